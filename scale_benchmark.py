@@ -0,0 +1,377 @@
+#!/usr/bin/python
+
+import argparse
+import json
+import os
+import random
+import shutil
+import subprocess
+import sys
+import time
+
+CQUERY_PATH = 'build/release/bin/cquery'
+WORK_DIR = 'benchmark_projects'
+# Latency histograms recorded by the indexer for every translation unit.
+INDEXER_STAGES = [
+    'indexer.stage.parse', 'indexer.stage.index', 'indexer.stage.macros',
+    'indexer.parse_time'
+]
+
+# Generates synthetic C++ projects of increasing size and runs cquery's full
+# import pipeline on each of them, then measures query latencies against the
+# finished index. This finds scaling problems that the tiny index_tests never
+# hit.
+#
+# A project of N translation units has N * headers_per_tu headers. Every header
+# includes |fanout| lower-numbered headers, so the include graph is a DAG, and
+# defines |symbols| functions, a struct and a template chain |template_depth|
+# deep. Every translation unit includes |fanout| headers and calls into them.
+#
+# The benchmark is a session replayed with `cquery --replay`: initialize, wait
+# for the import, then a fixed set of requests. See --replay in `cquery --help`.
+
+
+def WriteFile(path, contents):
+  with open(path, 'w') as f:
+    f.write(contents)
+
+
+def GenerateHeader(index, includes, args):
+  lines = ['#pragma once', '']
+  for include in includes:
+    lines.append('#include "h%d.h"' % include)
+  lines.append('')
+  lines.append('namespace ns%d {' % index)
+  lines.append('')
+  lines.append('template <int N>')
+  lines.append('struct Chain%d_0 { static constexpr int value = N; };' % index)
+  for depth in range(1, args.template_depth + 1):
+    lines.append('template <int N>')
+    lines.append('struct Chain%d_%d {' % (index, depth))
+    lines.append('  static constexpr int value = Chain%d_%d<N + 1>::value;' %
+                 (index, depth - 1))
+    lines.append('};')
+  lines.append('')
+  lines.append('struct Type%d {' % index)
+  lines.append('  int field;')
+  lines.append('  int Method(int x) const { return x + field; }')
+  lines.append('};')
+  lines.append('')
+  for symbol in range(args.symbols):
+    lines.append('int Func%d_%d(int x);' % (index, symbol))
+  lines.append('')
+  lines.append('}  // namespace ns%d' % index)
+  return '\n'.join(lines) + '\n'
+
+
+def GenerateSource(index, includes, args):
+  lines = []
+  for include in includes:
+    lines.append('#include "h%d.h"' % include)
+  lines.append('')
+  for include in includes:
+    for symbol in range(args.symbols):
+      if (index + symbol) % len(includes) == includes.index(include):
+        lines.append('int ns%d::Func%d_%d(int x) { return x * %d; }' %
+                     (include, include, symbol, index + 1))
+  lines.append('')
+  lines.append('int Entry%d() {' % index)
+  lines.append('  int total = 0;')
+  for include in includes:
+    lines.append('  ns%d::Type%d t%d{%d};' % (include, include, include, index))
+    lines.append('  total += t%d.Method(ns%d::Func%d_0(total));' %
+                 (include, include, include))
+    lines.append('  total += ns%d::Chain%d_%d<0>::value;' %
+                 (include, include, args.template_depth))
+  lines.append('  return total;')
+  lines.append('}')
+  return '\n'.join(lines) + '\n'
+
+
+def GenerateProject(root, num_files, args):
+  """
+  Writes a project with |num_files| translation units and its
+  compile_commands.json to |root|.
+  """
+  shutil.rmtree(root, ignore_errors=True)
+  os.makedirs(os.path.join(root, 'include'))
+  os.makedirs(os.path.join(root, 'src'))
+
+  rng = random.Random(args.seed)
+  num_headers = max(1, int(num_files * args.headers_per_tu))
+  for index in range(num_headers):
+    includes = rng.sample(range(index), min(index, args.fanout))
+    WriteFile(os.path.join(root, 'include', 'h%d.h' % index),
+              GenerateHeader(index, sorted(includes), args))
+
+  commands = []
+  for index in range(num_files):
+    includes = rng.sample(range(num_headers), min(num_headers, args.fanout))
+    path = os.path.join(root, 'src', 't%d.cc' % index)
+    WriteFile(path, GenerateSource(index, sorted(includes), args))
+    commands.append({
+        'directory': root,
+        'file': path,
+        'command': 'clang++ -std=c++11 -Iinclude -c %s' % path
+    })
+  WriteFile(os.path.join(root, 'compile_commands.json'),
+            json.dumps(commands, indent=1))
+  return num_headers
+
+
+def FindPosition(path, text):
+  """
+  Returns the LSP position of the first occurrence of |text| in |path|.
+  """
+  with open(path) as f:
+    for (line, contents) in enumerate(f):
+      character = contents.find(text)
+      if character >= 0:
+        return {'line': line, 'character': character}
+  raise Exception('%s not found in %s' % (text, path))
+
+
+def WriteSession(path, root, cache_dir, num_files):
+  """
+  Writes the session replayed by cquery: import the project, then send
+  requests 50ms apart against the idle index.
+  """
+  root_uri = 'file://' + ('' if root.startswith('/') else '/') + root
+  source = os.path.join(root, 'src', 't0.cc')
+  header = os.path.join(root, 'include', 'h0.h')
+  source_uri = root_uri + '/src/t0.cc'
+  header_uri = root_uri + '/include/h0.h'
+  with open(source) as f:
+    source_text = f.read()
+
+  messages = [
+      {
+          'id': 0,
+          'method': 'initialize',
+          'params': {
+              'processId': None,
+              'rootUri': root_uri,
+              'capabilities': {},
+              'initializationOptions': {
+                  'cacheDirectory': cache_dir
+              }
+          }
+      },
+      {'method': 'initialized', 'params': {}},
+      # Replay pauses here until the import is done.
+      {'method': '$cquery/wait'},
+      {
+          'method': 'textDocument/didOpen',
+          'params': {
+              'textDocument': {
+                  'uri': source_uri,
+                  'languageId': 'cpp',
+                  'version': 0,
+                  'text': source_text
+              }
+          }
+      },
+  ]
+
+  def Request(method, params):
+    messages.append({'id': len(messages), 'method': method, 'params': params})
+
+  for query in ['Func0_', 'Type1', 'Chain2_', 'Entry%d' % (num_files - 1)]:
+    Request('workspace/symbol', {'query': query})
+  Request('textDocument/documentSymbol', {'textDocument': {'uri': source_uri}})
+  # A call from t0.cc into a header.
+  Request('textDocument/definition', {
+      'textDocument': {'uri': source_uri},
+      'position': FindPosition(source, '::Func')
+  })
+  # Headers only include lower-numbered headers, so h0.h is included the most
+  # and its symbols have the most references.
+  Request('textDocument/references', {
+      'textDocument': {'uri': header_uri},
+      'position': FindPosition(header, 'Type0'),
+      'context': {'includeDeclaration': True}
+  })
+  Request('$cquery/callers', {
+      'textDocument': {'uri': header_uri},
+      'position': FindPosition(header, 'Func0_0')
+  })
+
+  with open(path, 'w') as f:
+    for (index, message) in enumerate(messages):
+      message['jsonrpc'] = '2.0'
+      payload = json.dumps(message)
+      f.write('Cquery-Time-Ms: %d\r\nContent-Length: %d\r\n\r\n%s' %
+              (index * 50, len(payload.encode('utf-8')), payload))
+
+
+def RunCquery(cmd, log_path):
+  """
+  Runs |cmd| and returns (exit_code, peak RSS in MB or None).
+  """
+  with open(log_path, 'w') as log:
+    process = subprocess.Popen(cmd, stdout=log, stderr=subprocess.STDOUT)
+    if not hasattr(os, 'wait4'):
+      return (process.wait(), None)
+    (_, status, rusage) = os.wait4(process.pid, 0)
+    process.returncode = os.WEXITSTATUS(status)
+    # ru_maxrss is in kilobytes on Linux and in bytes on macOS.
+    scale = 1e6 if sys.platform == 'darwin' else 1e3
+    return (process.returncode, rusage.ru_maxrss / scale)
+
+
+def RunBenchmark(args, num_files):
+  name = 'p%d' % num_files
+  root = os.path.abspath(os.path.join(args.work_dir, name))
+  cache_dir = os.path.abspath(os.path.join(args.work_dir, name + '_cache'))
+  session = os.path.join(args.work_dir, name + '.in')
+  report_path = os.path.join(args.work_dir, name + '.json')
+  shutil.rmtree(cache_dir, ignore_errors=True)
+
+  print('== Generating %d translation units in %s ==' % (num_files, root))
+  num_headers = GenerateProject(root, num_files, args)
+  WriteSession(session, root, cache_dir, num_files)
+
+  print('== Running cquery ==')
+  start = time.time()
+  (exit_code, peak_rss_mb) = RunCquery(
+      [args.cquery, '--replay', session, '--replay-report', report_path],
+      os.path.join(args.work_dir, name + '.log'))
+  wall_seconds = time.time() - start
+  if exit_code != 0 or not os.path.exists(report_path):
+    print('cquery failed with exit_code=%s; see %s.log' % (exit_code, name))
+    return None
+
+  with open(report_path) as f:
+    report = json.load(f)
+  import_seconds = report['importMs'] / 1000
+  result = {
+      'files': num_files,
+      'headers': num_headers,
+      'importSeconds': import_seconds,
+      'filesPerSecond': num_files / import_seconds if import_seconds else 0,
+      'wallSeconds': wall_seconds,
+      'peakRssMb': peak_rss_mb,
+      'unanswered': report['unanswered'],
+      'methods': report['methods'],
+      'metrics': report.get('metrics')
+  }
+  if not args.keep:
+    shutil.rmtree(root, ignore_errors=True)
+    shutil.rmtree(cache_dir, ignore_errors=True)
+  return result
+
+
+def PrintResults(results):
+  methods = []
+  for result in results:
+    for method in result['methods']:
+      if method['method'] not in methods:
+        methods.append(method['method'])
+
+  print('')
+  print('%8s %8s %10s %9s %9s' % ('files', 'headers', 'import s', 'files/s',
+                                  'peak MB'))
+  for result in results:
+    print('%8d %8d %10.1f %9.1f %9s' %
+          (result['files'], result['headers'], result['importSeconds'],
+           result['filesPerSecond'],
+           '%.0f' % result['peakRssMb'] if result['peakRssMb'] else '?'))
+
+  print('')
+  print('p50 / p99 latency in ms after the import')
+  print('%-32s' % 'method' +
+        ''.join('%16s' % ('%d files' % r['files']) for r in results))
+  for name in methods:
+    row = '%-32s' % name
+    for result in results:
+      found = [m for m in result['methods'] if m['method'] == name]
+      if found:
+        row += '%16s' % ('%.1f / %.1f' % (found[0]['p50Ms'], found[0]['p99Ms']))
+      else:
+        row += '%16s' % '-'
+    print(row)
+
+  # Compare these between commits to see which part of indexing a change sped
+  # up. Worker processes (index.outOfProcess) keep their own metrics.
+  print('')
+  print('mean ms per translation unit in each indexer stage')
+  print('%-32s' % 'stage' +
+        ''.join('%16s' % ('%d files' % r['files']) for r in results))
+  for stage in INDEXER_STAGES:
+    row = '%-32s' % stage
+    for result in results:
+      histograms = (result['metrics'] or {}).get('histograms', [])
+      found = [h for h in histograms if h['name'] == stage]
+      row += '%16s' % ('%.2f' % found[0]['meanMs'] if found else '-')
+    print(row)
+
+
+def PrintStageComparison(baseline, results):
+  # Matches runs by project size, so the baseline may cover other sizes too.
+  print('')
+  print('mean ms per translation unit in each indexer stage, before -> after')
+  for result in results:
+    before = [b for b in baseline if b['files'] == result['files']]
+    if not before:
+      continue
+    print('%d files' % result['files'])
+    for stage in INDEXER_STAGES:
+      means = []
+      for run in (before[0], result):
+        histograms = (run.get('metrics') or {}).get('histograms', [])
+        found = [h for h in histograms if h['name'] == stage]
+        means.append(found[0]['meanMs'] if found else None)
+      if None in means:
+        print('  %-30s %s' % (stage, '-'))
+        continue
+      change = ('%+.1f%%' % (100.0 * (means[1] - means[0]) / means[0])
+                if means[0] else '-')
+      print('  %-30s %10.2f -> %10.2f %9s' % (stage, means[0], means[1],
+                                              change))
+
+
+def main():
+  parser = argparse.ArgumentParser(
+      description='Benchmark cquery on generated projects of increasing size.')
+  parser.add_argument('--cquery', default=CQUERY_PATH)
+  parser.add_argument('--work-dir', default=WORK_DIR)
+  parser.add_argument('--sizes', default='1000,10000,100000',
+                      help='comma separated translation unit counts')
+  parser.add_argument('--headers-per-tu', type=float, default=0.5)
+  parser.add_argument('--fanout', type=int, default=8,
+                      help='headers included by each file')
+  parser.add_argument('--template-depth', type=int, default=4)
+  parser.add_argument('--symbols', type=int, default=20,
+                      help='functions declared by each header')
+  parser.add_argument('--seed', type=int, default=0)
+  parser.add_argument('--output', help='also write the results here as JSON')
+  parser.add_argument('--baseline',
+                      help='--output of an earlier run to compare the '
+                      'indexer stages with')
+  parser.add_argument('--keep', action='store_true',
+                      help='do not delete the generated projects')
+  args = parser.parse_args()
+
+  if not os.path.isdir(args.work_dir):
+    os.makedirs(args.work_dir)
+
+  results = []
+  success = True
+  for size in args.sizes.split(','):
+    result = RunBenchmark(args, int(size))
+    if not result or result['unanswered']:
+      success = False
+    if result:
+      results.append(result)
+
+  PrintResults(results)
+  if args.baseline:
+    with open(args.baseline) as f:
+      PrintStageComparison(json.load(f), results)
+  if args.output:
+    WriteFile(args.output, json.dumps(results, indent=2))
+  return 0 if success else 1
+
+
+if __name__ == '__main__':
+  sys.exit(main())
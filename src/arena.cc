@@ -0,0 +1,73 @@
+#include "arena.h"
+
+#include <doctest/doctest.h>
+
+#include <cstdint>
+
+void* Arena::Allocate(size_t size, size_t alignment) {
+  bytes_allocated_ += size;
+
+  // Large allocations would waste most of a block.
+  if (size > kBlockSize / 4) {
+    large_.emplace_back(new char[size + alignment]);
+    uintptr_t start = reinterpret_cast<uintptr_t>(large_.back().get());
+    return reinterpret_cast<void*>((start + alignment - 1) &
+                                   ~uintptr_t(alignment - 1));
+  }
+
+  while (true) {
+    if (current_ < blocks_.size()) {
+      uintptr_t start = reinterpret_cast<uintptr_t>(blocks_[current_].get());
+      uintptr_t aligned =
+          (start + offset_ + alignment - 1) & ~uintptr_t(alignment - 1);
+      if (aligned + size <= start + kBlockSize) {
+        offset_ = aligned + size - start;
+        return reinterpret_cast<void*>(aligned);
+      }
+      ++current_;
+      offset_ = 0;
+    } else {
+      blocks_.emplace_back(new char[kBlockSize]);
+    }
+  }
+}
+
+void Arena::Reset() {
+  if (blocks_.size() > kMaxRetainedBlocks)
+    blocks_.resize(kMaxRetainedBlocks);
+  large_.clear();
+  current_ = 0;
+  offset_ = 0;
+  bytes_allocated_ = 0;
+}
+
+TEST_SUITE("Arena") {
+  TEST_CASE("allocations are aligned and distinct") {
+    Arena arena;
+    char* c = static_cast<char*>(arena.Allocate(1, 1));
+    double* d = static_cast<double*>(arena.Allocate(sizeof(double), 8));
+    REQUIRE(reinterpret_cast<uintptr_t>(d) % 8 == 0);
+    REQUIRE(reinterpret_cast<char*>(d) > c);
+    void* large = arena.Allocate(1024 * 1024, 16);
+    REQUIRE(reinterpret_cast<uintptr_t>(large) % 16 == 0);
+    REQUIRE(arena.bytes_allocated() == 1 + sizeof(double) + 1024 * 1024);
+  }
+
+  TEST_CASE("containers") {
+    Arena arena;
+    for (int round = 0; round < 2; ++round) {
+      {
+        ArenaUnorderedMap<int, int> map{ArenaAllocator<int>(&arena)};
+        for (int i = 0; i < 100000; ++i)
+          map[i] = i * 2;
+        REQUIRE(map.size() == 100000);
+        REQUIRE(map[4242] == 8484);
+        std::vector<int, ArenaAllocator<int>> vec{ArenaAllocator<int>(&arena)};
+        vec.assign(1000, 7);
+        REQUIRE(vec[999] == 7);
+      }
+      arena.Reset();
+      REQUIRE(arena.bytes_allocated() == 0);
+    }
+  }
+}
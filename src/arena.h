@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// Bump allocator for data which is freed all at once. Allocations are carved
+// out of large blocks, deallocation is a no-op, and Reset() makes the blocks
+// available again. Not thread-safe; each indexer thread has its own.
+struct Arena {
+  Arena() = default;
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+  void* Allocate(size_t size, size_t alignment);
+
+  // Invalidates everything allocated so far. Keeps some of the blocks so the
+  // next user does not have to go back to malloc.
+  void Reset();
+
+  // Bytes handed out since the last Reset().
+  size_t bytes_allocated() const { return bytes_allocated_; }
+
+ private:
+  static const size_t kBlockSize = 256 * 1024;
+  // Blocks kept by Reset(); at most 4MB per thread.
+  static const size_t kMaxRetainedBlocks = 16;
+
+  std::vector<std::unique_ptr<char[]>> blocks_;
+  // Allocations too large for a block; freed by Reset().
+  std::vector<std::unique_ptr<char[]>> large_;
+  // Allocation continues at |offset_| in blocks_[current_].
+  size_t current_ = 0;
+  size_t offset_ = 0;
+  size_t bytes_allocated_ = 0;
+};
+
+// Standard allocator on top of an Arena, for containers which do not outlive
+// the arena's next Reset().
+template <typename T>
+struct ArenaAllocator {
+  using value_type = T;
+
+  explicit ArenaAllocator(Arena* arena) : arena(arena) {}
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(arena->Allocate(n * sizeof(T), alignof(T)));
+  }
+  void deallocate(T*, size_t) {}
+
+  Arena* arena;
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+  return a.arena == b.arena;
+}
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+  return a.arena != b.arena;
+}
+
+template <typename TKey, typename TValue>
+using ArenaUnorderedMap =
+    std::unordered_map<TKey,
+                       TValue,
+                       std::hash<TKey>,
+                       std::equal_to<TKey>,
+                       ArenaAllocator<std::pair<const TKey, TValue>>>;
+template <typename T>
+using ArenaUnorderedSet =
+    std::unordered_set<T, std::hash<T>, std::equal_to<T>, ArenaAllocator<T>>;
@@ -3,58 +3,169 @@
 #include "config.h"
 #include "indexer.h"
 #include "lsp.h"
+#include "metrics.h"
 #include "platform.h"
 
 #include <loguru/loguru.hpp>
 
 #include <algorithm>
+#include <random>
 #include <unordered_map>
 
 namespace {
 
+// Stands in for the project root in paths stored by a relocatable cache.
+const char kRelocatedProjectRoot[] = "<project>/";
+
+// Relocatable caches cannot key on the project root, which changes when the
+// cache is moved. They use the name of the root directory instead, which
+// usually does not, and still keeps projects sharing |cacheDirectory| apart.
+std::string RelocatableProjectName() {
+  std::string root = g_config->projectRoot;
+  if (!root.empty() && root.back() == '/')
+    root.pop_back();
+  return EscapeFileName(GetBaseName(root));
+}
+
+// Cache directories for files inside and outside of the project.
+std::string ProjectCacheDirectory() {
+  if (g_config->relocatableCache)
+    return g_config->cacheDirectory + RelocatableProjectName() + '/';
+  return g_config->cacheDirectory + EscapeFileName(g_config->projectRoot) +
+         '/';
+}
+// Files outside of the project go to the shared system header cache if there
+// is one, in the directory for |system_cache_key| (see
+// ICacheManager::GetSystemCacheKey).
+std::string ExternalCacheDirectory(const std::string& system_cache_key) {
+  if (!g_config->systemCacheDirectory.empty())
+    return g_config->systemCacheDirectory + system_cache_key + '/';
+  if (g_config->relocatableCache)
+    return g_config->cacheDirectory + '@' + RelocatableProjectName() + '/';
+  return g_config->cacheDirectory + '@' +
+         EscapeFileName(g_config->projectRoot) + '/';
+}
+
+// Writes |content| to |path| through a temporary file, so processes reading
+// |path| concurrently never see a partial file. Used for the shared system
+// header cache, which every project on the machine writes to.
+void WriteToFileAtomically(const std::string& path,
+                           const std::string& content) {
+  std::string temp_path =
+      path + ".tmp" + std::to_string(std::random_device()());
+  WriteToFile(temp_path, content);
+  MoveFileTo(AbsolutePath::BuildDoNotUse(path),
+             AbsolutePath::BuildDoNotUse(temp_path));
+}
+
+void RebasePath(std::string& path,
+                const std::string& from,
+                const std::string& to) {
+  if (StartsWith(path, from))
+    path = to + path.substr(from.size());
+}
+
+// Rewrites the prefix |from| of every path stored in |file| to |to|. Symbol
+// data only holds ranges, so these are the only fields that need it.
+void RebasePaths(IndexFile& file,
+                 const std::string& from,
+                 const std::string& to) {
+  RebasePath(file.import_file.path, from, to);
+  for (AbsolutePath& dependency : file.dependencies)
+    RebasePath(dependency.path, from, to);
+  for (IndexInclude& include : file.includes)
+    RebasePath(include.resolved_path, from, to);
+  // Arguments may embed paths anywhere, eg, -I/path/to/project/include.
+  std::vector<std::string> args = file.args.Get();
+  for (std::string& arg : args) {
+    for (size_t i = 0; (i = arg.find(from, i)) != std::string::npos;
+         i += to.size())
+      arg.replace(i, from.size(), to);
+  }
+  file.args = InternedArgs(args, file.import_file);
+}
+
 // Manages loading caches from file paths for the indexer process.
 struct RealCacheManager : ICacheManager {
-  explicit RealCacheManager() {}
+  explicit RealCacheManager(optional<std::string> system_cache_key)
+      : system_cache_key_(std::move(system_cache_key)) {}
   ~RealCacheManager() override = default;
 
   void WriteToCache(IndexFile& file) override {
-    std::string cache_path = GetCachePath(file.path);
-    WriteToFile(cache_path, file.file_contents);
+    std::string cache_path;
+    bool is_shared = IsInSystemCache(file.path);
+    if (is_shared) {
+      // |file| was indexed with the arguments of the translation unit that
+      // included it.
+      std::string directory =
+          ExternalCacheDirectory(GetSystemCacheKey(file.args.Get()));
+      MakeDirectoryRecursive(AbsolutePath::BuildDoNotUse(directory));
+      cache_path = directory + EscapeFileName(file.path);
+    } else {
+      cache_path = *GetCachePath(file.path);
+    }
+    std::string indexed_content;
+    if (g_config->relocatableCache) {
+      // |file| is still used after this, so restore its paths.
+      RebasePaths(file, g_config->projectRoot, kRelocatedProjectRoot);
+      indexed_content = Serialize(g_config->cacheFormat, file);
+      RebasePaths(file, kRelocatedProjectRoot, g_config->projectRoot);
+    } else {
+      indexed_content = Serialize(g_config->cacheFormat, file);
+    }
+    auto write = is_shared ? &WriteToFileAtomically : &WriteToFile;
+    write(AppendSerializationFormat(cache_path), indexed_content);
 
-    std::string indexed_content = Serialize(g_config->cacheFormat, file);
-    WriteToFile(AppendSerializationFormat(cache_path), indexed_content);
+    std::vector<IndexSymbolDocs> docs = file.CollectDocs();
+    write(AppendSerializationFormat(cache_path + ".docs"),
+          SerializeDocs(g_config->cacheFormat, docs));
   }
 
-  optional<std::string> LoadCachedFileContents(
+  optional<std::vector<IndexSymbolDocs>> LoadDocs(
       const std::string& path) override {
-    return ReadContent(GetCachePath(path));
+    optional<std::string> cache_path = GetCachePath(path);
+    if (!cache_path)
+      return nullopt;
+    optional<std::string> content =
+        ReadContent(AppendSerializationFormat(*cache_path + ".docs"));
+    if (!content)
+      return nullopt;
+    return DeserializeDocs(g_config->cacheFormat, *content);
   }
 
   std::unique_ptr<IndexFile> RawCacheLoad(const std::string& path) override {
-    std::string cache_path = GetCachePath(path);
-    optional<std::string> file_content = ReadContent(cache_path);
+    optional<std::string> cache_path = GetCachePath(path);
+    if (!cache_path)
+      return nullptr;
     optional<std::string> serialized_indexed_content =
-        ReadContent(AppendSerializationFormat(cache_path));
-    if (!file_content || !serialized_indexed_content)
+        ReadContent(AppendSerializationFormat(*cache_path));
+    if (!serialized_indexed_content)
       return nullptr;
 
-    return Deserialize(g_config->cacheFormat, path, *serialized_indexed_content,
-                       *file_content, IndexFile::kMajorVersion);
+    std::unique_ptr<IndexFile> file =
+        Deserialize(g_config->cacheFormat, path, *serialized_indexed_content,
+                    IndexFile::kMajorVersion);
+    if (file && g_config->relocatableCache)
+      RebasePaths(*file, kRelocatedProjectRoot, g_config->projectRoot);
+    return file;
+  }
+
+  bool IsInSystemCache(const std::string& source_file) {
+    return !g_config->systemCacheDirectory.empty() &&
+           !StartsWith(source_file, g_config->projectRoot);
   }
 
-  std::string GetCachePath(const std::string& source_file) {
+  // Returns nullopt for files in the shared system header cache if this cache
+  // manager does not know the arguments they are indexed with.
+  optional<std::string> GetCachePath(const std::string& source_file) {
     assert(!g_config->cacheDirectory.empty());
-    std::string cache_file;
     size_t len = g_config->projectRoot.size();
-    if (StartsWith(source_file, g_config->projectRoot)) {
-      cache_file = EscapeFileName(g_config->projectRoot) + '/' +
-                   EscapeFileName(source_file.substr(len));
-    } else {
-      cache_file = '@' + EscapeFileName(g_config->projectRoot) + '/' +
-                   EscapeFileName(source_file);
-    }
-
-    return g_config->cacheDirectory + cache_file;
+    if (StartsWith(source_file, g_config->projectRoot))
+      return ProjectCacheDirectory() + EscapeFileName(source_file.substr(len));
+    if (IsInSystemCache(source_file) && !system_cache_key_)
+      return nullopt;
+    return ExternalCacheDirectory(system_cache_key_.value_or("")) +
+           EscapeFileName(source_file);
   }
 
   std::string AppendSerializationFormat(const std::string& base) {
@@ -67,6 +178,8 @@ struct RealCacheManager : ICacheManager {
     assert(false);
     return ".json";
   }
+
+  optional<std::string> system_cache_key_;
 };
 
 struct FakeCacheManager : ICacheManager {
@@ -76,22 +189,15 @@ struct FakeCacheManager : ICacheManager {
   // TODO: should we allow tests to write cache files?
   void WriteToCache(IndexFile& file) override {}
 
-  optional<std::string> LoadCachedFileContents(
+  optional<std::vector<IndexSymbolDocs>> LoadDocs(
       const std::string& path) override {
-    for (const FakeCacheEntry& entry : entries_) {
-      if (entry.path == path) {
-        return entry.content;
-      }
-    }
-
     return nullopt;
   }
 
   std::unique_ptr<IndexFile> RawCacheLoad(const std::string& path) override {
     for (const FakeCacheEntry& entry : entries_) {
       if (entry.path == path) {
-        return Deserialize(SerializeFormat::Json, path, entry.json, "<empty>",
-                           nullopt);
+        return Deserialize(SerializeFormat::Json, path, entry.json, nullopt);
       }
     }
 
@@ -101,11 +207,80 @@ struct FakeCacheManager : ICacheManager {
   std::vector<FakeCacheEntry> entries_;
 };
 
+enum class CacheLookup { kMemoryHit, kDiskHit, kMiss };
+
+// Counts where cache lookups were served from, for $cquery/metrics.
+void CountCacheLookup(CacheLookup result) {
+  static std::atomic<long long>* memory_hits = GetCounter("cache.memory_hits");
+  static std::atomic<long long>* disk_hits = GetCounter("cache.disk_hits");
+  static std::atomic<long long>* misses = GetCounter("cache.misses");
+  switch (result) {
+    case CacheLookup::kMemoryHit:
+      ++*memory_hits;
+      break;
+    case CacheLookup::kDiskHit:
+      ++*disk_hits;
+      break;
+    case CacheLookup::kMiss:
+      ++*misses;
+      break;
+  }
+}
+
 }  // namespace
 
 // static
 std::shared_ptr<ICacheManager> ICacheManager::Make() {
-  return std::make_shared<RealCacheManager>();
+  return std::make_shared<RealCacheManager>(nullopt);
+}
+
+// static
+std::shared_ptr<ICacheManager> ICacheManager::Make(
+    const std::vector<std::string>& args) {
+  return std::make_shared<RealCacheManager>(GetSystemCacheKey(args));
+}
+
+// static
+std::string ICacheManager::GetSystemCacheKey(
+    const std::vector<std::string>& args) {
+  // Arguments which change what system headers expand to. The ones in
+  // |kSeparateValue| may take their value as the next argument.
+  static const std::vector<std::string> kFlags = {
+      "-D", "-U", "-std=", "-isystem", "-target", "--target=", "-isysroot",
+      "--sysroot", "-stdlib=", "-x", "-nostdinc", "-include"};
+  static const std::vector<std::string> kSeparateValue = {
+      "-D", "-U", "-isystem", "-target", "-isysroot", "--sysroot", "-x",
+      "-include"};
+  std::string key = GetClangVersion() + '|' + g_config->resourceDirectory;
+  for (size_t i = 0; i < args.size(); ++i) {
+    if (!StartsWithAny(args[i], kFlags))
+      continue;
+    key += '|' + args[i];
+    if (ContainsValue(kSeparateValue, args[i]) && i + 1 < args.size())
+      key += ' ' + args[++i];
+  }
+  return std::to_string(HashUsr(key));
+}
+
+// static
+void ICacheManager::MakeCacheDirectories() {
+  if (!g_config->systemCacheDirectory.empty()) {
+    optional<AbsolutePath> dir = NormalizePath(g_config->systemCacheDirectory,
+                                               false /*ensure_exists*/);
+    if (dir)
+      g_config->systemCacheDirectory = dir->path;
+    EnsureEndsInSlash(g_config->systemCacheDirectory);
+  }
+  MakeDirectoryRecursive(ProjectCacheDirectory());
+  // Directories of the shared system header cache are made as they are
+  // written.
+  if (g_config->systemCacheDirectory.empty())
+    MakeDirectoryRecursive(ExternalCacheDirectory(std::string()));
+}
+
+// static
+std::string ICacheManager::GetProjectCachePath(const std::string& name) {
+  return ProjectCacheDirectory() + name;
 }
 
 // static
@@ -118,10 +293,13 @@ ICacheManager::~ICacheManager() = default;
 
 IndexFile* ICacheManager::TryLoad(const std::string& path) {
   auto it = caches_.find(path);
-  if (it != caches_.end())
+  if (it != caches_.end()) {
+    CountCacheLookup(CacheLookup::kMemoryHit);
     return it->second.get();
+  }
 
   std::unique_ptr<IndexFile> cache = RawCacheLoad(path);
+  CountCacheLookup(cache ? CacheLookup::kDiskHit : CacheLookup::kMiss);
   if (!cache)
     return nullptr;
 
@@ -133,12 +311,15 @@ std::unique_ptr<IndexFile> ICacheManager::TryTakeOrLoad(
     const std::string& path) {
   auto it = caches_.find(path);
   if (it != caches_.end()) {
+    CountCacheLookup(CacheLookup::kMemoryHit);
     auto result = std::move(it->second);
     caches_.erase(it);
     return result;
   }
 
-  return RawCacheLoad(path);
+  std::unique_ptr<IndexFile> result = RawCacheLoad(path);
+  CountCacheLookup(result ? CacheLookup::kDiskHit : CacheLookup::kMiss);
+  return result;
 }
 
 std::unique_ptr<IndexFile> ICacheManager::TakeOrLoad(const std::string& path) {
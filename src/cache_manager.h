@@ -2,6 +2,7 @@
 
 #include <optional.h>
 
+#include <cstdint>
 #include <functional>
 #include <memory>
 #include <string>
@@ -10,18 +11,36 @@
 
 struct Config;
 struct IndexFile;
+struct IndexSymbolDocs;
 
 struct ICacheManager {
   struct FakeCacheEntry {
     std::string path;
-    std::string content;
     std::string json;
   };
 
+  // The cache manager only loads indexes from the shared system header cache
+  // (see Config::systemCacheDirectory) if it is made with the arguments of the
+  // translation unit the indexes are for.
   static std::shared_ptr<ICacheManager> Make();
+  static std::shared_ptr<ICacheManager> Make(
+      const std::vector<std::string>& args);
   static std::shared_ptr<ICacheManager> MakeFake(
       const std::vector<FakeCacheEntry>& entries);
 
+  // Creates the directories cache files for the current project are written
+  // to. Requires |g_config->cacheDirectory| and |projectRoot| to be set.
+  // Also normalizes |g_config->systemCacheDirectory|.
+  static void MakeCacheDirectories();
+  // Path of the project-wide file |name| in the project's cache directory.
+  // Names of cache files for sources never start with '@'.
+  static std::string GetProjectCachePath(const std::string& name);
+  // Key of the shared system header cache entries for translation units
+  // compiled with |args|. It covers the clang build and the arguments which
+  // change how headers are preprocessed, so only compatible translation units
+  // share an index.
+  static std::string GetSystemCacheKey(const std::vector<std::string>& args);
+
   virtual ~ICacheManager();
 
   // Tries to load a cache for |path|, returning null if there is none. The
@@ -38,7 +57,10 @@ struct ICacheManager {
 
   virtual void WriteToCache(IndexFile& file) = 0;
 
-  virtual optional<std::string> LoadCachedFileContents(
+  // Loads hover and comments of the symbols in |path| from its docs cache.
+  // Docs are not part of the IndexFile, so this reads from disk; see
+  // DocsCache.
+  virtual optional<std::vector<IndexSymbolDocs>> LoadDocs(
       const std::string& path) = 0;
 
   // Iterate over all loaded caches.
@@ -395,7 +395,7 @@ void TryEnsureDocumentParsed(ClangCompleteManager* manager,
   if (*tu)
     return;
 
-  std::vector<std::string> args = session->file.args;
+  std::vector<std::string> args = session->file.args.Get();
 
   // -fspell-checking enables FixIts for, ie, misspelled types.
   if (!AnyStartsWith(args, "-fno-spell-checking") &&
@@ -616,20 +616,25 @@ void CompletionQueryMain(ClangCompleteManager* completion_manager) {
 
 void DiagnosticsQueryMain(ClangCompleteManager* completion_manager) {
   while (true) {
-    // Fetching the completion request blocks until we have a request.
-    std::unique_ptr<ClangCompleteManager::DiagnosticRequest> request =
-        completion_manager->diagnostics_request_.Dequeue();
-    if (!request || !g_config->diagnostics.onType)
+    // Blocks until the user has stopped editing some file for the debounce
+    // interval. Any number of edits in that window result in a single reparse.
+    ClangCompleteManager::DiagnosticQueue::Clock::time_point requested_at;
+    std::string path =
+        completion_manager->diagnostics_request_.Dequeue(&requested_at);
+    if (!g_config->diagnostics.onType)
       continue;
 
-    std::string path = request->path;
-
     std::shared_ptr<CompletionSession> session =
         completion_manager->TryGetSession(path, true /*mark_as_completion*/,
                                           true /*create_if_needed*/);
 
     // At this point, we must have a translation unit. Block until we have one.
     std::lock_guard<std::mutex> lock(session->diagnostics.lock);
+    // The indexer may have parsed the file and published its diagnostics since
+    // this request was made (see NotifyIndexerDiagnostics).
+    if (completion_manager->diagnostics_request_.ParsedSince(path,
+                                                             requested_at))
+      continue;
     Timer timer;
     TryEnsureDocumentParsed(
         completion_manager, session, &session->diagnostics.tu,
@@ -700,9 +705,70 @@ ClangCompleteManager::CompletionRequest::CompletionRequest(
     const OnComplete& on_complete)
     : id(id), path(path), position(position), on_complete(on_complete) {}
 
-ClangCompleteManager::DiagnosticRequest::DiagnosticRequest(
-    const AbsolutePath& path)
-    : path(path) {}
+void ClangCompleteManager::DiagnosticQueue::Enqueue(const std::string& path,
+                                                   int debounce_ms) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Pending& pending = pending_[path];
+    pending.requested_at = Clock::now();
+    pending.deadline = pending.requested_at +
+                       std::chrono::milliseconds(std::max(debounce_ms, 0));
+  }
+  cv_.notify_one();
+}
+
+std::string ClangCompleteManager::DiagnosticQueue::Dequeue(
+    Clock::time_point* requested_at) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    if (pending_.empty()) {
+      cv_.wait(lock);
+      continue;
+    }
+
+    auto next = std::min_element(pending_.begin(), pending_.end(),
+                                 [](const auto& a, const auto& b) {
+                                   return a.second.deadline <
+                                          b.second.deadline;
+                                 });
+    Clock::time_point deadline = next->second.deadline;
+    if (Clock::now() < deadline) {
+      // A newer edit may push |deadline| back or add an earlier path, so
+      // re-evaluate after waking up.
+      cv_.wait_until(lock, deadline);
+      continue;
+    }
+
+    std::string path = next->first;
+    *requested_at = next->second.requested_at;
+    pending_.erase(next);
+    return path;
+  }
+}
+
+void ClangCompleteManager::DiagnosticQueue::MarkParsed(
+    const std::string& path,
+    Clock::time_point parsed_at) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Clock::time_point& last_parsed_at = last_parsed_at_[path];
+  last_parsed_at = std::max(last_parsed_at, parsed_at);
+  auto it = pending_.find(path);
+  if (it != pending_.end() && it->second.requested_at <= parsed_at)
+    pending_.erase(it);
+}
+
+bool ClangCompleteManager::DiagnosticQueue::ParsedSince(
+    const std::string& path,
+    Clock::time_point requested_at) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = last_parsed_at_.find(path);
+  return it != last_parsed_at_.end() && it->second >= requested_at;
+}
+
+void ClangCompleteManager::DiagnosticQueue::Forget(const std::string& path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  last_parsed_at_.erase(path);
+}
 
 ClangCompleteManager::ClangCompleteManager(Project* project,
                                            WorkingFiles* working_files,
@@ -734,16 +800,13 @@ void ClangCompleteManager::CodeComplete(
 }
 
 void ClangCompleteManager::DiagnosticsUpdate(const std::string& path) {
-  bool has = false;
-  diagnostics_request_.Iterate(
-      [&](const std::unique_ptr<DiagnosticRequest>& request) {
-        if (request->path == path)
-          has = true;
-      });
-  if (!has) {
-    diagnostics_request_.Enqueue(std::make_unique<DiagnosticRequest>(path),
-                                 true /*priority*/);
-  }
+  diagnostics_request_.Enqueue(path, g_config->diagnostics.debounceMs);
+}
+
+void ClangCompleteManager::NotifyIndexerDiagnostics(
+    const std::string& path,
+    DiagnosticQueue::Clock::time_point parsed_at) {
+  diagnostics_request_.MarkParsed(path, parsed_at);
 }
 
 void ClangCompleteManager::NotifyView(const AbsolutePath& filename) {
@@ -797,6 +860,8 @@ void ClangCompleteManager::NotifyClose(const AbsolutePath& filename) {
 
   // We should never have both a preloaded and completion session.
   assert((preloaded_ptr && completion_ptr) == false);
+
+  diagnostics_request_.Forget(filename);
 }
 
 bool ClangCompleteManager::EnsureCompletionOrCreatePreloadSession(
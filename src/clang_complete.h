@@ -12,10 +12,13 @@
 
 #include <clang-c/Index.h>
 
+#include <chrono>
+#include <condition_variable>
 #include <functional>
 #include <memory>
 #include <mutex>
 #include <string>
+#include <unordered_map>
 
 struct CompletionSession
     : public std::enable_shared_from_this<CompletionSession> {
@@ -70,10 +73,38 @@ struct ClangCompleteManager {
     lsPosition position;
     OnComplete on_complete;
   };
-  struct DiagnosticRequest {
-    DiagnosticRequest(const AbsolutePath& path);
-
-    AbsolutePath path;
+  // Pending diagnostic requests, keyed by path. Requests for the same path are
+  // coalesced; a path is only handed out once no new request for it has
+  // arrived for |debounce_ms|, ie, the user has stopped typing.
+  struct DiagnosticQueue {
+    using Clock = std::chrono::high_resolution_clock;
+
+    struct Pending {
+      // When the path was last enqueued.
+      Clock::time_point requested_at;
+      Clock::time_point deadline;
+    };
+
+    // Adds |path| to the queue, or pushes back its deadline if it is already
+    // pending.
+    void Enqueue(const std::string& path, int debounce_ms);
+    // Blocks until some path has been quiet for its debounce interval and
+    // returns it. |requested_at| is set to when it was last enqueued.
+    std::string Dequeue(Clock::time_point* requested_at);
+    // Records that diagnostics for |path| were published from a parse of its
+    // contents as of |parsed_at|. A pending request made before then is
+    // dropped.
+    void MarkParsed(const std::string& path, Clock::time_point parsed_at);
+    // Returns true if diagnostics for |path| were published from contents
+    // newer than |requested_at|.
+    bool ParsedSince(const std::string& path, Clock::time_point requested_at);
+    // Drops the parse time recorded for |path|, ie, when it is closed.
+    void Forget(const std::string& path);
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::unordered_map<std::string, Pending> pending_;
+    std::unordered_map<std::string, Clock::time_point> last_parsed_at_;
   };
 
   ClangCompleteManager(Project* project,
@@ -89,6 +120,11 @@ struct ClangCompleteManager {
                     const OnComplete& on_complete);
   // Request a diagnostics update.
   void DiagnosticsUpdate(const std::string& path);
+  // Notify the completion manager that the indexer published diagnostics for
+  // |path| from a full parse of its working file contents as of |parsed_at|.
+  // Diagnostics requests made before then are not reparsed.
+  void NotifyIndexerDiagnostics(const std::string& path,
+                                DiagnosticQueue::Clock::time_point parsed_at);
 
   // Notify the completion manager that |filename| has been viewed and we
   // should begin preloading completion data.
@@ -141,7 +177,7 @@ struct ClangCompleteManager {
 
   // Request a code completion at the given location.
   ThreadedQueue<std::unique_ptr<CompletionRequest>> completion_request_;
-  ThreadedQueue<std::unique_ptr<DiagnosticRequest>> diagnostics_request_;
+  DiagnosticQueue diagnostics_request_;
   // Parse requests. The path may already be parsed, in which case it should be
   // reparsed.
   ThreadedQueue<PreloadRequest> preload_requests_;
@@ -2,17 +2,20 @@
 
 #include "clang_cursor.h"
 #include "clang_utils.h"
+#include "metrics.h"
 #include "platform.h"
 #include "serializer.h"
 #include "timer.h"
 #include "type_printer.h"
 
+#include <doctest/doctest.h>
 #include <loguru.hpp>
 
 #include <algorithm>
 #include <cassert>
 #include <chrono>
 #include <climits>
+#include <deque>
 #include <iostream>
 
 // TODO: See if we can use clang_indexLoc_getFileLocation to get a type ref on
@@ -185,7 +188,10 @@ struct ConstructorCache {
     Usr usr;
     std::vector<std::string> param_type_desc;
   };
-  std::unordered_map<Usr, std::vector<Constructor>> constructors_;
+  ArenaUnorderedMap<Usr, std::vector<Constructor>> constructors_;
+
+  explicit ConstructorCache(Arena* arena)
+      : constructors_(ArenaAllocator<Usr>(arena)) {}
 
   // This should be called whenever there is a constructor declaration.
   void NotifyConstructor(ClangCursor ctor_cursor) {
@@ -278,8 +284,30 @@ struct ConstructorCache {
   }
 };
 
+// A use of |db|'s type, func or var |id|, waiting to be appended to its
+// |uses|.
+struct PendingUse {
+  IndexFile* db;
+  SymbolKind kind;
+  RawId id;
+  IndexId::LexicalRef ref;
+};
+
+// Uses are by far the most numerous references. Appending them straight to
+// |uses| reallocates each vector several times as it grows and leaves it with
+// spare capacity once the index is handed off. Instead they are logged in the
+// arena and moved into exactly sized vectors by FlushPendingUses.
+struct PendingUses {
+  // A deque, so growing the log does not leave dead copies in the arena.
+  std::deque<PendingUse, ArenaAllocator<PendingUse>> log;
+
+  explicit PendingUses(Arena* arena) : log(ArenaAllocator<PendingUse>(arena)) {}
+};
+
+// Per translation unit state of Parse. Its containers are allocated from a
+// per-thread arena, which is reset before the next translation unit.
 struct IndexParam {
-  std::unordered_set<CXFile> seen_cx_files;
+  ArenaUnorderedSet<CXFile> seen_cx_files;
   std::vector<AbsolutePath> seen_files;
 
   std::unordered_map<AbsolutePath, FileContents> file_contents;
@@ -298,8 +326,33 @@ struct IndexParam {
   NamespaceHelper ns;
   ConstructorCache ctors;
 
-  IndexParam(ClangTranslationUnit* tu, FileConsumer* file_consumer)
-      : tu(tu), file_consumer(file_consumer) {}
+  // Results of ConsumeFile, which do not change during a parse. Declarations
+  // and references mostly arrive in runs from the same file, so |last_file|
+  // answers most lookups; callbacks for the many declarations in headers
+  // owned by another translation unit then cost a pointer comparison.
+  ArenaUnorderedMap<CXFile, IndexFile*> file_to_db;
+  CXFile last_file = nullptr;
+  IndexFile* last_db = nullptr;
+  PendingUses uses;
+
+  // False for IndexFidelity::Reduced, which skips hover and comments.
+  bool index_docs = true;
+  // Null if indexing has no time limit.
+  ParseBudget* budget = nullptr;
+  // Started once the translation unit was parsed. The budget only covers
+  // indexing, since libclang cannot interrupt a parse.
+  Timer index_timer;
+
+  IndexParam(ClangTranslationUnit* tu,
+             FileConsumer* file_consumer,
+             Arena* arena)
+      : seen_cx_files(ArenaAllocator<CXFile>(arena)),
+        tu(tu),
+        file_consumer(file_consumer),
+        ns(arena),
+        ctors(arena),
+        file_to_db(ArenaAllocator<CXFile>(arena)),
+        uses(arena) {}
 
 #if CINDEX_HAVE_PRETTY
   CXPrintingPolicy print_policy = nullptr;
@@ -330,23 +383,29 @@ struct IndexParam {
 #endif
 };
 
-IndexFile* ConsumeFile(IndexParam* param, CXFile file) {
+// Takes ownership of |file| if possible. Called once per file; use ConsumeFile.
+IndexFile* ConsumeNewFile(IndexParam* param, CXFile file) {
   bool is_first_ownership = false;
   IndexFile* db =
       param->file_consumer->TryConsumeFile(file, &is_first_ownership);
 
+  if (db)
+    db->pending_uses_ = &param->uses;
+
   // If we are generating an index for the file:
   if (db && is_first_ownership) {
-    // Fetch indexed file contents from libclang.
+    // Fetch indexed file contents from libclang. The buffer lives as long as
+    // the translation unit, so it is used in place instead of copied.
     size_t size;
-    const char* contentsPtr =
+    const char* contents_ptr =
         clang_getFileContents(param->tu->cx_tu, file, &size);
-    std::string contents(contentsPtr, size);
+    std::string_view contents(contents_ptr, size);
 
-    // Update cached file contents.
-    db->file_contents = contents;
+    // Only line hashes are kept for the index; see IndexFile::line_hashes.
+    db->line_hashes = ToLineHashes(contents);
+    db->content_hash = HashUsr(contents);
     // Setup quick access to line offsets with the file.
-    param->file_contents[db->path] = FileContents(db->path, contents);
+    param->file_contents[db->path] = FileContents::View(db->path, contents);
     // Set modification time.
     db->last_modification_time = clang_getFileTime(file);
   }
@@ -375,6 +434,129 @@ IndexFile* ConsumeFile(IndexParam* param, CXFile file) {
   return db;
 }
 
+// Returns the IndexFile for |file|, or null if another translation unit owns
+// it. A null |file| is never owned.
+IndexFile* ConsumeFile(IndexParam* param, CXFile file) {
+  if (file == param->last_file)
+    return param->last_db;
+
+  IndexFile* db;
+  auto it = param->file_to_db.find(file);
+  if (it != param->file_to_db.end()) {
+    db = it->second;
+  } else {
+    db = ConsumeNewFile(param, file);
+    param->file_to_db[file] = db;
+  }
+  param->last_file = file;
+  param->last_db = db;
+  return db;
+}
+
+uint64_t HashCombine(const std::vector<uint64_t>& hashes) {
+  return HashUsr(std::string_view(reinterpret_cast<const char*>(hashes.data()),
+                                  hashes.size() * sizeof(uint64_t)));
+}
+
+// A file entered by the preprocessor, see SetIncludeContextHashes.
+struct Inclusion {
+  CXFile file;
+  // Hashes of the text before each #include which led to |file|, innermost
+  // first. Empty for the main file.
+  std::vector<uint64_t> prefix_hashes;
+};
+
+struct InclusionParam {
+  CXTranslationUnit cx_tu;
+  std::vector<Inclusion> inclusions;
+  std::unordered_map<CXFile, uint64_t> content_hashes;
+  std::unordered_map<CXFile, std::unordered_map<unsigned, uint64_t>>
+      prefix_hashes;
+
+  explicit InclusionParam(CXTranslationUnit cx_tu) : cx_tu(cx_tu) {}
+
+  uint64_t ContentHash(CXFile file) {
+    auto it = content_hashes.find(file);
+    if (it != content_hashes.end())
+      return it->second;
+    size_t size = 0;
+    const char* contents = clang_getFileContents(cx_tu, file, &size);
+    if (!contents)
+      size = 0;
+    uint64_t hash = HashUsr(std::string_view(contents, size));
+    content_hashes[file] = hash;
+    return hash;
+  }
+
+  uint64_t PrefixHash(CXFile file, unsigned offset) {
+    auto it = prefix_hashes[file].find(offset);
+    if (it != prefix_hashes[file].end())
+      return it->second;
+    size_t size = 0;
+    const char* contents = clang_getFileContents(cx_tu, file, &size);
+    if (!contents)
+      size = 0;
+    uint64_t hash =
+        HashUsr(std::string_view(contents, std::min<size_t>(offset, size)));
+    prefix_hashes[file][offset] = hash;
+    return hash;
+  }
+};
+
+void CollectInclusion(CXFile included_file,
+                      CXSourceLocation* inclusion_stack,
+                      unsigned include_len,
+                      CXClientData client_data) {
+  InclusionParam* param = static_cast<InclusionParam*>(client_data);
+  Inclusion inclusion;
+  inclusion.file = included_file;
+  for (unsigned i = 0; i < include_len; ++i) {
+    CXFile file;
+    unsigned offset;
+    clang_getFileLocation(inclusion_stack[i], &file, nullptr, nullptr,
+                          &offset);
+    inclusion.prefix_hashes.push_back(param->PrefixHash(file, offset));
+  }
+  param->inclusions.push_back(std::move(inclusion));
+}
+
+// Sets IndexFile::include_context_hash for the files owned by this
+// translation unit. The index of a header depends on the macros defined when
+// it is included, ie, on all text preprocessed before it, and on the headers
+// it includes. Files are entered in preorder of the include tree, so when a
+// file is left, every file entered since it was included is one of its
+// (transitive) includes, and every other file finished before that was
+// preprocessed before it.
+void SetIncludeContextHashes(IndexParam* param) {
+  InclusionParam inclusions(param->tu->cx_tu);
+  clang_getInclusions(param->tu->cx_tu, &CollectInclusion, &inclusions);
+
+  // Files which are being preprocessed, outermost first.
+  std::vector<const Inclusion*> open;
+  // Contents of the files left so far, in order.
+  uint64_t left = 0;
+  auto leave = [&]() {
+    const Inclusion* inclusion = open.back();
+    open.pop_back();
+    auto it = param->file_to_db.find(inclusion->file);
+    if (it != param->file_to_db.end() && it->second) {
+      // A file included several times depends on every inclusion.
+      std::vector<uint64_t> hashes = inclusion->prefix_hashes;
+      hashes.push_back(left);
+      hashes.push_back(it->second->include_context_hash);
+      it->second->include_context_hash = HashCombine(hashes);
+    }
+    left = HashCombine({left, inclusions.ContentHash(inclusion->file)});
+  };
+  for (const Inclusion& inclusion : inclusions.inclusions) {
+    while (open.size() > inclusion.prefix_hashes.size())
+      leave();
+    open.push_back(&inclusion);
+  }
+  while (!open.empty())
+    leave();
+}
+
 // Returns true if the given entity kind can be called implicitly, ie, without
 // actually being written in the source code.
 bool CanBeCalledImplicitly(CXIdxEntityKind kind) {
@@ -603,8 +785,8 @@ void SetVarDetail(IndexVar* var,
   // string. Shorten it to just "lambda".
   if (type_name.find("(lambda at") != std::string::npos)
     type_name = "lambda";
-  if (g_config->index.comments)
-    def.comments = cursor.get_comments();
+  if (param->index_docs && g_config->index.comments)
+    var->docs.comments = cursor.get_comments();
   def.storage = GetStorageClass(clang_Cursor_getStorageClass(cursor.cx_cursor));
 
   // TODO how to make PrettyPrint'ed variable name qualified?
@@ -627,7 +809,8 @@ void SetVarDetail(IndexVar* var,
     else
       hover += std::to_string(clang_getEnumConstantDeclValue(cursor.cx_cursor));
     def.detailed_name = std::move(qualified_name);
-    def.hover = hover;
+    if (param->index_docs)
+      var->docs.hover = hover;
   } else {
 #if 0 && CINDEX_HAVE_PRETTY
     //def.detailed_name = param->PrettyPrintCursor(cursor.cx_cursor, false);
@@ -644,15 +827,18 @@ void SetVarDetail(IndexVar* var,
            deref.kind == CXType_LValueReference ||
            deref.kind == CXType_RValueReference)
       deref = clang_getPointeeType(deref);
-    if (deref.kind != CXType_Unexposed && deref.kind != CXType_Auto &&
+    if (param->index_docs && deref.kind != CXType_Unexposed &&
+        deref.kind != CXType_Auto &&
         clang_getResultType(deref).kind == CXType_Invalid &&
         clang_getElementType(deref).kind == CXType_Invalid) {
       const FileContents& fc = param->file_contents[db->path];
       optional<int> spell_end = fc.ToOffset(cursor.get_spell().end);
       optional<int> extent_end = fc.ToOffset(cursor.get_extent().end);
       if (extent_end && *spell_end < *extent_end)
-        def.hover = std::string(def.detailed_name.c_str()) +
-                    fc.content.substr(*spell_end, *extent_end - *spell_end);
+        var->docs.hover =
+            std::string(def.detailed_name.c_str()) +
+            std::string(
+                fc.content.substr(*spell_end, *extent_end - *spell_end));
     }
 #endif
   }
@@ -678,6 +864,83 @@ void SetVarDetail(IndexVar* var,
   }
 }
 
+IndexId::LexicalRef MakeLexicalRef(IndexFile* db,
+                                   Range range,
+                                   ClangCursor parent,
+                                   Role role) {
+  switch (GetSymbolKind(parent.get_kind())) {
+    case SymbolKind::Func:
+      return IndexId::LexicalRef(range, db->ToFuncId(parent.cx_cursor),
+                                 SymbolKind::Func, role);
+    case SymbolKind::Type:
+      return IndexId::LexicalRef(range, db->ToTypeId(parent.cx_cursor),
+                                 SymbolKind::Type, role);
+    default:
+      return IndexId::LexicalRef(range, AnyId(), SymbolKind::File, role);
+  }
+}
+
+SymbolKind KindOf(const IndexFunc&) {
+  return SymbolKind::Func;
+}
+SymbolKind KindOf(const IndexType&) {
+  return SymbolKind::Type;
+}
+SymbolKind KindOf(const IndexVar&) {
+  return SymbolKind::Var;
+}
+
+// Records a use of |entity|; see PendingUses.
+template <typename T>
+void AddUse(IndexFile* db, T* entity, IndexId::LexicalRef ref) {
+  if (!db->pending_uses_) {
+    entity->uses.push_back(ref);
+    return;
+  }
+  db->pending_uses_->log.push_back(
+      PendingUse{db, KindOf(*entity), entity->id.id, ref});
+}
+
+template <typename T>
+void AddUse(IndexFile* db,
+            T* entity,
+            Range range,
+            ClangCursor parent,
+            Role role = Role::Reference) {
+  AddUse(db, entity, MakeLexicalRef(db, range, parent, role));
+}
+
+template <typename T>
+void AddUseSpell(IndexFile* db, T* entity, ClangCursor cursor) {
+  AddUse(db, entity, cursor.get_spell(),
+         cursor.get_lexical_parent().cx_cursor);
+}
+
+std::vector<IndexId::LexicalRef>& UsesOf(const PendingUse& use) {
+  switch (use.kind) {
+    case SymbolKind::Func:
+      return use.db->Resolve(IndexId::Func(use.id))->uses;
+    case SymbolKind::Type:
+      return use.db->Resolve(IndexId::Type(use.id))->uses;
+    default:
+      return use.db->Resolve(IndexId::Var(use.id))->uses;
+  }
+}
+
+// Moves the logged uses into their entities, in the order they were found.
+// Counting first lets every |uses| vector be allocated once at its final size.
+void FlushPendingUses(PendingUses* pending, Arena* arena) {
+  ArenaUnorderedMap<std::vector<IndexId::LexicalRef>*, size_t> counts(
+      ArenaAllocator<std::vector<IndexId::LexicalRef>*>(arena));
+  for (const PendingUse& use : pending->log)
+    ++counts[&UsesOf(use)];
+  for (auto& it : counts)
+    it.first->reserve(it.first->size() + it.second);
+  for (const PendingUse& use : pending->log)
+    UsesOf(use).push_back(use.ref);
+  pending->log.clear();
+}
+
 void OnIndexReference_Function(IndexFile* db,
                                Range loc,
                                ClangCursor parent_cursor,
@@ -689,22 +952,22 @@ void OnIndexReference_Function(IndexFile* db,
       IndexFunc* called = db->Resolve(called_id);
       parent->def.callees.push_back(
           IndexId::SymbolRef(loc, called->id, SymbolKind::Func, role));
-      called->uses.push_back(
-          IndexId::LexicalRef(loc, parent->id, SymbolKind::Func, role));
+      AddUse(db, called,
+             IndexId::LexicalRef(loc, parent->id, SymbolKind::Func, role));
       break;
     }
     case SymbolKind::Type: {
       IndexType* parent = db->Resolve(db->ToTypeId(parent_cursor.cx_cursor));
       IndexFunc* called = db->Resolve(called_id);
       called = db->Resolve(called_id);
-      called->uses.push_back(
-          IndexId::LexicalRef(loc, parent->id, SymbolKind::Type, role));
+      AddUse(db, called,
+             IndexId::LexicalRef(loc, parent->id, SymbolKind::Type, role));
       break;
     }
     default: {
       IndexFunc* called = db->Resolve(called_id);
-      called->uses.push_back(
-          IndexId::LexicalRef(loc, AnyId(), SymbolKind::File, role));
+      AddUse(db, called,
+             IndexId::LexicalRef(loc, AnyId(), SymbolKind::File, role));
       break;
     }
   }
@@ -732,44 +995,41 @@ void Uniquify(std::vector<IndexId::LexicalRef>& refs) {
 }  // namespace
 
 // static
-const int IndexFile::kMajorVersion = 15;
+const int IndexFile::kMajorVersion = 18;
 // static
-const int IndexFile::kMinorVersion = 0;
+const int IndexFile::kMinorVersion = 4;
 
 IndexFile::IndexFile(const AbsolutePath& path)
-    : id_cache(path), path(path), file_contents("#error <NONE>") {}
+    : id_cache(path), path(path) {}
 
 IndexId::Type IndexFile::ToTypeId(Usr usr) {
-  auto it = id_cache.usr_to_type_id.find(usr);
-  if (it != id_cache.usr_to_type_id.end())
-    return it->second;
-
-  IndexId::Type id(types.size());
-  types.push_back(IndexType(id, usr));
-  id_cache.usr_to_type_id[usr] = id;
-  id_cache.type_id_to_usr[id] = usr;
+  bool inserted;
+  IndexId::Type id = *id_cache.usr_to_type_id.TryEmplace(
+      usr, IndexId::Type(types.size()), &inserted);
+  if (inserted) {
+    types.push_back(IndexType(id, usr));
+    id_cache.type_id_to_usr.push_back(usr);
+  }
   return id;
 }
 IndexId::Func IndexFile::ToFuncId(Usr usr) {
-  auto it = id_cache.usr_to_func_id.find(usr);
-  if (it != id_cache.usr_to_func_id.end())
-    return it->second;
-
-  IndexId::Func id(funcs.size());
-  funcs.push_back(IndexFunc(id, usr));
-  id_cache.usr_to_func_id[usr] = id;
-  id_cache.func_id_to_usr[id] = usr;
+  bool inserted;
+  IndexId::Func id = *id_cache.usr_to_func_id.TryEmplace(
+      usr, IndexId::Func(funcs.size()), &inserted);
+  if (inserted) {
+    funcs.push_back(IndexFunc(id, usr));
+    id_cache.func_id_to_usr.push_back(usr);
+  }
   return id;
 }
 IndexId::Var IndexFile::ToVarId(Usr usr) {
-  auto it = id_cache.usr_to_var_id.find(usr);
-  if (it != id_cache.usr_to_var_id.end())
-    return it->second;
-
-  IndexId::Var id(vars.size());
-  vars.push_back(IndexVar(id, usr));
-  id_cache.usr_to_var_id[usr] = id;
-  id_cache.var_id_to_usr[id] = usr;
+  bool inserted;
+  IndexId::Var id = *id_cache.usr_to_var_id.TryEmplace(
+      usr, IndexId::Var(vars.size()), &inserted);
+  if (inserted) {
+    vars.push_back(IndexVar(id, usr));
+    id_cache.var_id_to_usr.push_back(usr);
+  }
   return id;
 }
 
@@ -795,6 +1055,26 @@ IndexVar* IndexFile::Resolve(IndexId::Var id) {
   return &vars[id.id];
 }
 
+std::vector<IndexSymbolDocs> IndexFile::CollectDocs() {
+  std::vector<IndexSymbolDocs> result;
+  auto add = [&](SymbolKind kind, Usr usr, const IndexDocs& docs) {
+    if (docs.hover.empty() && docs.comments.empty())
+      return;
+    IndexSymbolDocs entry;
+    entry.kind = kind;
+    entry.usr = usr;
+    entry.docs = docs;
+    result.push_back(std::move(entry));
+  };
+  for (const IndexType& type : types)
+    add(SymbolKind::Type, type.usr, type.docs);
+  for (const IndexFunc& func : funcs)
+    add(SymbolKind::Func, func.usr, func.docs);
+  for (const IndexVar& var : vars)
+    add(SymbolKind::Var, var.usr, var.docs);
+  return result;
+}
+
 std::string IndexFile::ToString() {
   return Serialize(SerializeFormat::Json, *this);
 }
@@ -806,20 +1086,7 @@ void AddRef(IndexFile* db,
             Range range,
             ClangCursor parent,
             Role role = Role::Reference) {
-  switch (GetSymbolKind(parent.get_kind())) {
-    case SymbolKind::Func:
-      refs.push_back(IndexId::LexicalRef(range, db->ToFuncId(parent.cx_cursor),
-                                         SymbolKind::Func, role));
-      break;
-    case SymbolKind::Type:
-      refs.push_back(IndexId::LexicalRef(range, db->ToTypeId(parent.cx_cursor),
-                                         SymbolKind::Type, role));
-      break;
-    default:
-      refs.push_back(
-          IndexId::LexicalRef(range, AnyId(), SymbolKind::File, role));
-      break;
-  }
+  refs.push_back(MakeLexicalRef(db, range, parent, role));
 }
 
 void AddRefSpell(IndexFile* db,
@@ -835,6 +1102,19 @@ CXCursor FromContainer(const CXIdxContainerInfo* parent) {
 IdCache::IdCache(const AbsolutePath& primary_file)
     : primary_file(primary_file) {}
 
+// Called by libclang between declarations and references. Returning non-zero
+// stops indexing the translation unit.
+int OnIndexAbortQuery(CXClientData client_data, void* reserved) {
+  IndexParam* param = static_cast<IndexParam*>(client_data);
+  if (!param->budget || param->budget->timeout_ms <= 0)
+    return 0;
+  if (param->index_timer.ElapsedMicroseconds() / 1000 <
+      param->budget->timeout_ms)
+    return 0;
+  param->budget->timed_out = true;
+  return 1;
+}
+
 void OnIndexDiagnostic(CXClientData client_data,
                        CXDiagnosticSet diagnostics,
                        void* reserved) {
@@ -953,6 +1233,58 @@ bool IsTypeDefinition(const CXIdxContainerInfo* container) {
   return GetSymbolKind(container->cursor.kind) == SymbolKind::Type;
 }
 
+// Various versions of LLVM (ie, 4.0) will not visit inline variable references
+// for template arguments, so these are added for every DeclRefExpr below a
+// variable declaration.
+void AddDeclInitializerUsage(ClangCursor cursor, IndexFile* db) {
+  /*
+    We need to index the |DeclRefExpr| below (ie, |var| inside of
+    Foo<int>::var).
+
+      template<typename T>
+      struct Foo {
+        static constexpr int var = 3;
+      };
+
+      int a = Foo<int>::var;
+
+      =>
+
+      VarDecl a
+        UnexposedExpr var
+          DeclRefExpr var
+            TemplateRef Foo
+
+  */
+  if (cursor.get_kind() != CXCursor_DeclRefExpr ||
+      cursor.get_referenced().get_kind() != CXCursor_VarDecl)
+    return;
+
+  // TODO: when we resolve the template type to the definition, we get a
+  // different Usr.
+
+  // ClangCursor ref =
+  // cursor.get_referenced().template_specialization_to_template_definition().get_type().strip_qualifiers().get_usr_hash();
+  // std::string ref_usr =
+  // cursor.get_referenced().template_specialization_to_template_definition().get_type().strip_qualifiers().get_usr_hash();
+  optional<Usr> ref_usr = cursor.get_referenced()
+                              .template_specialization_to_template_definition()
+                              .get_usr_hash();
+  // std::string ref_usr = ref.get_usr_hash();
+  if (!ref_usr)
+    return;
+
+  IndexVar* ref_var = db->Resolve(db->ToVarId(*ref_usr));
+  AddUseSpell(db, ref_var, cursor);
+}
+
+ClangCursor::VisitResult AddDeclInitializerUsagesVisitor(ClangCursor cursor,
+                                                         ClangCursor parent,
+                                                         IndexFile* db) {
+  AddDeclInitializerUsage(cursor, db);
+  return ClangCursor::VisitResult::Recurse;
+}
+
 struct VisitDeclForTypeUsageParam {
   IndexFile* db;
   optional<IndexId::Type> toplevel_type;
@@ -960,9 +1292,20 @@ struct VisitDeclForTypeUsageParam {
   optional<ClangCursor> previous_cursor;
   optional<IndexId::Type> initial_type;
 
+  // The cursor whose children are visited.
+  ClangCursor decl_cursor;
+  // Calls and casts below |decl_cursor| whose children can still be type
+  // usages. Only the chain of such expressions directly below |decl_cursor| is
+  // kept, so this stays short.
+  std::vector<ClangCursor> type_usage_parents;
+  // If true, the whole subtree is visited and AddDeclInitializerUsage is run
+  // for every cursor in it, in the same traversal.
+  bool add_initializer_usages = false;
+
   VisitDeclForTypeUsageParam(IndexFile* db,
-                             optional<IndexId::Type> toplevel_type)
-      : db(db), toplevel_type(toplevel_type) {}
+                             optional<IndexId::Type> toplevel_type,
+                             ClangCursor decl_cursor)
+      : db(db), toplevel_type(toplevel_type), decl_cursor(decl_cursor) {}
 };
 
 void VisitDeclForTypeUsageVisitorHandler(ClangCursor cursor,
@@ -987,7 +1330,7 @@ void VisitDeclForTypeUsageVisitorHandler(ClangCursor cursor,
     IndexType* ref_type = db->Resolve(*param->toplevel_type);
     std::string name = cursor.get_referenced().get_spell_name();
     if (name == ref_type->def.ShortName()) {
-      AddRefSpell(db, ref_type->uses, cursor);
+      AddUseSpell(db, ref_type, cursor);
       param->toplevel_type = nullopt;
       return;
     }
@@ -1009,43 +1352,54 @@ void VisitDeclForTypeUsageVisitorHandler(ClangCursor cursor,
   IndexType* ref_type_def = db->Resolve(ref_type_id);
   // TODO: Should we even be visiting this if the file is not from the main
   // def? Try adding assert on |loc| later.
-  AddRefSpell(db, ref_type_def->uses, cursor);
+  AddUseSpell(db, ref_type_def, cursor);
 }
 
 ClangCursor::VisitResult VisitDeclForTypeUsageVisitor(
     ClangCursor cursor,
     ClangCursor parent,
     VisitDeclForTypeUsageParam* param) {
-  switch (cursor.get_kind()) {
-    case CXCursor_TemplateRef:
-    case CXCursor_TypeRef:
-      if (param->previous_cursor) {
-        VisitDeclForTypeUsageVisitorHandler(param->previous_cursor.value(),
-                                            param);
-      }
+  const std::vector<ClangCursor>& parents = param->type_usage_parents;
+  bool is_type_usage_scope =
+      parent == param->decl_cursor ||
+      std::find(parents.begin(), parents.end(), parent) != parents.end();
+  if (is_type_usage_scope) {
+    switch (cursor.get_kind()) {
+      case CXCursor_TemplateRef:
+      case CXCursor_TypeRef:
+        if (param->previous_cursor) {
+          VisitDeclForTypeUsageVisitorHandler(param->previous_cursor.value(),
+                                              param);
+        }
 
-      param->previous_cursor = cursor;
-      return ClangCursor::VisitResult::Continue;
+        param->previous_cursor = cursor;
+        return ClangCursor::VisitResult::Continue;
 
-    // We do not want to recurse for everything, since if we do that we will end
-    // up visiting method definition bodies/etc. Instead, we only recurse for
-    // things that can logically appear as part of an inline variable
-    // initializer,
-    // ie,
-    //
-    //  class Foo {
-    //   int x = (Foo)3;
-    //  }
-    case CXCursor_CallExpr:
-    case CXCursor_CStyleCastExpr:
-    case CXCursor_CXXStaticCastExpr:
-    case CXCursor_CXXReinterpretCastExpr:
-      return ClangCursor::VisitResult::Recurse;
+      // We do not want to recurse for everything, since if we do that we will
+      // end up visiting method definition bodies/etc. Instead, we only recurse
+      // for things that can logically appear as part of an inline variable
+      // initializer,
+      // ie,
+      //
+      //  class Foo {
+      //   int x = (Foo)3;
+      //  }
+      case CXCursor_CallExpr:
+      case CXCursor_CStyleCastExpr:
+      case CXCursor_CXXStaticCastExpr:
+      case CXCursor_CXXReinterpretCastExpr:
+        param->type_usage_parents.push_back(cursor);
+        return ClangCursor::VisitResult::Recurse;
 
-    default:
-      return ClangCursor::VisitResult::Continue;
+      default:
+        break;
+    }
   }
 
+  if (param->add_initializer_usages) {
+    AddDeclInitializerUsage(cursor, param->db);
+    return ClangCursor::VisitResult::Recurse;
+  }
   return ClangCursor::VisitResult::Continue;
 }
 
@@ -1059,12 +1413,16 @@ ClangCursor::VisitResult VisitDeclForTypeUsageVisitor(
 // template.
 // We use |toplevel_type| to attribute the use to the specialized template
 // instead of the primary template.
+// If |add_initializer_usages| is true, variable references anywhere below
+// |decl_cursor| are added as well (see AddDeclInitializerUsage), without
+// walking the declaration a second time.
 optional<IndexId::Type> AddDeclTypeUsages(
     IndexFile* db,
     ClangCursor decl_cursor,
     optional<IndexId::Type> toplevel_type,
     const CXIdxContainerInfo* semantic_container,
-    const CXIdxContainerInfo* lexical_container) {
+    const CXIdxContainerInfo* lexical_container,
+    bool add_initializer_usages = false) {
   //
   // The general AST format for definitions follows this pattern:
   //
@@ -1156,13 +1514,20 @@ optional<IndexId::Type> AddDeclTypeUsages(
     //
     if (!decl_cursor.is_definition()) {
       ClangCursor def = decl_cursor.get_definition();
-      if (def.get_kind() != CXCursor_FirstInvalid)
+      if (def.get_kind() != CXCursor_FirstInvalid) {
+        // Initializer usages still belong to the original declaration.
+        if (add_initializer_usages) {
+          decl_cursor.VisitChildren(&AddDeclInitializerUsagesVisitor, db);
+          add_initializer_usages = false;
+        }
         decl_cursor = def;
+      }
     }
     process_last_type_ref = false;
   }
 
-  VisitDeclForTypeUsageParam param(db, toplevel_type);
+  VisitDeclForTypeUsageParam param(db, toplevel_type, decl_cursor);
+  param.add_initializer_usages = add_initializer_usages;
   decl_cursor.VisitChildren(&VisitDeclForTypeUsageVisitor, &param);
 
   // VisitDeclForTypeUsageVisitor guarantees that if there are multiple TypeRef
@@ -1189,63 +1554,6 @@ optional<IndexId::Type> AddDeclTypeUsages(
   return db->ToTypeId(ClangType(cx_under).strip_qualifiers().get_usr_hash());
 }
 
-// Various versions of LLVM (ie, 4.0) will not visit inline variable references
-// for template arguments.
-ClangCursor::VisitResult AddDeclInitializerUsagesVisitor(ClangCursor cursor,
-                                                         ClangCursor parent,
-                                                         IndexFile* db) {
-  /*
-    We need to index the |DeclRefExpr| below (ie, |var| inside of
-    Foo<int>::var).
-
-      template<typename T>
-      struct Foo {
-        static constexpr int var = 3;
-      };
-
-      int a = Foo<int>::var;
-
-      =>
-
-      VarDecl a
-        UnexposedExpr var
-          DeclRefExpr var
-            TemplateRef Foo
-
-  */
-
-  switch (cursor.get_kind()) {
-    case CXCursor_DeclRefExpr: {
-      if (cursor.get_referenced().get_kind() != CXCursor_VarDecl)
-        break;
-
-      // TODO: when we resolve the template type to the definition, we get a
-      // different Usr.
-
-      // ClangCursor ref =
-      // cursor.get_referenced().template_specialization_to_template_definition().get_type().strip_qualifiers().get_usr_hash();
-      // std::string ref_usr =
-      // cursor.get_referenced().template_specialization_to_template_definition().get_type().strip_qualifiers().get_usr_hash();
-      optional<Usr> ref_usr =
-          cursor.get_referenced()
-              .template_specialization_to_template_definition()
-              .get_usr_hash();
-      // std::string ref_usr = ref.get_usr_hash();
-      if (!ref_usr)
-        break;
-
-      IndexVar* ref_var = db->Resolve(db->ToVarId(*ref_usr));
-      AddRefSpell(db, ref_var->uses, cursor);
-      break;
-    }
-
-    default:
-      break;
-  }
-
-  return ClangCursor::VisitResult::Recurse;
-}
-
 ClangCursor::VisitResult VisitMacroDefinitionAndExpansions(ClangCursor cursor,
                                                            ClangCursor parent,
                                                            IndexParam* param) {
@@ -1279,17 +1587,19 @@ ClangCursor::VisitResult VisitMacroDefinitionAndExpansions(ClangCursor cursor,
         var_def->def.short_name_offset = 0;
         var_def->def.short_name_size =
             int16_t(strlen(var_def->def.detailed_name.c_str()));
-        var_def->def.hover =
-            "#define " + GetDocumentContentInRange(param->tu->cx_tu, cx_extent);
+        if (param->index_docs) {
+          var_def->docs.hover = "#define " + GetDocumentContentInRange(
+                                                 param->tu->cx_tu, cx_extent);
+        }
         var_def->def.kind = lsSymbolKind::Macro;
-        if (g_config->index.comments)
-          var_def->def.comments = cursor.get_comments();
+        if (param->index_docs && g_config->index.comments)
+          var_def->docs.comments = cursor.get_comments();
         var_def->def.spell =
             SetUse(db, decl_loc_spelling, parent, Role::Definition);
         var_def->def.extent = SetUse(
             db, ResolveCXSourceRange(cx_extent, nullptr), parent, Role::None);
       } else
-        AddRef(db, var_def->uses, decl_loc_spelling, parent);
+        AddUse(db, var_def, decl_loc_spelling, parent);
 
       break;
     }
@@ -1346,11 +1656,11 @@ ClangCursor::VisitResult TemplateVisitor(ClangCursor cursor,
             // seems no way to extract the spelling range of `type` and we do
             // not want to do subtraction here.
             // See https://github.com/jacobdufault/cquery/issues/252
-            AddRef(db, ref_type_index->uses, ref_cursor.get_extent(),
+            AddUse(db, ref_type_index, ref_cursor.get_extent(),
                    ref_cursor.get_lexical_parent());
           }
         }
-        AddRefSpell(db, ref_var->uses, cursor);
+        AddUseSpell(db, ref_var, cursor);
       }
       break;
     }
@@ -1402,7 +1712,7 @@ ClangCursor::VisitResult TemplateVisitor(ClangCursor cursor,
               int16_t(strlen(ref_type->def.detailed_name.c_str()));
           ref_type->def.kind = lsSymbolKind::TypeParameter;
         }
-        AddRefSpell(db, ref_type->uses, cursor);
+        AddUseSpell(db, ref_type, cursor);
       }
       break;
     }
@@ -1437,7 +1747,7 @@ ClangCursor::VisitResult TemplateVisitor(ClangCursor cursor,
               int16_t(strlen(ref_type->def.detailed_name.c_str()));
           ref_type->def.kind = lsSymbolKind::TypeParameter;
         }
-        AddRefSpell(db, ref_type->uses, cursor);
+        AddUseSpell(db, ref_type, cursor);
       }
       break;
     }
@@ -1550,7 +1860,7 @@ void OnIndexDeclaration(CXClientData client_data, const CXIdxDeclInfo* decl) {
           ns->def.bases.push_back(parent_id);
         }
       }
-      AddRef(db, ns->uses, spell, lex_parent);
+      AddUse(db, ns, spell, lex_parent);
       break;
     }
 
@@ -1596,16 +1906,16 @@ void OnIndexDeclaration(CXClientData client_data, const CXIdxDeclInfo* decl) {
             SetRef(db, spell, lex_parent, Role::Declaration));
       }
 
-      cursor.VisitChildren(&AddDeclInitializerUsagesVisitor, db);
-      var = db->Resolve(var_id);
-
       // Declaring variable type information. Note that we do not insert an
       // interesting reference for parameter declarations - that is handled when
       // the function declaration is encountered since we won't receive ParmDecl
       // declarations for unnamed parameters.
       // TODO: See if we can remove this function call.
+      // References in the initializer are collected in the same traversal.
       AddDeclTypeUsages(db, cursor, var->def.type, decl->semanticContainer,
-                        decl->lexicalContainer);
+                        decl->lexicalContainer,
+                        true /*add_initializer_usages*/);
+      var = db->Resolve(var_id);
 
       // We don't need to assign declaring type multiple times if this variable
       // has already been seen.
@@ -1648,8 +1958,8 @@ void OnIndexDeclaration(CXClientData client_data, const CXIdxDeclInfo* decl) {
 
       IndexId::Func func_id = db->ToFuncId(decl_cursor_resolved.cx_cursor);
       IndexFunc* func = db->Resolve(func_id);
-      if (g_config->index.comments)
-        func->def.comments = cursor.get_comments();
+      if (param->index_docs && g_config->index.comments)
+        func->docs.comments = cursor.get_comments();
       func->def.kind = GetSymbolKind(decl->entityInfo->kind);
       func->def.storage =
           GetStorageClass(clang_Cursor_getStorageClass(decl->cursor));
@@ -1741,7 +2051,7 @@ void OnIndexDeclaration(CXClientData client_data, const CXIdxDeclInfo* decl) {
 
           // Mark a type reference at the ctor/dtor location.
           if (decl->entityInfo->kind == CXIdxEntity_CXXConstructor)
-            AddRef(db, declaring_type_def->uses, spell,
+            AddUse(db, declaring_type_def, spell,
                    FromContainer(decl->lexicalContainer));
 
           // Add function to declaring type.
@@ -1796,29 +2106,32 @@ void OnIndexDeclaration(CXClientData client_data, const CXIdxDeclInfo* decl) {
       SetTypeName(type, decl_cursor, decl->semanticContainer,
                   decl->entityInfo->name, param);
       type->def.kind = GetSymbolKind(decl->entityInfo->kind);
-      if (g_config->index.comments)
-        type->def.comments = decl_cursor.get_comments();
+      if (param->index_docs && g_config->index.comments)
+        type->docs.comments = decl_cursor.get_comments();
 
       // For Typedef/CXXTypeAlias spanning a few lines, display the declaration
       // line, with spelling name replaced with qualified name.
       // TODO Think how to display multi-line declaration like `typedef struct {
       // ... } foo;` https://github.com/jacobdufault/cquery/issues/29
-      if (extent.end.line - extent.start.line <
-          kMaxLinesDisplayTypeAliasDeclarations) {
+      if (param->index_docs &&
+          extent.end.line - extent.start.line <
+              kMaxLinesDisplayTypeAliasDeclarations) {
         FileContents& fc = param->file_contents[db->path];
         optional<int> extent_start = fc.ToOffset(extent.start),
                       spell_start = fc.ToOffset(spell.start),
                       spell_end = fc.ToOffset(spell.end),
                       extent_end = fc.ToOffset(extent.end);
         if (extent_start && spell_start && spell_end && extent_end) {
-          type->def.hover =
-              fc.content.substr(*extent_start, *spell_start - *extent_start) +
+          type->docs.hover =
+              std::string(fc.content.substr(*extent_start,
+                                            *spell_start - *extent_start)) +
               type->def.detailed_name.c_str() +
-              fc.content.substr(*spell_end, *extent_end - *spell_end);
+              std::string(
+                  fc.content.substr(*spell_end, *extent_end - *spell_end));
         }
       }
 
-      AddRef(db, type->uses, spell, FromContainer(decl->lexicalContainer));
+      AddUse(db, type, spell, FromContainer(decl->lexicalContainer));
       break;
     }
 
@@ -1843,8 +2156,8 @@ void OnIndexDeclaration(CXClientData client_data, const CXIdxDeclInfo* decl) {
       SetTypeName(type, cursor, decl->semanticContainer, decl->entityInfo->name,
                   param);
       type->def.kind = GetSymbolKind(decl->entityInfo->kind);
-      if (g_config->index.comments)
-        type->def.comments = cursor.get_comments();
+      if (param->index_docs && g_config->index.comments)
+        type->docs.comments = cursor.get_comments();
       // }
 
       if (decl->isDefinition) {
@@ -1857,8 +2170,7 @@ void OnIndexDeclaration(CXClientData client_data, const CXIdxDeclInfo* decl) {
           if (!enum_type.is_builtin()) {
             IndexType* int_type =
                 db->Resolve(db->ToTypeId(enum_type.get_usr_hash()));
-            AddRef(db, int_type->uses, spell,
-                   FromContainer(decl->lexicalContainer));
+            AddUse(db, int_type, spell, FromContainer(decl->lexicalContainer));
             // type is invalidated.
             type = db->Resolve(type_id);
           }
@@ -2005,13 +2317,13 @@ void OnIndexReference(CXClientData client_data, const CXIdxEntityRefInfo* ref) {
 
     case CXIdxEntity_CXXNamespace: {
       IndexType* ns = db->Resolve(db->ToTypeId(referenced.get_usr_hash()));
-      AddRef(db, ns->uses, cursor.get_spell(), FromContainer(ref->container));
+      AddUse(db, ns, cursor.get_spell(), FromContainer(ref->container));
       break;
     }
 
     case CXIdxEntity_CXXNamespaceAlias: {
       IndexType* ns = db->Resolve(db->ToTypeId(referenced.get_usr_hash()));
-      AddRef(db, ns->uses, cursor.get_spell(), FromContainer(ref->container));
+      AddUse(db, ns, cursor.get_spell(), FromContainer(ref->container));
       if (!ns->def.spell) {
         ClangCursor sem_parent = referenced.get_semantic_parent();
         ClangCursor lex_parent = referenced.get_lexical_parent();
@@ -2060,7 +2372,7 @@ void OnIndexReference(CXClientData client_data, const CXIdxEntityRefInfo* ref) {
           var->def.kind = lsSymbolKind::Parameter;
         }
       }
-      AddRef(db, var->uses, loc, FromContainer(ref->container),
+      AddUse(db, var, loc, FromContainer(ref->container),
              GetRole(ref, Role::Reference));
       break;
     }
@@ -2158,8 +2470,9 @@ void OnIndexReference(CXClientData client_data, const CXIdxEntityRefInfo* ref) {
               param->ctors.TryFindConstructorUsr(ctor_type_usr, call_type_desc);
           if (ctor_usr) {
             IndexFunc* ctor = db->Resolve(db->ToFuncId(*ctor_usr));
-            ctor->uses.push_back(IndexId::LexicalRef(
-                loc, AnyId(), SymbolKind::File, Role::Call | Role::Implicit));
+            AddUse(db, ctor,
+                   IndexId::LexicalRef(loc, AnyId(), SymbolKind::File,
+                                       Role::Call | Role::Implicit));
           }
         }
       }
@@ -2183,7 +2496,7 @@ void OnIndexReference(CXClientData client_data, const CXIdxEntityRefInfo* ref) {
       if (!ref->parentEntity || IsDeclContext(ref->parentEntity->kind))
         AddRefSpell(db, ref_type->declarations, ref->cursor);
       else
-        AddRefSpell(db, ref_type->uses, ref->cursor);
+        AddUseSpell(db, ref_type, ref->cursor);
       break;
     }
   }
@@ -2195,6 +2508,8 @@ optional<std::vector<std::unique_ptr<IndexFile>>> Parse(
     const std::vector<std::string>& args,
     const std::vector<FileContents>& file_contents,
     ClangIndex* index,
+    IndexFidelity fidelity,
+    ParseBudget* budget,
     bool dump_ast) {
   if (!g_config->index.enabled)
     return nullopt;
@@ -2210,60 +2525,102 @@ optional<std::vector<std::unique_ptr<IndexFile>>> Parse(
   for (const FileContents& contents : file_contents) {
     CXUnsavedFile unsaved;
     unsaved.Filename = contents.path.path.c_str();
-    unsaved.Contents = contents.content.c_str();
+    unsaved.Contents = contents.content.data();
     unsaved.Length = (unsigned long)contents.content.size();
     unsaved_files.push_back(unsaved);
   }
 
+  // Time spent in each stage, so changes to one of them can be measured with
+  // $cquery/metrics.
+  static LatencyHistogram* parse_stage_time =
+      GetLatencyHistogram("indexer.stage.parse");
+  static LatencyHistogram* index_stage_time =
+      GetLatencyHistogram("indexer.stage.index");
+  static LatencyHistogram* macro_stage_time =
+      GetLatencyHistogram("indexer.stage.macros");
+  Timer parse_timer;
+  Timer stage_timer;
   std::unique_ptr<ClangTranslationUnit> tu = ClangTranslationUnit::Create(
       index, file->path, args, unsaved_files,
       CXTranslationUnit_KeepGoing |
           CXTranslationUnit_DetailedPreprocessingRecord);
   if (!tu)
     return nullopt;
+  parse_stage_time->Record(stage_timer.ElapsedMicrosecondsAndReset());
 
   if (dump_ast)
     Dump(clang_getTranslationUnitCursor(tu->cx_tu));
 
   IndexerCallbacks callback = {0};
   // Available callbacks:
-  // - abortQuery
   // - enteredMainFile
   // - ppIncludedFile
   // - importedASTFile
   // - startedTranslationUnit
+  callback.abortQuery = &OnIndexAbortQuery;
   callback.diagnostic = &OnIndexDiagnostic;
   callback.ppIncludedFile = &OnIndexIncludedFile;
   callback.indexDeclaration = &OnIndexDeclaration;
   callback.indexEntityReference = &OnIndexReference;
 
-  FileConsumer file_consumer(file_consumer_shared, *file);
-  IndexParam param(tu.get(), &file_consumer);
-  for (const FileContents& contents : file_contents)
-    param.file_contents[contents.path] = contents;
+  // |file_contents| does not need to be copied into |param|. libclang keeps
+  // its own buffer for every unsaved file, which ConsumeFile refers to.
+  // The previous translation unit's IndexParam is gone, so its memory can be
+  // reused.
+  static thread_local Arena arena;
+  arena.Reset();
+  FileConsumer file_consumer(file_consumer_shared, *file, args);
+  IndexParam param(tu.get(), &file_consumer, &arena);
+  param.index_docs = fidelity == IndexFidelity::Full;
+  param.budget = budget;
 
   CXFile cx_file = clang_getFile(tu->cx_tu, file->path.c_str());
   param.primary_file = ConsumeFile(&param, cx_file);
 
   CXIndexAction index_action = clang_IndexAction_create(index->cx_index);
 
+  unsigned index_options = CXIndexOpt_SkipParsedBodiesInSession;
+  if (fidelity == IndexFidelity::Full) {
+    index_options |= CXIndexOpt_IndexFunctionLocalSymbols |
+                     CXIndexOpt_IndexImplicitTemplateInstantiations;
+  }
+  param.index_timer.Reset();
   // |index_result| is a CXErrorCode instance.
-  int index_result = clang_indexTranslationUnit(
-      index_action, &param, &callback, sizeof(IndexerCallbacks),
-      CXIndexOpt_IndexFunctionLocalSymbols |
-          CXIndexOpt_SkipParsedBodiesInSession |
-          CXIndexOpt_IndexImplicitTemplateInstantiations,
-      tu->cx_tu);
+  int index_result =
+      clang_indexTranslationUnit(index_action, &param, &callback,
+                                 sizeof(IndexerCallbacks), index_options,
+                                 tu->cx_tu);
+  clang_IndexAction_dispose(index_action);
+  index_stage_time->Record(stage_timer.ElapsedMicrosecondsAndReset());
+  if (budget)
+    budget->index_ms = param.index_timer.ElapsedMicroseconds() / 1000;
+  if (budget && budget->timed_out) {
+    // Let other translation units index the headers this one took.
+    for (std::unique_ptr<IndexFile>& entry :
+         param.file_consumer->TakeLocalState())
+      file_consumer_shared->Reset(entry->path.path);
+    return nullopt;
+  }
   if (index_result != CXError_Success) {
     LOG_S(ERROR) << "Indexing " << *file
                  << " failed with errno=" << index_result;
     return nullopt;
   }
 
-  clang_IndexAction_dispose(index_action);
-
   ClangCursor(clang_getTranslationUnitCursor(tu->cx_tu))
       .VisitChildren(&VisitMacroDefinitionAndExpansions, &param);
+  macro_stage_time->Record(stage_timer.ElapsedMicrosecondsAndReset());
+
+  if (param.primary_file) {
+    param.primary_file->parse_time_ms =
+        parse_timer.ElapsedMicroseconds() / 1000;
+    CXTUResourceUsage usage = clang_getCXTUResourceUsage(tu->cx_tu);
+    unsigned long bytes = 0;
+    for (unsigned i = 0; i < usage.numEntries; ++i)
+      bytes += usage.entries[i].amount;
+    clang_disposeCXTUResourceUsage(usage);
+    param.primary_file->tu_memory_mb = bytes / 1000000;
+  }
 
   std::unordered_map<AbsolutePath, int> inc_to_line;
   // TODO
@@ -2271,10 +2628,14 @@ optional<std::vector<std::unique_ptr<IndexFile>>> Parse(
     for (auto& inc : param.primary_file->includes)
       inc_to_line[inc.resolved_path] = inc.line;
 
+  SetIncludeContextHashes(&param);
+  FlushPendingUses(&param.uses, &arena);
   auto result = param.file_consumer->TakeLocalState();
   for (std::unique_ptr<IndexFile>& entry : result) {
+    entry->pending_uses_ = nullptr;
+    entry->fidelity = fidelity;
     entry->import_file = *file;
-    entry->args = args;
+    entry->args = InternedArgs(args, file->path);
     for (IndexFunc& func : entry->funcs) {
       // e.g. declaration + out-of-line definition
       Uniquify(func.derived);
@@ -2335,7 +2696,7 @@ void ClangSanityCheck(const Project::Entry& entry) {
   ClangIndex index;
   std::vector<CXUnsavedFile> unsaved;
   std::unique_ptr<ClangTranslationUnit> tu = ClangTranslationUnit::Create(
-      &index, entry.filename, entry.args, unsaved, 0);
+      &index, entry.filename, entry.args.Get(), unsaved, 0);
   if (!tu)
     ABORT_S() << "Creating translation unit failed";
 
@@ -2406,6 +2767,68 @@ std::string GetClangVersion() {
   return SplitString(version_string, " ")[2];
 }
 
+namespace {
+
+// In MessagePack a reference is packed into six small integers: the start line
+// as a delta from the previous reference in the same array, the start column,
+// the number of lines spanned, the end column, the id plus one (so an invalid
+// id is 0) and |kind| with |role| shifted above it. MessagePack stores integers
+// in [-32, 127] in a single byte, so most references take 6-8 bytes instead of
+// 7 fields of up to 5 bytes each.
+void ReadPackedReference(Reader& visitor, Reference& value, int& line) {
+  line += visitor.GetInt();
+  value.range.start.line = int16_t(line);
+  value.range.start.column = int16_t(visitor.GetInt());
+  value.range.end.line = int16_t(line + visitor.GetInt());
+  value.range.end.column = int16_t(visitor.GetInt());
+  value.id.id = RawId(visitor.GetUint32() - 1);
+  int kind_and_role = visitor.GetInt();
+  value.kind = static_cast<SymbolKind>(kind_and_role & 7);
+  value.role = static_cast<Role>(kind_and_role >> 3);
+}
+void WritePackedReference(Writer& visitor, Reference& value, int& line) {
+  visitor.Int(value.range.start.line - line);
+  line = value.range.start.line;
+  visitor.Int(value.range.start.column);
+  visitor.Int(value.range.end.line - value.range.start.line);
+  visitor.Int(value.range.end.column);
+  visitor.Uint32(RawId(value.id.id + 1));
+  visitor.Int(int(value.kind) | int(value.role) << 3);
+}
+
+template <typename T>
+void ReflectReferences(Reader& visitor, std::vector<T>& values) {
+  if (visitor.Format() == SerializeFormat::Json) {
+    visitor.IterArray([&](Reader& entry) {
+      T value;
+      Reflect(entry, static_cast<Reference&>(value));
+      values.push_back(value);
+    });
+  } else {
+    int line = 0;
+    visitor.IterArray([&](Reader& entry) {
+      T value;
+      ReadPackedReference(entry, value, line);
+      values.push_back(value);
+    });
+  }
+}
+template <typename T>
+void ReflectReferences(Writer& visitor, std::vector<T>& values) {
+  visitor.StartArray(values.size());
+  if (visitor.Format() == SerializeFormat::Json) {
+    for (T& value : values)
+      Reflect(visitor, static_cast<Reference&>(value));
+  } else {
+    int line = 0;
+    for (T& value : values)
+      WritePackedReference(visitor, value, line);
+  }
+  visitor.EndArray();
+}
+
+}  // namespace
+
 // |SymbolRef| is serialized this way.
 // |Use| also uses this though it has an extra field |file|,
 // which is not used by Index* so it does not need to be serialized.
@@ -2419,10 +2842,8 @@ void Reflect(Reader& visitor, Reference& value) {
     value.kind = static_cast<SymbolKind>(strtol(s + 1, &s, 10));
     value.role = static_cast<Role>(strtol(s + 1, &s, 10));
   } else {
-    Reflect(visitor, value.range);
-    Reflect(visitor, value.id);
-    Reflect(visitor, value.kind);
-    Reflect(visitor, value.role);
+    int line = 0;
+    ReadPackedReference(visitor, value, line);
   }
 }
 void Reflect(Writer& visitor, Reference& value) {
@@ -2435,9 +2856,110 @@ void Reflect(Writer& visitor, Reference& value) {
     s += '|' + std::to_string(int(value.role));
     Reflect(visitor, s);
   } else {
-    Reflect(visitor, value.range);
-    Reflect(visitor, value.id);
-    Reflect(visitor, value.kind);
-    Reflect(visitor, value.role);
+    int line = 0;
+    WritePackedReference(visitor, value, line);
+  }
+}
+
+void Reflect(Reader& visitor, std::vector<IndexSymbolRef>& values) {
+  ReflectReferences(visitor, values);
+}
+void Reflect(Writer& visitor, std::vector<IndexSymbolRef>& values) {
+  ReflectReferences(visitor, values);
+}
+void Reflect(Reader& visitor, std::vector<IndexLexicalRef>& values) {
+  ReflectReferences(visitor, values);
+}
+void Reflect(Writer& visitor, std::vector<IndexLexicalRef>& values) {
+  ReflectReferences(visitor, values);
+}
+
+TEST_SUITE("Indexer") {
+  TEST_CASE("reindex open file after its header changed") {
+    // Saving a header reindexes the translation units which include it, with
+    // the header's new contents.
+    std::string impl_path = "index_tests/multi_file/simple_impl.cc";
+    optional<AbsolutePath> header_path =
+        NormalizePath("index_tests/multi_file/simple_header.h");
+    REQUIRE(header_path);
+    ClangIndex index;
+    FileConsumerSharedState file_consumer_shared;
+    auto indexes = Parse(
+        &file_consumer_shared, impl_path, {"-xc++", "-std=c++14", impl_path},
+        {FileContents(*header_path,
+                      "#pragma once\nvoid header();\nvoid added();\n")},
+        &index);
+    REQUIRE(indexes);
+
+    IndexFile* impl = nullptr;
+    IndexFile* header = nullptr;
+    for (std::unique_ptr<IndexFile>& entry : *indexes)
+      (entry->path == *header_path ? header : impl) = entry.get();
+    REQUIRE(impl);
+    REQUIRE(header);
+    REQUIRE(impl->includes.size() == 1);
+    REQUIRE(impl->includes[0].resolved_path == header_path->path);
+    REQUIRE(impl->dependencies == std::vector<AbsolutePath>{*header_path});
+
+    std::vector<std::string> funcs;
+    for (IndexFunc& func : header->funcs)
+      funcs.push_back(std::string(func.def.ShortName()));
+    std::sort(funcs.begin(), funcs.end());
+    REQUIRE(funcs == std::vector<std::string>{"added", "header"});
+  }
+
+  TEST_CASE("include context of headers") {
+    // simple_impl.cc includes simple_header.h, which includes header.h.
+    std::string impl_path = "index_tests/multi_file/simple_impl.cc";
+    optional<AbsolutePath> impl = NormalizePath(impl_path);
+    optional<AbsolutePath> header =
+        NormalizePath("index_tests/multi_file/simple_header.h");
+    optional<AbsolutePath> nested =
+        NormalizePath("index_tests/multi_file/header.h");
+    REQUIRE(impl);
+    REQUIRE(header);
+    REQUIRE(nested);
+    auto index_header = [&](const std::string& impl_contents,
+                            const std::string& nested_contents) {
+      ClangIndex index;
+      FileConsumerSharedState file_consumer_shared;
+      auto indexes = Parse(
+          &file_consumer_shared, impl_path, {"-xc++", "-std=c++14", impl_path},
+          {FileContents(*impl, impl_contents),
+           FileContents(*header,
+                        "#pragma once\n#include \"header.h\"\n"
+                        "#if X\nvoid x();\n#endif\nvoid header();\n"),
+           FileContents(*nested, nested_contents)},
+          &index);
+      REQUIRE(indexes);
+      for (std::unique_ptr<IndexFile>& entry : *indexes) {
+        if (entry->path == *header)
+          return std::make_pair(entry->content_hash,
+                                entry->include_context_hash);
+      }
+      FAIL("simple_header.h was not indexed");
+      return std::make_pair(uint64_t(0), uint64_t(0));
+    };
+
+    std::string impl_contents =
+        "#include \"simple_header.h\"\nvoid impl() {}\n";
+    std::string nested_contents = "#pragma once\nstruct Base {};\n";
+    auto base = index_header(impl_contents, nested_contents);
+
+    // Editing the translation unit after the #include does not change what the
+    // header sees.
+    REQUIRE(index_header(impl_contents + "void added() {}\n",
+                         nested_contents) == base);
+
+    // Neither the header nor its arguments changed, but a macro defined before
+    // the #include or a header it includes did.
+    auto with_macro = index_header("#define X 1\n" + impl_contents,
+                                   nested_contents);
+    REQUIRE(with_macro.first == base.first);
+    REQUIRE(with_macro.second != base.second);
+    auto with_nested_change = index_header(
+        impl_contents, nested_contents + "struct Derived : Base {};\n");
+    REQUIRE(with_nested_change.first == base.first);
+    REQUIRE(with_nested_change.second != base.second);
   }
 }
@@ -3,29 +3,35 @@
 #include "clang_complete.h"
 #include "code_complete_cache.h"
 #include "diagnostics_engine.h"
+#include "docs_cache.h"
 #include "file_consumer.h"
 #include "import_manager.h"
 #include "import_pipeline.h"
 #include "include_complete.h"
 #include "indexer.h"
+#include "indexer_worker.h"
 #include "lex_utils.h"
 #include "lru_cache.h"
 #include "lsp_diagnostic.h"
 #include "match.h"
 #include "message_handler.h"
+#include "metrics.h"
 #include "options.h"
+#include "parse_quarantine.h"
 #include "platform.h"
 #include "project.h"
 #include "query.h"
 #include "query_utils.h"
 #include "queue_manager.h"
 #include "recorder.h"
+#include "replay.h"
 #include "semantic_highlight_symbol_cache.h"
 #include "serializer.h"
 #include "serializers/json.h"
 #include "test.h"
 #include "timer.h"
 #include "timestamp_manager.h"
+#include "trace.h"
 #include "work_thread.h"
 #include "working_files.h"
 
@@ -35,6 +41,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <algorithm>
 #include <functional>
 #include <iostream>
 #include <iterator>
@@ -74,11 +81,26 @@ Mode:
                 This can be used to quickly test to see if your project
                 configuration will work. The current directory is used as the
                 project directory.
+  --index-project <root>
+                Index every file in the project at root, write the results to
+                the cache and exit. cacheDirectory and other options are taken
+                from --init. Prints throughput statistics when done. This can
+                be used to prebuild a cache, eg, on a CI machine.
   --test-unit   Run unit tests.
   --test-index <opt_filter_path>
                 Run index tests. opt_filter_path can be used to specify which
                 test to run (ie, "foo" will run all tests which contain "foo"
                 in the path). If not provided all tests are run.
+  --replay <path>.in
+                Run as a language server, but read the session recorded with
+                --record from <path>.in instead of stdin. Once the import is
+                done, prints the latency percentiles of every LSP method and
+                how long the import took, then exits. Options:
+                  --replay-speed <factor>: speed up the recorded timing; 0
+                    sends messages back to back (default: 1)
+                  --replay-root <dir>: replace the recorded workspace root
+                    with <dir>, eg, a checkout of a fixture project
+                  --replay-report <path>: also write the report as JSON
   (default if no other mode is specified)
                 Run as a language server over stdin and stdout
 
@@ -87,7 +109,13 @@ Other command line options:
                 Override client provided initialization options
          https://github.com/cquery-project/cquery/wiki/Initialization-options
   --record <path>
-                Writes stdin to <path>.in and stdout to <path>.out
+                Writes stdin to <path>.in and stdout to <path>.out. The .in file
+                can be replayed with --replay.
+  --trace <path>
+                Records how long each file spends in each stage and queue of
+                the import pipeline and writes it to <path> on exit, in Chrome
+                trace-event format (default path: cquery-trace.json). See also
+                $cquery/trace.
   --log-file <path>
                 Logging file for diagnostics
   --log-file-append <path>
@@ -101,6 +129,9 @@ Other command line options:
                 continuous integration so it can fail faster instead of timing
                 out.
   --print-env   Print all environment variables cquery is running with.
+  --indexer-worker
+                Used internally to run an indexer worker process, see the
+                index.outOfProcess initialization option.
 
 See more on https://github.com/cquery-project/cquery/wiki
 )help";
@@ -137,6 +168,29 @@ void WriteQueryDbStatus(bool is_active) {
   QueueManager::WriteStdout(kMethodType_CqueryQueryDbStatus, out);
 }
 
+// Parses |g_init_options| into |config|. Prints an error and returns false if
+// the options are malformed.
+bool ReflectInitOptions(Config* config) {
+  rapidjson::Document reader;
+  rapidjson::ParseResult ok = reader.Parse(g_init_options.c_str());
+  if (!ok) {
+    std::cerr << "Failed to parse --init as JSON: "
+              << rapidjson::GetParseError_En(ok.Code()) << " (" << ok.Offset()
+              << ")\n";
+    return false;
+  }
+  JsonReader json_reader{&reader};
+  try {
+    Reflect(json_reader, *config);
+  } catch (std::invalid_argument& e) {
+    std::cerr << "Fail to parse --init "
+              << static_cast<JsonReader&>(json_reader).GetPath()
+              << ", expected " << e.what() << "\n";
+    return false;
+  }
+  return true;
+}
+
 }  // namespace
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -164,6 +218,7 @@ bool QueryDbMainLoop(QueryDatabase* db,
                      ImportPipelineStatus* status,
                      TimestampManager* timestamp_manager,
                      SemanticHighlightSymbolCache* semantic_cache,
+                     DocsCache* docs_cache,
                      WorkingFiles* working_files,
                      ClangCompleteManager* clang_complete,
                      IncludeComplete* include_complete,
@@ -196,7 +251,7 @@ bool QueryDbMainLoop(QueryDatabase* db,
   }
 
   if (QueryDb_ImportMain(db, import_manager, status, semantic_cache,
-                         working_files)) {
+                         docs_cache, working_files)) {
     did_work = true;
   }
 
@@ -206,6 +261,7 @@ bool QueryDbMainLoop(QueryDatabase* db,
 void RunQueryDbThread(const std::string& bin_name) {
   Project project;
   SemanticHighlightSymbolCache semantic_cache;
+  DocsCache docs_cache;
   WorkingFiles working_files;
   FileConsumerSharedState file_consumer_shared;
   DiagnosticsEngine diag_engine;
@@ -235,6 +291,10 @@ void RunQueryDbThread(const std::string& bin_name) {
   ImportPipelineStatus import_pipeline_status;
   TimestampManager timestamp_manager;
   QueryDatabase db;
+  file_consumer_shared.use_shared_index =
+      [&](const AbsolutePath& path, const std::vector<std::string>& args) {
+        return HasSharedSystemIndex(&timestamp_manager, path, args);
+      };
 
   // Setup shared references.
   for (MessageHandler* handler : *MessageHandler::message_handlers) {
@@ -246,6 +306,7 @@ void RunQueryDbThread(const std::string& bin_name) {
     handler->import_pipeline_status = &import_pipeline_status;
     handler->timestamp_manager = &timestamp_manager;
     handler->semantic_cache = &semantic_cache;
+    handler->docs_cache = &docs_cache;
     handler->working_files = &working_files;
     handler->clang_complete = &clang_complete;
     handler->include_complete = &include_complete;
@@ -262,7 +323,7 @@ void RunQueryDbThread(const std::string& bin_name) {
     bool did_work = QueryDbMainLoop(
         &db, &project, &file_consumer_shared, &import_manager,
         &import_pipeline_status, &timestamp_manager, &semantic_cache,
-        &working_files, &clang_complete, &include_complete,
+        &docs_cache, &working_files, &clang_complete, &include_complete,
         global_code_complete_cache.get(), non_global_code_complete_cache.get(),
         signature_cache.get());
 
@@ -354,21 +415,34 @@ void LaunchStdoutThread(std::unordered_map<MethodType, Timer>* request_times) {
 
       if (ShouldDisplayMethodTiming(message.method)) {
         Timer time = (*request_times)[message.method];
+        RecordLatency("lsp." + std::string(message.method),
+                      time.ElapsedMicroseconds());
         time.ResetAndPrint("[e2e] Running " + std::string(message.method));
       }
 
       RecordOutput(message.content);
 
+      if (IsReplaying()) {
+        OnReplayOutput(message.content);
+        continue;
+      }
+
       fwrite(message.content.c_str(), message.content.size(), 1, stdout);
       fflush(stdout);
     }
   });
 }
 
-void LanguageServerMain(const std::string& bin_name) {
+bool LanguageServerMain(const std::string& bin_name,
+                        const optional<ReplayOptions>& replay) {
   std::unordered_map<MethodType, Timer> request_times;
 
-  LaunchStdinLoop(&request_times);
+  if (replay) {
+    if (!LaunchReplayThread(*replay, &request_times))
+      return false;
+  } else {
+    LaunchStdinLoop(&request_times);
+  }
 
   // We run a dedicated thread for writing to stdout because there can be an
   // unknown number of delays when output information.
@@ -377,6 +451,62 @@ void LanguageServerMain(const std::string& bin_name) {
   // Start querydb which takes over this thread. The querydb will launch
   // indexer threads as needed.
   RunQueryDbThread(bin_name);
+  return true;
+}
+
+// Runs --index-project. Sets up |g_config| the way initialize does for a
+// client, then indexes the whole project into the cache.
+bool IndexProjectMain(const std::string& root) {
+  optional<AbsolutePath> project_path = NormalizePath(root);
+  if (!project_path) {
+    std::cerr << "Cannot find project directory \"" << root << "\"\n";
+    return false;
+  }
+
+  if (!g_init_options.empty() && !ReflectInitOptions(g_config))
+    return false;
+  if (g_config->cacheDirectory.empty()) {
+    std::cerr << "--index-project requires cacheDirectory to be set with "
+              << "--init\n";
+    return false;
+  }
+  optional<AbsolutePath> cache_dir =
+      NormalizePath(g_config->cacheDirectory, false /*ensure_exists*/);
+  if (!cache_dir) {
+    std::cerr << "Cannot find cache directory " << g_config->cacheDirectory
+              << "\n";
+    return false;
+  }
+  g_config->cacheDirectory = *cache_dir;
+  EnsureEndsInSlash(g_config->cacheDirectory);
+
+  if (g_config->resourceDirectory.empty()) {
+    optional<AbsolutePath> resource_dir = GetDefaultResourceDirectory();
+    if (!resource_dir) {
+      std::cerr << "Cannot resolve resource directory\n";
+      return false;
+    }
+    g_config->resourceDirectory = resource_dir->path;
+  }
+
+  g_config->projectRoot = project_path->path;
+  EnsureEndsInSlash(g_config->projectRoot);
+  ICacheManager::MakeCacheDirectories();
+  ParseQuarantine::instance()->Load(
+      ICacheManager::GetProjectCachePath("@parse_quarantine.json"));
+
+  Timer time;
+  Project project;
+  project.Load(g_config->projectRoot);
+  time.ResetAndPrint("[perf] Loaded compilation entries (" +
+                     std::to_string(project.entries.size()) + " files)");
+
+  // Unlike the language server, a batch run has the machine to itself, so use
+  // every core by default.
+  int num_threads = g_config->index.threads;
+  if (num_threads <= 0)
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  return IndexProjectHeadless(&project, num_threads);
 }
 
 int main(int argc, char** argv, const char** env) {
@@ -426,12 +556,20 @@ int main(int argc, char** argv, const char** env) {
   PlatformInit();
   IndexInit();
 
+  if (HasOption(options, "--indexer-worker"))
+    return RunIndexerWorker();
+
   if (HasOption(options, "--print-env"))
     PrintEnvironment(env);
 
   if (HasOption(options, "--record"))
     EnableRecording(options["--record"]);
 
+  if (HasOption(options, "--trace")) {
+    StartTracing(options["--trace"].empty() ? "cquery-trace.json"
+                                            : options["--trace"]);
+  }
+
   if (HasOption(options, "--check")) {
     loguru::g_stderr_verbosity = loguru::Verbosity_MAX;
 
@@ -458,11 +596,18 @@ int main(int argc, char** argv, const char** env) {
     config.resourceDirectory = GetDefaultResourceDirectory()->path;
     project.Load(GetWorkingDirectory().path);
     Project::Entry entry = project.FindCompilationEntryForFile(path->path);
-    LOG_S(INFO) << "Using arguments " << StringJoin(entry.args, " ");
+    LOG_S(INFO) << "Using arguments " << StringJoin(entry.args.Get(), " ");
     ClangSanityCheck(entry);
     return 0;
   }
 
+  if (HasOption(options, "--index-project")) {
+    language_server = false;
+    g_init_options = options["--init"];
+    if (!IndexProjectMain(options["--index-project"]))
+      return 1;
+  }
+
   if (HasOption(options, "--test-unit")) {
     language_server = false;
     doctest::Context context;
@@ -483,27 +628,23 @@ int main(int argc, char** argv, const char** env) {
       // We check syntax error here but override client-side
       // initializationOptions in messages/initialize.cc
       g_init_options = options["--init"];
-      rapidjson::Document reader;
-      rapidjson::ParseResult ok = reader.Parse(g_init_options.c_str());
-      if (!ok) {
-        std::cerr << "Failed to parse --init as JSON: "
-                  << rapidjson::GetParseError_En(ok.Code()) << " ("
-                  << ok.Offset() << ")\n";
-        return 1;
-      }
-      JsonReader json_reader{&reader};
-      try {
-        Config config;
-        Reflect(json_reader, config);
-      } catch (std::invalid_argument& e) {
-        std::cerr << "Fail to parse --init "
-                  << static_cast<JsonReader&>(json_reader).GetPath()
-                  << ", expected " << e.what() << "\n";
+      Config config;
+      if (!ReflectInitOptions(&config))
         return 1;
-      }
     }
 
-    LanguageServerMain(argv[0]);
+    optional<ReplayOptions> replay;
+    if (HasOption(options, "--replay")) {
+      replay = ReplayOptions();
+      replay->path = options["--replay"];
+      if (HasOption(options, "--replay-speed"))
+        replay->speed = atof(options["--replay-speed"].c_str());
+      replay->root = options["--replay-root"];
+      replay->report_path = options["--replay-report"];
+    }
+
+    if (!LanguageServerMain(argv[0], replay))
+      return 1;
   }
 
   if (HasOption(options, "--wait-for-input")) {
@@ -48,6 +48,25 @@ struct Config {
   // member has changed.
   SerializeFormat cacheFormat = SerializeFormat::Json;
 
+  // If true, cache files are named and store paths relative to the project
+  // root, so a cache built in one checkout (eg, with --index-project on a CI
+  // machine) can be used by a checkout at a different location. Files outside
+  // of the project, such as system headers, keep their absolute paths. Since
+  // timestamps do not survive a copy, a file whose timestamp differs from the
+  // cache is only reindexed if its contents differ too. The cache is stored
+  // under the name of the project root directory, so both checkouts must use
+  // the same name, and projects sharing cacheDirectory need different ones.
+  bool relocatableCache = false;
+
+  // If set, files outside of the project, such as system and third-party
+  // headers, are cached in this directory instead of per project, so every
+  // project on the machine shares one index of them. Entries are grouped by
+  // clang version, resource directory and the arguments which change how
+  // headers are preprocessed (eg, -D, -U, -std, -isystem and the target). A
+  // header with an up-to-date entry is not indexed again; its index is loaded
+  // from this directory instead.
+  std::string systemCacheDirectory;
+
   // Value to use for clang -resource-dir if not present in
   // compile_commands.json.
   //
@@ -177,6 +196,11 @@ struct Config {
     //   xxx: at most every xxx milliseconds
     int frequencyMs = 0;
 
+    // How long to wait after the last edit to a file before reparsing it for
+    // diagnostics. Edits made within this window are coalesced into a single
+    // reparse. Set to 0 to reparse after every edit.
+    int debounceMs = 200;
+
     // If true, diagnostics from a full document parse will be reported.
     bool onParse = true;
     // If true, diagnostics from typing will be reported.
@@ -229,6 +253,35 @@ struct Config {
 
     // Number of indexer threads. If 0, 80% of cores are used.
     int threads = 0;
+
+    // If true, every indexer thread parses in its own worker process, so a
+    // libclang crash or a pathological translation unit cannot take down
+    // cquery or fragment its heap. A worker which crashes is restarted for the
+    // next file. Not supported on Windows; indexing stays in-process there.
+    bool outOfProcess = false;
+
+    // A worker process is restarted once it uses more than this many MB after
+    // a translation unit. 0 disables the limit.
+    int workerMemoryLimitMb = 2000;
+
+    // Indexing a translation unit is abandoned after this many milliseconds,
+    // so a pathological file cannot hold an indexer thread while the rest of
+    // the project waits. Parsing cannot be interrupted and does not count.
+    // The file is indexed again without a limit once the other files are
+    // done. 0 disables the limit.
+    int parseTimeoutMs = 120000;
+
+    // A translation unit which ran out of time in this many sessions in a row
+    // is quarantined: later sessions index it after every other file, without
+    // a limit. 0 disables quarantine.
+    int quarantineAfterTimeouts = 2;
+
+    // If true, files which are not open are first indexed with reduced
+    // fidelity: no function-local symbols, implicit template instantiations,
+    // hover or comments. Navigation is then available much sooner on a cold
+    // start, and every file is indexed again with full fidelity in the
+    // background afterwards.
+    bool reducedFirstPass = false;
   };
   Index index;
 
@@ -267,6 +320,7 @@ MAKE_REFLECT_STRUCT(Config::Diagnostics,
                     blacklist,
                     whitelist,
                     frequencyMs,
+                    debounceMs,
                     onParse,
                     onType)
 MAKE_REFLECT_STRUCT(Config::Highlight, enabled, blacklist, whitelist)
@@ -277,7 +331,12 @@ MAKE_REFLECT_STRUCT(Config::Index,
                     comments,
                     enabled,
                     logSkippedPaths,
-                    threads);
+                    threads,
+                    outOfProcess,
+                    workerMemoryLimitMb,
+                    parseTimeoutMs,
+                    quarantineAfterTimeouts,
+                    reducedFirstPass);
 MAKE_REFLECT_STRUCT(Config::WorkspaceSymbol, maxNum, sort);
 MAKE_REFLECT_STRUCT(Config::Xref, maxNum);
 MAKE_REFLECT_STRUCT(Config,
@@ -285,6 +344,8 @@ MAKE_REFLECT_STRUCT(Config,
                     compilationDatabaseDirectory,
                     cacheDirectory,
                     cacheFormat,
+                    relocatableCache,
+                    systemCacheDirectory,
                     resourceDirectory,
 
                     discoverSystemIncludes,
@@ -2,8 +2,28 @@
 
 #include "queue_manager.h"
 
+#include <doctest/doctest.h>
+
 #include <chrono>
 
+namespace {
+
+// lsDiagnostic::operator== only looks at range and message; a change in
+// severity or code is still visible to the user so it must be re-sent.
+bool SameDiagnostics(const std::vector<lsDiagnostic>& a,
+                     const std::vector<lsDiagnostic>& b) {
+  if (a.size() != b.size())
+    return false;
+  for (size_t i = 0; i < a.size(); ++i) {
+    if (a[i] != b[i] || a[i].severity != b[i].severity ||
+        a[i].code != b[i].code)
+      return false;
+  }
+  return true;
+}
+
+}  // namespace
+
 void DiagnosticsEngine::Init() {
   frequencyMs_ = g_config->diagnostics.frequencyMs;
   match_ = std::make_unique<GroupMatch>(g_config->diagnostics.whitelist,
@@ -19,17 +39,108 @@ void DiagnosticsEngine::Publish(WorkingFiles* working_files,
       working_file->diagnostics_ = diagnostics;
   });
 
+  if (frequencyMs_ < 0 || !match_->IsMatch(path))
+    return;
+
   int64_t now =
       std::chrono::duration_cast<std::chrono::milliseconds>(
           std::chrono::high_resolution_clock::now().time_since_epoch())
           .count();
-  if (frequencyMs_ >= 0 && (nextPublish_ <= now || diagnostics.empty()) &&
-      match_->IsMatch(path)) {
-    nextPublish_ = now + frequencyMs_;
-
-    Out_TextDocumentPublishDiagnostics out;
-    out.params.uri = lsDocumentUri::FromPath(path);
-    out.params.diagnostics = diagnostics;
-    QueueManager::WriteStdout(kMethodType_TextDocumentPublishDiagnostics, out);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    FileState& state = files_[path];
+    if (SameDiagnostics(state.published, diagnostics))
+      return;
+    if (state.next_publish > now && !diagnostics.empty())
+      return;
+    state.next_publish = now + frequencyMs_;
+    state.published = diagnostics;
+  }
+
+  Out_TextDocumentPublishDiagnostics out;
+  out.params.uri = lsDocumentUri::FromPath(path);
+  out.params.diagnostics = std::move(diagnostics);
+  QueueManager::WriteStdout(kMethodType_TextDocumentPublishDiagnostics, out);
+}
+
+void DiagnosticsEngine::OnClose(const std::string& path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  files_.erase(path);
+}
+
+TEST_SUITE("DiagnosticsEngine") {
+  TEST_CASE("unchanged diagnostics are not republished") {
+    QueueManager::Init();
+    auto* queue = QueueManager::instance();
+    WorkingFiles working_files;
+    DiagnosticsEngine engine;
+    engine.Init();
+    engine.frequencyMs_ = 0;
+
+    lsDiagnostic diagnostic;
+    diagnostic.range = lsRange(lsPosition(1, 2), lsPosition(1, 5));
+    diagnostic.severity = lsDiagnosticSeverity::Error;
+    diagnostic.message = "foo";
+
+    engine.Publish(&working_files, "/a.cc", {diagnostic});
+    REQUIRE(queue->for_stdout.Size() == 1);
+    engine.Publish(&working_files, "/a.cc", {diagnostic});
+    REQUIRE(queue->for_stdout.Size() == 1);
+
+    // Other files are tracked separately.
+    engine.Publish(&working_files, "/b.cc", {diagnostic});
+    REQUIRE(queue->for_stdout.Size() == 2);
+
+    // A severity change is visible to the user.
+    diagnostic.severity = lsDiagnosticSeverity::Warning;
+    engine.Publish(&working_files, "/a.cc", {diagnostic});
+    REQUIRE(queue->for_stdout.Size() == 3);
+
+    // Clearing is published once.
+    engine.Publish(&working_files, "/a.cc", {});
+    engine.Publish(&working_files, "/a.cc", {});
+    REQUIRE(queue->for_stdout.Size() == 4);
+  }
+
+  TEST_CASE("throttle is per file") {
+    QueueManager::Init();
+    auto* queue = QueueManager::instance();
+    WorkingFiles working_files;
+    DiagnosticsEngine engine;
+    engine.Init();
+    engine.frequencyMs_ = 1000 * 60;
+
+    lsDiagnostic diagnostic;
+    diagnostic.message = "foo";
+    engine.Publish(&working_files, "/a.cc", {diagnostic});
+    REQUIRE(queue->for_stdout.Size() == 1);
+
+    // Throttled; |/a.cc| was published too recently.
+    diagnostic.message = "bar";
+    engine.Publish(&working_files, "/a.cc", {diagnostic});
+    REQUIRE(queue->for_stdout.Size() == 1);
+
+    // Not throttled; |/b.cc| has not been published yet.
+    engine.Publish(&working_files, "/b.cc", {diagnostic});
+    REQUIRE(queue->for_stdout.Size() == 2);
+  }
+
+  TEST_CASE("diagnostics are republished after close") {
+    QueueManager::Init();
+    auto* queue = QueueManager::instance();
+    WorkingFiles working_files;
+    DiagnosticsEngine engine;
+    engine.Init();
+    engine.frequencyMs_ = 0;
+
+    lsDiagnostic diagnostic;
+    diagnostic.message = "foo";
+    engine.Publish(&working_files, "/a.cc", {diagnostic});
+    REQUIRE(queue->for_stdout.Size() == 1);
+
+    engine.OnClose("/a.cc");
+    REQUIRE(engine.files_.empty());
+    engine.Publish(&working_files, "/a.cc", {diagnostic});
+    REQUIRE(queue->for_stdout.Size() == 2);
   }
 }
@@ -3,13 +3,31 @@
 #include "match.h"
 #include "working_files.h"
 
+#include <mutex>
+#include <unordered_map>
+
 struct DiagnosticsEngine {
   void Init();
   void Publish(WorkingFiles* working_files,
                std::string path,
                std::vector<lsDiagnostic> diagnostics);
+  // Forgets what was published for |path|. The client drops the diagnostics
+  // of a closed file, so they are sent again if it is reopened.
+  void OnClose(const std::string& path);
+
+  // Per-file publishing state. Throttling is tracked per file so that
+  // diagnostics for one file do not delay diagnostics for another.
+  struct FileState {
+    int64_t next_publish = 0;
+    // The diagnostics last sent to the client. An identical set is never
+    // re-sent.
+    std::vector<lsDiagnostic> published;
+  };
 
   std::unique_ptr<GroupMatch> match_;
-  int64_t nextPublish_ = 0;
   int frequencyMs_;
+
+  // Publish is called from the indexer and code completion threads.
+  std::mutex mutex_;
+  std::unordered_map<std::string, FileState> files_;
 };
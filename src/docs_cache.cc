@@ -0,0 +1,91 @@
+#include "docs_cache.h"
+
+#include "cache_manager.h"
+
+#include <doctest/doctest.h>
+
+DocsCache::Entry::Entry(std::vector<IndexSymbolDocs>&& docs) {
+  for (IndexSymbolDocs& entry : docs) {
+    switch (entry.kind) {
+      case SymbolKind::Type:
+        types[entry.usr] = std::move(entry.docs);
+        break;
+      case SymbolKind::Func:
+        funcs[entry.usr] = std::move(entry.docs);
+        break;
+      case SymbolKind::Var:
+        vars[entry.usr] = std::move(entry.docs);
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+DocsCache::DocsCache() : cache_(kCacheSize) {}
+
+void DocsCache::Update(IndexFileDocs&& docs) {
+  Key key{std::move(docs.path), docs.content_hash};
+  cache_.TryTake(key, nullptr);
+  cache_.Insert(key, std::make_shared<Entry>(std::move(docs.docs)));
+}
+
+optional<IndexDocs> DocsCache::Get(const QueryFile::Def& file,
+                                   SymbolKind kind,
+                                   Usr usr) {
+  Key key{file.path.path, file.content_hash};
+  std::shared_ptr<Entry> entry;
+  if (!cache_.TryGet(key, &entry)) {
+    // Docs of system headers are keyed by the arguments they were indexed
+    // with. A file without docs is cached too, so it is not read again.
+    std::shared_ptr<ICacheManager> cache_manager =
+        ICacheManager::Make(file.args.Get());
+    optional<std::vector<IndexSymbolDocs>> docs =
+        cache_manager->LoadDocs(file.path);
+    entry = std::make_shared<Entry>(
+        docs ? std::move(*docs) : std::vector<IndexSymbolDocs>());
+    cache_.Insert(key, entry);
+  }
+
+  const std::unordered_map<Usr, IndexDocs>* docs = nullptr;
+  switch (kind) {
+    case SymbolKind::Type:
+      docs = &entry->types;
+      break;
+    case SymbolKind::Func:
+      docs = &entry->funcs;
+      break;
+    case SymbolKind::Var:
+      docs = &entry->vars;
+      break;
+    default:
+      return nullopt;
+  }
+  auto it = docs->find(usr);
+  if (it == docs->end())
+    return nullopt;
+  return it->second;
+}
+
+TEST_SUITE("DocsCache") {
+  TEST_CASE("serves docs of freshly indexed files") {
+    IndexSymbolDocs docs;
+    docs.kind = SymbolKind::Func;
+    docs.usr = 42;
+    docs.docs.hover = "void foo()";
+    docs.docs.comments = "Does foo.";
+
+    DocsCache cache;
+    cache.Update({"/a.cc", 1, {docs}});
+
+    QueryFile::Def file;
+    file.path = AbsolutePath::BuildDoNotUse("/a.cc");
+    file.content_hash = 1;
+    optional<IndexDocs> result = cache.Get(file, SymbolKind::Func, 42);
+    REQUIRE(result);
+    REQUIRE(result->hover == "void foo()");
+    REQUIRE(result->comments == "Does foo.");
+    // Same usr, other kind.
+    REQUIRE(!cache.Get(file, SymbolKind::Var, 42));
+  }
+}
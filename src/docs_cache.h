@@ -0,0 +1,55 @@
+#pragma once
+
+#include "indexer.h"
+#include "lru_cache.h"
+#include "query.h"
+
+#include <optional.h>
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Hover and comments of the symbols of a file which was just indexed.
+struct IndexFileDocs {
+  std::string path;
+  uint64_t content_hash = 0;
+  std::vector<IndexSymbolDocs> docs;
+};
+
+// Hover and comments for querydb, which does not store them (see IndexDocs).
+// The docs of recently used files are kept in memory, looked up by usr, so a
+// hover does not read and parse a whole docs cache file. Files are keyed by
+// path and content hash, so the docs of a reindexed file are not served from
+// the old entry.
+struct DocsCache {
+  DocsCache();
+
+  // Keeps the docs of a freshly indexed file. They are served even if the
+  // docs cache file cannot be read.
+  void Update(IndexFileDocs&& docs);
+
+  // Returns the docs of the symbol |usr| of |kind| which is defined in |file|.
+  optional<IndexDocs> Get(const QueryFile::Def& file, SymbolKind kind, Usr usr);
+
+ private:
+  struct Key {
+    std::string path;
+    uint64_t content_hash = 0;
+
+    bool operator==(const Key& o) const {
+      return content_hash == o.content_hash && path == o.path;
+    }
+  };
+  struct Entry {
+    std::unordered_map<Usr, IndexDocs> types;
+    std::unordered_map<Usr, IndexDocs> funcs;
+    std::unordered_map<Usr, IndexDocs> vars;
+
+    explicit Entry(std::vector<IndexSymbolDocs>&& docs);
+  };
+
+  constexpr static int kCacheSize = 32;
+  LruCache<Key, std::shared_ptr<Entry>> cache_;
+};
@@ -13,6 +13,8 @@ bool operator==(const CXFileUniqueID& a, const CXFileUniqueID& b) {
 }
 
 bool FileConsumerSharedState::Mark(const std::string& file) {
+  if (claim)
+    return claim(file);
   std::lock_guard<std::mutex> lock(mutex);
   return used_files.insert(file).second;
 }
@@ -24,9 +26,28 @@ void FileConsumerSharedState::Reset(const std::string& file) {
     used_files.erase(it);
 }
 
+bool FileConsumerSharedState::UseSharedIndex(
+    const AbsolutePath& file,
+    const std::vector<std::string>& args) const {
+  if (!use_shared_index)
+    return false;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (unusable_shared_indexes.count(file.path))
+      return false;
+  }
+  return use_shared_index(file, args);
+}
+
+void FileConsumerSharedState::OnSharedIndexLoadFailed(const std::string& file) {
+  std::lock_guard<std::mutex> lock(mutex);
+  unusable_shared_indexes.insert(file);
+}
+
 FileConsumer::FileConsumer(FileConsumerSharedState* shared_state,
-                           const AbsolutePath& parse_file)
-    : shared_(shared_state), parse_file_(parse_file) {}
+                           const AbsolutePath& parse_file,
+                           const std::vector<std::string>& args)
+    : shared_(shared_state), parse_file_(parse_file), args_(args) {}
 
 IndexFile* FileConsumer::TryConsumeFile(CXFile file,
                                         bool* is_first_ownership) {
@@ -52,6 +73,12 @@ IndexFile* FileConsumer::TryConsumeFile(CXFile file,
     return nullptr;
   }
 
+  // Headers with a shared index are loaded from cache by the import pipeline.
+  if (shared_->UseSharedIndex(*file_name, args_)) {
+    local_[file_id] = nullptr;
+    return nullptr;
+  }
+
   // No result in local; we need to query global.
   bool did_insert = shared_->Mark(file_name->path);
 
@@ -18,12 +18,35 @@ bool operator==(const CXFileUniqueID& a, const CXFileUniqueID& b);
 
 struct FileConsumerSharedState {
   mutable std::unordered_set<std::string> used_files;
+  // Files whose shared index could not be loaded. They are indexed like any
+  // other file for the rest of the session.
+  mutable std::unordered_set<std::string> unusable_shared_indexes;
   mutable std::mutex mutex;
 
+  // Returns true if the index of |file|, as included by a translation unit
+  // compiled with |args|, should be loaded from the shared system header cache
+  // instead of being built (see Config::systemCacheDirectory). No FileConsumer
+  // takes ownership of such files. Set once before indexing starts.
+  std::function<bool(const AbsolutePath& file,
+                     const std::vector<std::string>& args)>
+      use_shared_index;
+  // If set, decides which files are marked instead of |used_files|. Indexer
+  // workers use this to ask the language server, which keeps the state shared
+  // by all translation units.
+  std::function<bool(const std::string& file)> claim;
+
   // Mark the file as used. Returns true if the file was not previously used.
   bool Mark(const std::string& file);
   // Reset the used state (ie, mark the file as unused).
   void Reset(const std::string& file);
+
+  // Calls |use_shared_index| unless loading the shared index of |file| has
+  // failed before.
+  bool UseSharedIndex(const AbsolutePath& file,
+                      const std::vector<std::string>& args) const;
+  // Records that the shared index of |file| could not be loaded, so it is no
+  // longer used.
+  void OnSharedIndexLoadFailed(const std::string& file);
 };
 
 // FileConsumer is used by the indexer. When it encouters a file, it tries to
@@ -35,7 +58,8 @@ struct FileConsumerSharedState {
 // units but we still want to index them.
 struct FileConsumer {
   FileConsumer(FileConsumerSharedState* shared_state,
-               const AbsolutePath& parse_file);
+               const AbsolutePath& parse_file,
+               const std::vector<std::string>& args);
 
   // Returns true if this instance owns given |file|. This will also attempt to
   // take ownership over |file|.
@@ -58,4 +82,5 @@ struct FileConsumer {
   std::unordered_map<CXFileUniqueID, std::unique_ptr<IndexFile>> local_;
   FileConsumerSharedState* shared_;
   AbsolutePath parse_file_;
+  std::vector<std::string> args_;
 };
\ No newline at end of file
@@ -3,7 +3,23 @@
 FileContents::FileContents() : line_offsets_{0} {}
 
 FileContents::FileContents(const AbsolutePath& path, const std::string& content)
-    : path(path), content(content) {
+    : path(path), owned_content_(std::make_shared<std::string>(content)) {
+  this->content = *owned_content_;
+  ComputeLineOffsets();
+}
+
+// static
+FileContents FileContents::View(const AbsolutePath& path,
+                                std::string_view content) {
+  FileContents result;
+  result.path = path;
+  result.content = content;
+  result.ComputeLineOffsets();
+  return result;
+}
+
+void FileContents::ComputeLineOffsets() {
+  line_offsets_.clear();
   line_offsets_.push_back(0);
   for (size_t i = 0; i < content.size(); i++) {
     if (content[i] == '\n')
@@ -24,6 +40,7 @@ optional<std::string> FileContents::ContentsInRange(Range range) const {
   optional<int> start_offset = ToOffset(range.start),
                 end_offset = ToOffset(range.end);
   if (start_offset && end_offset && *start_offset < *end_offset)
-    return content.substr(*start_offset, *end_offset - *start_offset);
+    return std::string(
+        content.substr(*start_offset, *end_offset - *start_offset));
   return nullopt;
 }
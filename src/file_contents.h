@@ -4,19 +4,35 @@
 
 #include "optional.h"
 
+#include <string_view.h>
+
+#include <memory>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
 struct FileContents {
   FileContents();
+  // Keeps a copy of |content|. Copies of this FileContents share it.
   FileContents(const AbsolutePath& path, const std::string& content);
 
+  // Refers to |content| without copying it. The buffer must outlive the
+  // returned value and its copies, e.g. libclang's file buffers for the
+  // lifetime of the translation unit.
+  static FileContents View(const AbsolutePath& path,
+                           std::string_view content);
+
   optional<int> ToOffset(Position p) const;
   optional<std::string> ContentsInRange(Range range) const;
 
   AbsolutePath path;
-  std::string content;
+  std::string_view content;
   // {0, 1 + position of first newline, 1 + position of second newline, ...}
   std::vector<int> line_offsets_;
+
+ private:
+  void ComputeLineOffsets();
+
+  // Backs |content| unless this is a view.
+  std::shared_ptr<const std::string> owned_content_;
 };
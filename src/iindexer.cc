@@ -10,9 +10,11 @@ struct ClangIndexer : IIndexer {
       FileConsumerSharedState* file_consumer_shared,
       std::string file,
       const std::vector<std::string>& args,
-      const std::vector<FileContents>& file_contents) override {
+      const std::vector<FileContents>& file_contents,
+      IndexFidelity fidelity,
+      ParseBudget* budget) override {
     return Parse(file_consumer_shared, file, args, file_contents, &index,
-                 false /*dump_ast*/);
+                 fidelity, budget, false /*dump_ast*/);
   }
 
   // Note: constructing this acquires a global lock
@@ -48,7 +50,9 @@ struct TestIndexer : IIndexer {
       FileConsumerSharedState* file_consumer_shared,
       std::string file,
       const std::vector<std::string>& args,
-      const std::vector<FileContents>& file_contents) override {
+      const std::vector<FileContents>& file_contents,
+      IndexFidelity fidelity,
+      ParseBudget* budget) override {
     auto it = indexes.find(file);
     if (it == indexes.end()) {
       // Don't return any indexes for unexpected data.
@@ -17,6 +17,29 @@ struct IndexFile;
 struct FileContents;
 struct FileConsumerSharedState;
 
+// How much of a translation unit the indexer extracts.
+enum class IndexFidelity {
+  // Everything.
+  Full,
+  // Declarations, definitions, references and the outline. Function-local
+  // symbols, implicit template instantiations, hover and comments are
+  // skipped. See Config::Index::reducedFirstPass.
+  Reduced
+};
+
+// Limits the time an indexer may spend indexing one translation unit once it
+// is parsed.
+struct ParseBudget {
+  // 0 means there is no limit.
+  int timeout_ms = 0;
+  // Set by the indexer if it gave up on the translation unit because it ran
+  // out of time. The index is then not returned.
+  bool timed_out = false;
+  // Set by the indexer to the time it spent indexing, ie, the time
+  // |timeout_ms| limits.
+  int64_t index_ms = 0;
+};
+
 // Abstracts away the actual indexing process. Each IIndexer instance is
 // per-thread and constructing an instance may be extremely expensive (ie,
 // acquire a lock) and should be done as rarely as possible.
@@ -29,6 +52,8 @@ struct IIndexer {
   };
 
   static std::unique_ptr<IIndexer> MakeClangIndexer();
+  // Indexes in a worker process, see indexer_worker.h.
+  static std::unique_ptr<IIndexer> MakeWorkerIndexer();
   static std::unique_ptr<IIndexer> MakeTestIndexer(
       std::initializer_list<TestEntry> entries);
 
@@ -37,5 +62,7 @@ struct IIndexer {
       FileConsumerSharedState* file_consumer_shared,
       std::string file,
       const std::vector<std::string>& args,
-      const std::vector<FileContents>& file_contents) = 0;
+      const std::vector<FileContents>& file_contents,
+      IndexFidelity fidelity,
+      ParseBudget* budget) = 0;
 };
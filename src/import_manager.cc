@@ -25,12 +25,5 @@ std::ostream& operator<<(std::ostream& os, const PipelineStatus& status) {
 }
 
 PipelineStatus ImportManager::GetStatus(const std::string& path) {
-  // Try reading the value
-  {
-    std::shared_lock<std::shared_timed_mutex> lock(status_mutex_);
-    auto it = status_.find(path);
-    if (it != status_.end())
-      return it->second;
-  }
-  return PipelineStatus::kNotSeen;
-}
\ No newline at end of file
+  return status_.TryGet(path).value_or(PipelineStatus::kNotSeen);
+}
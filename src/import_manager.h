@@ -1,7 +1,8 @@
 #pragma once
 
+#include "sharded_map.h"
+
 #include <iosfwd>
-#include <shared_mutex>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -29,40 +30,37 @@ struct ImportManager {
   // |status_map| is a function which receives the current status as input, and
   // returns a new status. If the new status is different, then this function
   // will return true, otherwise false.
-
   template <typename TFn>
-  bool SetStatusAtomicNoLock_(const std::string& path, TFn status_map) {
-    // Get the current pipeline status.
-    PipelineStatus current_status = PipelineStatus::kNotSeen;
-    {
-      auto it = status_.find(path);
-      if (it != status_.end())
-        current_status = it->second;
-    }
+  bool SetStatusAtomic(const std::string& path, TFn status_map) {
+    return status_.WithLock(
+        path, [&](std::unordered_map<std::string, PipelineStatus>& status) {
+          // Get the current pipeline status.
+          PipelineStatus current_status = PipelineStatus::kNotSeen;
+          {
+            auto it = status.find(path);
+            if (it != status.end())
+              current_status = it->second;
+          }
 
-    // Determine the new status based on the current status.
-    PipelineStatus new_status = status_map(current_status);
+          // Determine the new status based on the current status.
+          PipelineStatus new_status = status_map(current_status);
 
-    // Only set the status if it changed.
-    if (new_status == current_status)
-      return false;
-    status_[path] = new_status;
-    return true;
-  }
-  template <typename TFn>
-  bool SetStatusAtomic(const std::string& path, TFn status_map) {
-    std::unique_lock<std::shared_timed_mutex> lock(status_mutex_);
-    return SetStatusAtomicNoLock_(path, status_map);
+          // Only set the status if it changed.
+          if (new_status == current_status)
+            return false;
+          status[path] = new_status;
+          return true;
+        });
   }
+  // Each path is updated atomically, but the batch as a whole is not.
   template <typename TFn>
   void SetStatusAtomicBatch(const std::vector<std::string>& paths,
                             TFn status_map) {
-    std::unique_lock<std::shared_timed_mutex> lock(status_mutex_);
     for (auto& path : paths)
-      SetStatusAtomicNoLock_(path, status_map);
+      SetStatusAtomic(path, status_map);
   }
 
-  // TODO: use shared_mutex
-  std::shared_timed_mutex status_mutex_;
-  std::unordered_map<std::string, PipelineStatus> status_;
-};
\ No newline at end of file
+  // Sharded so that status checks of different files (eg, the many headers
+  // visited by dependency checks) do not serialize indexer threads.
+  ShardedMap<std::string, PipelineStatus> status_;
+};
@@ -1,25 +1,33 @@
 #include "import_pipeline.h"
 
 #include "cache_manager.h"
+#include "clang_complete.h"
 #include "config.h"
 #include "diagnostics_engine.h"
 #include "iindexer.h"
 #include "import_manager.h"
 #include "lsp.h"
 #include "message_handler.h"
+#include "metrics.h"
+#include "parse_quarantine.h"
 #include "platform.h"
 #include "project.h"
 #include "query_utils.h"
 #include "queue_manager.h"
 #include "timer.h"
 #include "timestamp_manager.h"
+#include "working_files.h"
 
 #include <doctest/doctest.h>
 #include <loguru.hpp>
 
+#include <algorithm>
 #include <atomic>
 #include <chrono>
+#include <iostream>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 namespace {
@@ -31,6 +39,8 @@ struct Out_Progress : public lsOutMessage<Out_Progress> {
     int onIdMappedCount = 0;
     int onIndexedCount = 0;
     int activeThreads = 0;
+    // Translation units which repeatedly ran out of time, see ParseQuarantine.
+    int quarantinedCount = 0;
   };
   std::string method = "$cquery/progress";
   Params params;
@@ -40,7 +50,8 @@ MAKE_REFLECT_STRUCT(Out_Progress::Params,
                     doIdMapCount,
                     onIdMappedCount,
                     onIndexedCount,
-                    activeThreads);
+                    activeThreads,
+                    quarantinedCount);
 MAKE_REFLECT_STRUCT(Out_Progress, jsonrpc, method, params);
 
 // Instead of processing messages forever, we only process upto
@@ -106,6 +117,7 @@ struct ActiveThread {
     out.params.onIndexedCount = queue->on_indexed_for_merge.Size() +
                                 queue->on_indexed_for_querydb.Size();
     out.params.activeThreads = status_->num_active_threads;
+    out.params.quarantinedCount = ParseQuarantine::instance()->Count();
 
     // Ignore this progress update if the last update was too recent.
     if (g_config->progressReportFrequencyMs != 0) {
@@ -127,6 +139,32 @@ struct ActiveThread {
   ImportPipelineStatus* status_;
 };
 
+// Returns true if |path| on disk has the contents its cache was built from.
+bool HasSameContents(ICacheManager* cache_manager, const AbsolutePath& path) {
+  IndexFile* file = cache_manager->TryLoad(path);
+  if (!file)
+    return false;
+  optional<std::string> content = ReadContent(path);
+  return content && HashUsr(*content) == file->content_hash;
+}
+
+// Returns true if |index|, a header built while indexing some translation
+// unit, is already in querydb as it is: the cached index has the same
+// fingerprints (IndexFile::content_hash and include_context_hash), arguments
+// and fidelity. Importing it again would only compute an empty delta.
+bool IsUnchangedImport(ImportManager* import_manager,
+                       ICacheManager* cache_manager,
+                       const IndexFile& index) {
+  if (import_manager->GetStatus(index.path) != PipelineStatus::kImported)
+    return false;
+  IndexFile* previous = cache_manager->TryLoad(index.path);
+  return previous && previous->content_hash == index.content_hash &&
+         previous->include_context_hash == index.include_context_hash &&
+         previous->fidelity == index.fidelity &&
+         (previous->args.SameFlags(index.args) ||
+          previous->args.Get() == index.args.Get());
+}
+
 // Checks if |path| needs to be reparsed. This will modify cached state
 // such that calling this function twice with the same path may return true
 // the first time but will return false the second.
@@ -139,7 +177,7 @@ ChangeResult ComputeChangeStatus(
     const std::shared_ptr<ICacheManager>& cache_manager,
     IndexFile* opt_previous_index,
     const AbsolutePath& path,
-    const std::vector<std::string>& args,
+    const InternedArgs& args,
     const optional<AbsolutePath>& from) {
   auto unwrap_opt = [](const optional<AbsolutePath>& opt) -> std::string {
     if (opt)
@@ -160,20 +198,31 @@ ChangeResult ComputeChangeStatus(
   // File has been changed.
   if (!last_cached_modification ||
       modification_timestamp != *last_cached_modification) {
-    LOG_S(INFO) << "Timestamp has changed for " << path << unwrap_opt(from);
-    return ChangeResult::kYes;
+    // Timestamps of a relocated cache come from another checkout, so only
+    // reindex if the contents are different.
+    if (last_cached_modification && g_config->relocatableCache &&
+        HasSameContents(cache_manager.get(), path)) {
+      timestamp_manager->UpdateCachedModificationTime(path,
+                                                      *modification_timestamp);
+    } else {
+      LOG_S(INFO) << "Timestamp has changed for " << path << unwrap_opt(from);
+      return ChangeResult::kYes;
+    }
   }
 
-  // Command-line arguments changed.
+  // Command-line arguments changed. Interned arguments share their flags when
+  // they only differ in the file, which makes the common case a pointer
+  // compare.
   auto is_file = [](const std::string& arg) {
     return EndsWithAny(arg, {".h", ".c", ".cc", ".cpp", ".hpp", ".m", ".mm"});
   };
-  if (opt_previous_index) {
-    auto& prev_args = opt_previous_index->args;
-    bool same = prev_args.size() == args.size();
-    for (size_t i = 0; i < args.size() && same; ++i) {
-      same = prev_args[i] == args[i] ||
-             (is_file(prev_args[i]) && is_file(args[i]));
+  if (opt_previous_index && !opt_previous_index->args.SameFlags(args)) {
+    std::vector<std::string> prev_args = opt_previous_index->args.Get();
+    std::vector<std::string> new_args = args.Get();
+    bool same = prev_args.size() == new_args.size();
+    for (size_t i = 0; i < new_args.size() && same; ++i) {
+      same = prev_args[i] == new_args[i] ||
+             (is_file(prev_args[i]) && is_file(new_args[i]));
     }
     if (!same) {
       LOG_S(INFO) << "Arguments have changed for " << path << unwrap_opt(from);
@@ -193,12 +242,18 @@ CacheLoadResult TryLoadFromCache(
     ImportManager* import_manager,
     const std::shared_ptr<ICacheManager>& cache_manager,
     bool is_interactive,
+    IndexFidelity fidelity,
     const Project::Entry& entry,
     const AbsolutePath& path_to_index) {
   IndexFile* previous_index = cache_manager->TryLoad(path_to_index);
   if (!previous_index)
     return CacheLoadResult::kParse;
 
+  // A reduced index is upgraded by parsing the file again. Headers which only
+  // have a reduced index are taken over, like headers which have changed.
+  bool upgrade = fidelity == IndexFidelity::Full &&
+                 previous_index->fidelity == IndexFidelity::Reduced;
+
   // If none of the dependencies have changed and the index is not
   // interactive (ie, requested by a file save), skip parsing and just load
   // from cache.
@@ -207,7 +262,7 @@ CacheLoadResult TryLoadFromCache(
   ChangeResult path_state = ComputeChangeStatus(
       timestamp_manager, modification_timestamp_fetcher, cache_manager,
       previous_index, path_to_index, entry.args, previous_index->path);
-  if (path_state == ChangeResult::kYes)
+  if (path_state == ChangeResult::kYes || upgrade)
     file_consumer_shared->Reset(path_to_index);
 
   // Target file does not exist on disk, do not emit any indexes.
@@ -217,7 +272,8 @@ CacheLoadResult TryLoadFromCache(
   if (path_state == ChangeResult::kDeleted)
     return CacheLoadResult::kDoNotParse;
 
-  bool needs_reparse = is_interactive || path_state == ChangeResult::kYes;
+  bool needs_reparse =
+      is_interactive || upgrade || path_state == ChangeResult::kYes;
 
   for (const AbsolutePath& dependency : previous_index->dependencies) {
     assert(!dependency.path.empty());
@@ -230,6 +286,11 @@ CacheLoadResult TryLoadFromCache(
       // Do not break here, as we need to update |file_consumer_shared| for
       // every dependency that needs to be reparsed.
       file_consumer_shared->Reset(dependency);
+    } else if (upgrade) {
+      IndexFile* dependency_index = cache_manager->TryLoad(dependency);
+      if (dependency_index &&
+          dependency_index->fidelity == IndexFidelity::Reduced)
+        file_consumer_shared->Reset(dependency);
     }
   }
 
@@ -291,8 +352,21 @@ CacheLoadResult TryLoadFromCache(
   return CacheLoadResult::kDoNotParse;
 }
 
-void ParseFile(DiagnosticsEngine* diag_engine,
+enum class ParseResult {
+  kIndexed,
+  kFailed,
+  // Some headers were skipped because they have a shared index, which could
+  // not be loaded after all. Parsing the file again indexes them.
+  kReparse,
+  // The file ran out of its parse budget. It is recorded in the
+  // ParseQuarantine, which lifts the limit for the rest of the session, and
+  // should be indexed again after the other files.
+  kTimedOut,
+};
+
+ParseResult ParseFile(DiagnosticsEngine* diag_engine,
                WorkingFiles* working_files,
+               ClangCompleteManager* clang_complete,
                FileConsumerSharedState* file_consumer_shared,
                TimestampManager* timestamp_manager,
                IModificationTimestampFetcher* modification_timestamp_fetcher,
@@ -311,22 +385,84 @@ void ParseFile(DiagnosticsEngine* diag_engine,
       path_to_index = entry_cache->import_file;
   }
 
+  // Once a reduced index is done, or if the cache only has a reduced index,
+  // the file is indexed again with full fidelity after everything else.
+  auto enqueue_upgrade = [&request]() {
+    Index_Request upgrade(request);
+    upgrade.fidelity = IndexFidelity::Full;
+    QueueManager::instance()->index_request.Enqueue(std::move(upgrade),
+                                                    false /*priority*/);
+  };
+  IndexFile* cached_index = request.cache_manager->TryLoad(path_to_index);
+  bool cached_index_is_reduced =
+      cached_index && cached_index->fidelity == IndexFidelity::Reduced;
+
   // Try to load the file from cache.
   if (TryLoadFromCache(file_consumer_shared, timestamp_manager,
                        modification_timestamp_fetcher, import_manager,
-                       request.cache_manager, request.is_interactive, entry,
+                       request.cache_manager, request.is_interactive,
+                       request.fidelity, entry,
                        path_to_index) == CacheLoadResult::kDoNotParse) {
-    return;
+    if (request.fidelity == IndexFidelity::Reduced && cached_index_is_reduced)
+      enqueue_upgrade();
+    return ParseResult::kIndexed;
   }
 
-  LOG_S(INFO) << "Parsing " << path_to_index;
+  LOG_S(INFO) << "Parsing " << path_to_index
+              << (request.fidelity == IndexFidelity::Reduced
+                      ? " with reduced fidelity"
+                      : "");
+  // Interactive requests index what the user sees, and the diagnostics of that
+  // parse are published in place of a separate diagnostics reparse (see
+  // ClangCompleteManager::NotifyIndexerDiagnostics). Edits made from now on
+  // are newer than this parse.
+  auto parsed_at = std::chrono::high_resolution_clock::now();
+  optional<std::string> contents = request.contents;
+  if (request.is_interactive && !contents) {
+    working_files->DoActionOnFile(request.path, [&](WorkingFile* working_file) {
+      if (working_file)
+        contents = working_file->buffer_content;
+    });
+  }
+  bool publish_diagnostics = !request.is_interactive ||
+                             (clang_complete && g_config->diagnostics.onType);
   std::vector<FileContents> file_contents;
-  if (request.contents)
-    file_contents.push_back(FileContents(request.path, *request.contents));
-  auto indexes = indexer->Index(file_consumer_shared, path_to_index, entry.args,
-                                file_contents);
+  if (contents)
+    file_contents.push_back(FileContents(request.path, *contents));
+  static LatencyHistogram* parse_time =
+      GetLatencyHistogram("indexer.parse_time");
+  static std::atomic<long long>* parse_failures =
+      GetCounter("indexer.parse_failures");
+  // The user is waiting for interactive requests, so they are not limited.
+  ParseQuarantine* quarantine = ParseQuarantine::instance();
+  ParseBudget budget;
+  if (!request.is_interactive)
+    budget.timeout_ms = quarantine->GetTimeoutMs(path_to_index.path);
+  Timer parse_timer;
+  auto indexes =
+      indexer->Index(file_consumer_shared, path_to_index, entry.args.Get(),
+                     file_contents, request.fidelity, &budget);
+  parse_time->Record(parse_timer.ElapsedMicroseconds());
+
+  if (budget.timed_out) {
+    LOG_S(WARNING) << "Indexing " << path_to_index << " took longer than "
+                   << budget.timeout_ms
+                   << "ms; it will be indexed again after the other files";
+    IncrementCounter("indexer.parse_timeouts");
+    quarantine->RecordTimeout(path_to_index.path);
+    return ParseResult::kTimedOut;
+  }
+  // A quarantined file which is now indexed within the limit is released
+  // again. The limit only covers indexing, see ParseBudget.
+  if (indexes && g_config->index.parseTimeoutMs > 0 &&
+      budget.index_ms < g_config->index.parseTimeoutMs)
+    quarantine->RecordSuccess(path_to_index.path);
 
   if (!indexes) {
+    ++*parse_failures;
+    // Nothing was published, so diagnostics have to come from a reparse.
+    if (request.is_interactive && publish_diagnostics)
+      clang_complete->DiagnosticsUpdate(request.path);
     if (g_config->index.enabled && request.id.has_value()) {
       Out_Error out;
       out.id = request.id;
@@ -334,13 +470,45 @@ void ParseFile(DiagnosticsEngine* diag_engine,
       out.error.message = "Failed to index " + path_to_index.path;
       QueueManager::WriteStdout(kMethodType_Unknown, out);
     }
-    return;
+    return ParseResult::kFailed;
   }
+  if (request.fidelity == IndexFidelity::Reduced)
+    enqueue_upgrade();
 
   std::vector<Index_DoIdMap> result;
+  static std::atomic<long long>* unchanged_headers =
+      GetCounter("indexer.unchanged_headers");
 
   // Add the set of indexes we want to actually import from the index operation.
   for (std::unique_ptr<IndexFile>& new_index : *indexes) {
+    // For interactive requests, only the file the user is editing gets the
+    // diagnostics of this parse. Other open files have their own.
+    if (publish_diagnostics &&
+        (!request.is_interactive || new_index->path == request.path)) {
+      diag_engine->Publish(working_files, new_index->path,
+                           new_index->diagnostics_);
+      if (request.is_interactive)
+        clang_complete->NotifyIndexerDiagnostics(request.path, parsed_at);
+    }
+
+    // Headers which this translation unit took over but which did not change
+    // are neither written nor diffed against querydb.
+    if (new_index->path != path_to_index &&
+        IsUnchangedImport(import_manager, request.cache_manager.get(),
+                          *new_index)) {
+      ++*unchanged_headers;
+      // A header which was touched but not edited is written with its new
+      // timestamp, or every later session would see it as changed and reparse
+      // the translation units which include it.
+      IndexFile* previous = request.cache_manager->TryLoad(new_index->path);
+      if (previous->last_modification_time !=
+          new_index->last_modification_time)
+        request.cache_manager->WriteToCache(*new_index);
+      timestamp_manager->UpdateCachedModificationTime(
+          new_index->path, new_index->last_modification_time);
+      continue;
+    }
+
     // Do not allow a file to be imported twice at the same time.
     // Set the new pipeline status. Only set it if it is not already in the
     // pipeline.
@@ -362,14 +530,6 @@ void ParseFile(DiagnosticsEngine* diag_engine,
       continue;
     }
 
-    // Only emit diagnostics for non-interactive sessions, which makes it easier
-    // to identify indexing problems. For interactive sessions, diagnostics are
-    // handled by code completion.
-    if (!request.is_interactive) {
-      diag_engine->Publish(working_files, new_index->path,
-                           new_index->diagnostics_);
-    }
-
     // When main thread does IdMap request it will request the previous index if
     // needed.
     LOG_S(INFO) << "Emitting index result for " << new_index->path;
@@ -378,6 +538,40 @@ void ParseFile(DiagnosticsEngine* diag_engine,
                                    true /*write_to_disk*/));
   }
 
+  // Headers served by the shared system header cache were skipped by the
+  // indexer, so import them from there instead. The first translation unit to
+  // reach a header imports it.
+  bool needs_reparse = false;
+  if (file_consumer_shared->use_shared_index && !indexes->empty()) {
+    std::vector<std::string> args = request.args.Get();
+    for (const AbsolutePath& dependency : (*indexes)[0]->dependencies) {
+      if (!file_consumer_shared->UseSharedIndex(dependency, args) ||
+          !file_consumer_shared->Mark(dependency))
+        continue;
+      std::unique_ptr<IndexFile> shared_index =
+          request.cache_manager->TryTakeOrLoad(dependency);
+      if (!shared_index) {
+        LOG_S(WARNING) << "Unable to load shared index for " << dependency
+                       << "; indexing it with " << request.path;
+        file_consumer_shared->OnSharedIndexLoadFailed(dependency);
+        file_consumer_shared->Reset(dependency);
+        needs_reparse = true;
+        continue;
+      }
+      bool did_set = import_manager->SetStatusAtomic(
+          dependency, [](PipelineStatus current_status) {
+            if (current_status == PipelineStatus::kNotSeen)
+              return PipelineStatus::kProcessingInitialImport;
+            return current_status;
+          });
+      if (did_set) {
+        result.push_back(Index_DoIdMap(
+            std::move(shared_index), request.cache_manager,
+            request.is_interactive, false /*write_to_disk*/));
+      }
+    }
+  }
+
   // Load previous index if the file has already been imported so we can do a
   // delta update.
   for (Index_DoIdMap& request : result) {
@@ -404,15 +598,19 @@ void ParseFile(DiagnosticsEngine* diag_engine,
       timestamp_manager->UpdateCachedModificationTime(
           request.current->path, request.current->last_modification_time);
     }
+    // Writing is part of parsing, not of waiting in do_id_map.
+    request.trace.Enqueue(request.current->path);
   }
 
   QueueManager::instance()->do_id_map.EnqueueAll(std::move(result),
                                                  request.is_interactive);
+  return needs_reparse ? ParseResult::kReparse : ParseResult::kIndexed;
 }
 
 bool IndexMain_DoParse(
     DiagnosticsEngine* diag_engine,
     WorkingFiles* working_files,
+    ClangCompleteManager* clang_complete,
     FileConsumerSharedState* file_consumer_shared,
     TimestampManager* timestamp_manager,
     IModificationTimestampFetcher* modification_timestamp_fetcher,
@@ -423,13 +621,20 @@ bool IndexMain_DoParse(
       queue->index_request.TryDequeue(true /*priority*/);
   if (!request)
     return false;
+  request->trace.Dequeue("index_request");
 
   Project::Entry entry;
   entry.filename = request->path;
   entry.args = request->args;
-  ParseFile(diag_engine, working_files, file_consumer_shared, timestamp_manager,
-            modification_timestamp_fetcher, import_manager, indexer,
-            request.value(), entry);
+  ParseResult result = ParseFile(
+      diag_engine, working_files, clang_complete, file_consumer_shared,
+      timestamp_manager, modification_timestamp_fetcher, import_manager,
+      indexer, request.value(), entry);
+  request->trace.EndStage("parse");
+  // A file which timed out goes to the back of the queue, behind the rest of
+  // the project.
+  if (result == ParseResult::kReparse || result == ParseResult::kTimedOut)
+    queue->index_request.Enqueue(Index_Request(*request), false /*priority*/);
   return true;
 }
 
@@ -445,6 +650,7 @@ bool IndexMain_DoCreateIndexUpdate(TimestampManager* timestamp_manager) {
       return did_work;
 
     did_work = true;
+    response->trace.Dequeue("on_id_mapped");
 
     IdMap* previous_id_map = nullptr;
     IndexFile* previous_index = nullptr;
@@ -460,7 +666,18 @@ bool IndexMain_DoCreateIndexUpdate(TimestampManager* timestamp_manager) {
     LOG_S(INFO) << "Built index update for " << response->current->file->path
                 << " (is_delta=" << !!response->previous << ")";
 
+    response->trace.EndStage("create_delta");
+
     Index_OnIndexed reply(std::move(update));
+    reply.traces.emplace_back();
+    reply.traces.back().Enqueue(response->current->file->path);
+    // Only a freshly indexed file has its docs in memory; a file loaded from
+    // the cache keeps them in its docs cache file.
+    if (response->write_to_disk) {
+      IndexFile* file = response->current->file.get();
+      reply.docs.push_back(
+          {file->path.path, file->content_hash, file->CollectDocs()});
+    }
     const int kMaxSizeForQuerydb = 1000;
     ThreadedQueue<Index_OnIndexed>& q =
         queue->on_indexed_for_querydb.Size() < kMaxSizeForQuerydb
@@ -491,6 +708,10 @@ bool IndexMergeIndexUpdates() {
       break;
     did_merge = true;
     root->update.Merge(std::move(to_join->update));
+    // Merging counts as waiting for querydb.
+    root->traces.insert(root->traces.end(), to_join->traces.begin(),
+                        to_join->traces.end());
+    AddRange(&root->docs, std::move(to_join->docs));
   }
 
   const int kMaxSizeForQuerydb = 10;
@@ -513,11 +734,13 @@ void Indexer_Main(DiagnosticsEngine* diag_engine,
                   ImportManager* import_manager,
                   ImportPipelineStatus* status,
                   Project* project,
-                  WorkingFiles* working_files) {
+                  WorkingFiles* working_files,
+                  ClangCompleteManager* clang_complete) {
   RealModificationTimestampFetcher modification_timestamp_fetcher;
   auto* queue = QueueManager::instance();
   // Build one index per-indexer, as building the index acquires a global lock.
-  auto indexer = IIndexer::MakeClangIndexer();
+  auto indexer = g_config->index.outOfProcess ? IIndexer::MakeWorkerIndexer()
+                                              : IIndexer::MakeClangIndexer();
 
   while (true) {
     bool did_work = false;
@@ -535,9 +758,10 @@ void Indexer_Main(DiagnosticsEngine* diag_engine,
       // work. Running both also lets the user query the partially constructed
       // index.
       did_work =
-          IndexMain_DoParse(diag_engine, working_files, file_consumer_shared,
-                            timestamp_manager, &modification_timestamp_fetcher,
-                            import_manager, indexer.get()) ||
+          IndexMain_DoParse(diag_engine, working_files, clang_complete,
+                            file_consumer_shared, timestamp_manager,
+                            &modification_timestamp_fetcher, import_manager,
+                            indexer.get()) ||
           did_work;
 
       did_work = IndexMain_DoCreateIndexUpdate(timestamp_manager) || did_work;
@@ -557,12 +781,137 @@ void Indexer_Main(DiagnosticsEngine* diag_engine,
   }
 }
 
+bool HasSharedSystemIndex(TimestampManager* timestamp_manager,
+                          const AbsolutePath& path,
+                          const std::vector<std::string>& args) {
+  if (g_config->systemCacheDirectory.empty() ||
+      StartsWith(path.path, g_config->projectRoot))
+    return false;
+  optional<int64_t> modification_time = GetLastModificationTime(path);
+  if (!modification_time)
+    return false;
+  // Every key has its own entry for |path|, so remember their timestamps
+  // separately from the one of the index this session built.
+  std::string timestamp_key =
+      ICacheManager::GetSystemCacheKey(args) + '|' + path.path;
+  optional<int64_t> cached_time =
+      timestamp_manager->timestamps_.TryGet(timestamp_key);
+  if (!cached_time) {
+    std::shared_ptr<ICacheManager> cache_manager = ICacheManager::Make(args);
+    IndexFile* file = cache_manager->TryLoad(path);
+    if (!file)
+      return false;
+    cached_time = file->last_modification_time;
+    timestamp_manager->UpdateCachedModificationTime(timestamp_key,
+                                                    *cached_time);
+  }
+  return cached_time == modification_time;
+}
+
+bool IndexProjectHeadless(Project* project, int num_threads) {
+  // There is no client to publish diagnostics to.
+  g_config->diagnostics.frequencyMs = -1;
+  DiagnosticsEngine diag_engine;
+  diag_engine.Init();
+  WorkingFiles working_files;
+  FileConsumerSharedState file_consumer_shared;
+  TimestampManager timestamp_manager;
+  ImportManager import_manager;
+  RealModificationTimestampFetcher modification_timestamp_fetcher;
+  auto* queue = QueueManager::instance();
+  file_consumer_shared.use_shared_index =
+      [&](const AbsolutePath& path, const std::vector<std::string>& args) {
+        return HasSharedSystemIndex(&timestamp_manager, path, args);
+      };
+
+  // Quarantined translation units are indexed after everything else, like in
+  // Project::Index.
+  std::vector<Project::Entry> entries;
+  project->ForAllFilteredFiles(
+      [&](int i, const Project::Entry& entry) { entries.push_back(entry); });
+  ParseQuarantine* quarantine = ParseQuarantine::instance();
+  std::stable_partition(entries.begin(), entries.end(),
+                        [&](const Project::Entry& entry) {
+                          return !quarantine->IsQuarantined(entry.filename);
+                        });
+
+  std::atomic<size_t> num_failed(0);
+  std::atomic<size_t> num_files(0);
+  // Indexes |work|. Entries which run out of their parse budget are added to
+  // |timed_out|.
+  auto index_entries = [&](const std::vector<Project::Entry>& work,
+                           std::vector<Project::Entry>* timed_out) {
+    std::atomic<size_t> next_entry(0);
+    std::mutex timed_out_mutex;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < num_threads; ++i) {
+      threads.emplace_back([&, i]() {
+        SetCurrentThreadName("indexer" + std::to_string(i));
+        auto indexer = g_config->index.outOfProcess
+                           ? IIndexer::MakeWorkerIndexer()
+                           : IIndexer::MakeClangIndexer();
+        size_t j;
+        while ((j = next_entry++) < work.size()) {
+          const Project::Entry& entry = work[j];
+          std::cerr << ("[" + std::to_string(j + 1) + "/" +
+                        std::to_string(work.size()) + "] " +
+                        entry.filename.path + "\n");
+          Index_Request request(entry.filename, entry.args,
+                                false /*is_interactive*/, nullopt,
+                                ICacheManager::Make(entry.args.Get()));
+          ParseResult result;
+          do {
+            result = ParseFile(
+                &diag_engine, &working_files, nullptr /*clang_complete*/,
+                &file_consumer_shared, &timestamp_manager,
+                &modification_timestamp_fetcher, &import_manager,
+                indexer.get(), request, entry);
+          } while (result == ParseResult::kReparse);
+          if (result == ParseResult::kTimedOut && timed_out) {
+            std::lock_guard<std::mutex> lock(timed_out_mutex);
+            timed_out->push_back(entry);
+          } else if (result != ParseResult::kIndexed) {
+            ++num_failed;
+          }
+
+          // Caches are written by ParseFile; drop the results that would
+          // otherwise go to querydb.
+          while (queue->do_id_map.TryDequeue(false /*priority*/))
+            ++num_files;
+        }
+      });
+    }
+    for (std::thread& thread : threads)
+      thread.join();
+  };
+
+  Timer timer;
+  std::vector<Project::Entry> timed_out;
+  index_entries(entries, &timed_out);
+  // Files which timed out are not limited anymore, see
+  // ParseQuarantine::GetTimeoutMs.
+  if (!timed_out.empty()) {
+    std::cerr << "Indexing " << timed_out.size()
+              << " files which timed out again\n";
+    index_entries(timed_out, nullptr);
+  }
+
+  double seconds = timer.ElapsedMicroseconds() / 1e6;
+  std::cout << "Indexed " << entries.size() << " entries (" << num_files
+            << " files, " << num_failed << " failed) with " << num_threads
+            << " threads in " << seconds << "s, "
+            << (seconds > 0 ? entries.size() / seconds : 0) << " entries/s"
+            << std::endl;
+  return num_failed == 0;
+}
+
 namespace {
 void QueryDb_DoIdMap(QueueManager* queue,
                      QueryDatabase* db,
                      ImportManager* import_manager,
                      Index_DoIdMap* request) {
   assert(request->current);
+  request->trace.Dequeue("do_id_map");
   Index_OnIdMapped response(request->cache_manager, request->is_interactive,
                             request->write_to_disk);
   auto make_map = [db](std::unique_ptr<IndexFile> file)
@@ -576,6 +925,8 @@ void QueryDb_DoIdMap(QueueManager* queue,
   };
   response.current = make_map(std::move(request->current));
   response.previous = make_map(std::move(request->previous));
+  request->trace.EndStage("id_map");
+  response.trace.Enqueue(response.current->file->path);
 
   queue->on_id_mapped.Enqueue(std::move(response),
                               response.is_interactive /*priority*/);
@@ -586,21 +937,31 @@ void QueryDb_OnIndexed(QueueManager* queue,
                        ImportManager* import_manager,
                        ImportPipelineStatus* status,
                        SemanticHighlightSymbolCache* semantic_cache,
+                       DocsCache* docs_cache,
                        WorkingFiles* working_files,
                        Index_OnIndexed* response) {
+  for (PipelineTrace& trace : response->traces)
+    trace.Dequeue("on_indexed");
+
+  static LatencyHistogram* apply_time =
+      GetLatencyHistogram("querydb.apply_time");
   Timer time;
   db->ApplyIndexUpdate(&response->update);
+  apply_time->Record(time.ElapsedMicroseconds());
   time.ResetAndPrint("Applying index update for " +
                      std::to_string(response->update.files_def_update.size()) +
                      " files");
 
+  for (IndexFileDocs& docs : response->docs)
+    docs_cache->Update(std::move(docs));
+
   // Update indexed content, inactive lines, and semantic highlighting.
   for (auto& updated_file : response->update.files_def_update) {
     WorkingFile* working_file =
         working_files->GetFileByFilename(updated_file.value.path);
     if (working_file) {
       // Update indexed content.
-      working_file->SetIndexContent(updated_file.file_content);
+      working_file->SetIndexLineHashes(updated_file.value.line_hashes);
 
       // Inactive lines.
       EmitInactiveLines(working_file, updated_file.value.inactive_regions);
@@ -623,6 +984,10 @@ void QueryDb_OnIndexed(QueueManager* queue,
                current_status == PipelineStatus::kProcessingUpdate);
         return PipelineStatus::kImported;
       });
+
+  // Updates are merged, so every file in this update shares the span.
+  for (PipelineTrace& trace : response->traces)
+    trace.EndStage("apply_update");
 }
 
 }  // namespace
@@ -631,6 +996,7 @@ bool QueryDb_ImportMain(QueryDatabase* db,
                         ImportManager* import_manager,
                         ImportPipelineStatus* status,
                         SemanticHighlightSymbolCache* semantic_cache,
+                        DocsCache* docs_cache,
                         WorkingFiles* working_files) {
   auto* queue = QueueManager::instance();
 
@@ -657,7 +1023,7 @@ bool QueryDb_ImportMain(QueryDatabase* db,
       break;
     did_work = true;
     QueryDb_OnIndexed(queue, db, import_manager, status, semantic_cache,
-                      working_files, &*response);
+                      docs_cache, working_files, &*response);
   }
 
   return did_work;
@@ -675,10 +1041,10 @@ TEST_SUITE("ImportPipeline") {
     }
 
     bool PumpOnce() {
-      return IndexMain_DoParse(&diag_engine, &working_files,
-                               &file_consumer_shared, &timestamp_manager,
-                               &modification_timestamp_fetcher, &import_manager,
-                               indexer.get());
+      return IndexMain_DoParse(
+          &diag_engine, &working_files, nullptr /*clang_complete*/,
+          &file_consumer_shared, &timestamp_manager,
+          &modification_timestamp_fetcher, &import_manager, indexer.get());
     }
 
     void MakeRequest(const std::string& path,
@@ -686,7 +1052,8 @@ TEST_SUITE("ImportPipeline") {
                      bool is_interactive = false,
                      const std::string& contents = "void foo();") {
       queue->index_request.Enqueue(
-          Index_Request(path, args, is_interactive, contents, cache_manager),
+          Index_Request(path, InternedArgs(args, path), is_interactive,
+                        contents, cache_manager),
           false /*priority*/);
     }
 
@@ -710,7 +1077,7 @@ TEST_SUITE("ImportPipeline") {
       if (!old_args.empty()) {
         opt_previous_index = std::make_unique<IndexFile>(
             AbsolutePath("---.cc", false /*validate*/));
-        opt_previous_index->args = old_args;
+        opt_previous_index->args = InternedArgs(old_args);
       }
       optional<AbsolutePath> from;
       if (is_dependency)
@@ -718,7 +1085,7 @@ TEST_SUITE("ImportPipeline") {
       return ComputeChangeStatus(
           &timestamp_manager, &modification_timestamp_fetcher, cache_manager,
           opt_previous_index.get(), AbsolutePath(file, false /*validate*/),
-          new_args, from);
+          InternedArgs(new_args), from);
     };
 
     // A file with no timestamp is not imported, since this implies the file no
@@ -783,6 +1150,34 @@ TEST_SUITE("ImportPipeline") {
     REQUIRE(file_consumer_shared.used_files.empty());
   }
 
+  TEST_CASE_FIXTURE(Fixture, "unchanged header is not imported again") {
+    indexer = IIndexer::MakeTestIndexer({IIndexer::TestEntry{"foo.cc", 3}});
+    IndexFile cached_header(AbsolutePath("foo.cc_extra_1.h"));
+    cache_manager = ICacheManager::MakeFake(
+        {{cached_header.path.path,
+          Serialize(SerializeFormat::Json, cached_header)}});
+    import_manager.SetStatusAtomic(cached_header.path, [](PipelineStatus) {
+      return PipelineStatus::kImported;
+    });
+
+    MakeRequest("foo.cc");
+    PumpOnce();
+    REQUIRE(queue->do_id_map.Size() == 2);
+    REQUIRE(import_manager.GetStatus(cached_header.path) ==
+            PipelineStatus::kImported);
+  }
+
+  TEST_CASE_FIXTURE(Fixture, "shared index is not used after failing to load") {
+    file_consumer_shared.use_shared_index =
+        [](const AbsolutePath& path, const std::vector<std::string>& args) {
+          return true;
+        };
+    AbsolutePath header("/usr/include/foo.h", false /*validate*/);
+    REQUIRE(file_consumer_shared.UseSharedIndex(header, {}));
+    file_consumer_shared.OnSharedIndexLoadFailed(header.path);
+    REQUIRE(!file_consumer_shared.UseSharedIndex(header, {}));
+  }
+
   TEST_CASE_FIXTURE(Fixture, "multiple index requests") {
     indexer = IIndexer::MakeTestIndexer(
         {IIndexer::TestEntry{"foo.cc", 100}, IIndexer::TestEntry{"bar.cc", 5}});
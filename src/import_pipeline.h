@@ -1,8 +1,13 @@
 #pragma once
 
 #include <atomic>
+#include <string>
+#include <vector>
 
+struct AbsolutePath;
+struct ClangCompleteManager;
 struct DiagnosticsEngine;
+struct DocsCache;
 struct FileConsumerSharedState;
 struct ImportManager;
 struct Project;
@@ -25,10 +30,26 @@ void Indexer_Main(DiagnosticsEngine* diag_engine,
                   ImportManager* import_manager,
                   ImportPipelineStatus* status,
                   Project* project,
-                  WorkingFiles* working_files);
+                  WorkingFiles* working_files,
+                  ClangCompleteManager* clang_complete);
+
+// Returns true if |path| is outside of the project and has an up-to-date index
+// in the shared system header cache (see Config::systemCacheDirectory) for
+// translation units compiled with |args|. Used for
+// FileConsumerSharedState::use_shared_index.
+bool HasSharedSystemIndex(TimestampManager* timestamp_manager,
+                          const AbsolutePath& path,
+                          const std::vector<std::string>& args);
+
+// Indexes every entry in |project| on |num_threads| threads and writes the
+// results to the cache without building a query database. Used by
+// --index-project to prebuild caches. Prints throughput statistics to stdout
+// and returns false if any entry failed to index.
+bool IndexProjectHeadless(Project* project, int num_threads);
 
 bool QueryDb_ImportMain(QueryDatabase* db,
                         ImportManager* import_manager,
                         ImportPipelineStatus* status,
                         SemanticHighlightSymbolCache* semantic_cache,
+                        DocsCache* docs_cache,
                         WorkingFiles* working_files);
@@ -1,11 +1,14 @@
 #pragma once
 
+#include "arena.h"
 #include "clang_cursor.h"
 #include "clang_index.h"
 #include "clang_translation_unit.h"
 #include "clang_utils.h"
 #include "file_consumer.h"
 #include "file_contents.h"
+#include "iindexer.h"
+#include "interned_args.h"
 #include "language.h"
 #include "lsp.h"
 #include "maybe.h"
@@ -13,6 +16,7 @@
 #include "project.h"
 #include "serializer.h"
 #include "symbol.h"
+#include "usr_map.h"
 #include "utils.h"
 
 #include <optional.h>
@@ -25,10 +29,13 @@
 #include <unordered_map>
 #include <vector>
 
+MAKE_REFLECT_TYPE_PROXY(IndexFidelity);
+
 struct IndexFile;
 struct IndexType;
 struct IndexFunc;
 struct IndexVar;
+struct PendingUses;
 struct QueryFile;
 
 using RawId = uint32_t;
@@ -134,13 +141,36 @@ struct IndexId {
 
 void Reflect(Reader& visitor, Reference& value);
 void Reflect(Writer& visitor, Reference& value);
+// Arrays of references are delta-encoded in MessagePack; see
+// |ReadPackedReference|.
+void Reflect(Reader& visitor, std::vector<IndexSymbolRef>& values);
+void Reflect(Writer& visitor, std::vector<IndexSymbolRef>& values);
+void Reflect(Reader& visitor, std::vector<IndexLexicalRef>& values);
+void Reflect(Writer& visitor, std::vector<IndexLexicalRef>& values);
+
+// Hover text and comments of an index symbol. These strings are large and only
+// needed when the user hovers over the symbol, so they are kept out of the
+// symbol definition. They are written to a separate cache file (see
+// ICacheManager::LoadDocs) and never copied into querydb; hover reads them
+// through DocsCache.
+struct IndexDocs {
+  std::string hover;
+  std::string comments;
+};
+MAKE_REFLECT_STRUCT(IndexDocs, hover, comments);
+
+// A single entry of the docs cache file.
+struct IndexSymbolDocs {
+  SymbolKind kind = SymbolKind::Invalid;
+  Usr usr = 0;
+  IndexDocs docs;
+};
+MAKE_REFLECT_STRUCT(IndexSymbolDocs, kind, usr, docs);
 
 template <typename Id>
 struct TypeDefDefinitionData {
   // General metadata.
   std::string detailed_name;
-  std::string hover;
-  std::string comments;
 
   // While a class/type can technically have a separate declaration/definition,
   // it doesn't really happen in practice. The declaration never contains
@@ -175,7 +205,7 @@ struct TypeDefDefinitionData {
     return detailed_name == o.detailed_name && spell == o.spell &&
            extent == o.extent && alias_of == o.alias_of && bases == o.bases &&
            types == o.types && funcs == o.funcs && vars == o.vars &&
-           kind == o.kind && hover == o.hover && comments == o.comments;
+           kind == o.kind;
   }
   bool operator!=(const TypeDefDefinitionData& o) const {
     return !(*this == o);
@@ -195,8 +225,6 @@ void Reflect(TVisitor& visitor, TypeDefDefinitionData<Family>& value) {
   REFLECT_MEMBER(short_name_offset);
   REFLECT_MEMBER(short_name_size);
   REFLECT_MEMBER(kind);
-  REFLECT_MEMBER(hover);
-  REFLECT_MEMBER(comments);
   REFLECT_MEMBER(spell);
   REFLECT_MEMBER(extent);
   REFLECT_MEMBER(file);
@@ -215,6 +243,7 @@ struct IndexType {
   IndexId::Type id;
 
   Def def;
+  IndexDocs docs;
   std::vector<IndexId::LexicalRef> declarations;
 
   // Immediate derived types.
@@ -238,8 +267,6 @@ template <typename Id>
 struct FuncDefDefinitionData {
   // General metadata.
   std::string detailed_name;
-  std::string hover;
-  std::string comments;
   Maybe<typename Id::LexicalRef> spell;
   Maybe<typename Id::LexicalRef> extent;
 
@@ -264,8 +291,7 @@ struct FuncDefDefinitionData {
     return detailed_name == o.detailed_name && spell == o.spell &&
            extent == o.extent && declaring_type == o.declaring_type &&
            bases == o.bases && vars == o.vars && callees == o.callees &&
-           kind == o.kind && storage == o.storage && hover == o.hover &&
-           comments == o.comments;
+           kind == o.kind && storage == o.storage;
   }
   bool operator!=(const FuncDefDefinitionData& o) const {
     return !(*this == o);
@@ -291,8 +317,6 @@ void Reflect(TVisitor& visitor, FuncDefDefinitionData<Family>& value) {
   REFLECT_MEMBER(short_name_size);
   REFLECT_MEMBER(kind);
   REFLECT_MEMBER(storage);
-  REFLECT_MEMBER(hover);
-  REFLECT_MEMBER(comments);
   REFLECT_MEMBER(spell);
   REFLECT_MEMBER(extent);
   REFLECT_MEMBER(file);
@@ -310,6 +334,7 @@ struct IndexFunc {
   IndexId::Func id;
 
   Def def;
+  IndexDocs docs;
 
   struct Declaration {
     // Range of only the function name.
@@ -343,8 +368,6 @@ template <typename Id>
 struct VarDefDefinitionData {
   // General metadata.
   std::string detailed_name;
-  std::string hover;
-  std::string comments;
   // TODO: definitions should be a list of ranges, since there can be more
   //       than one - when??
   Maybe<typename Id::LexicalRef> spell;
@@ -368,7 +391,7 @@ struct VarDefDefinitionData {
   bool operator==(const VarDefDefinitionData& o) const {
     return detailed_name == o.detailed_name && spell == o.spell &&
            extent == o.extent && type == o.type && kind == o.kind &&
-           storage == o.storage && hover == o.hover && comments == o.comments;
+           storage == o.storage;
   }
   bool operator!=(const VarDefDefinitionData& o) const { return !(*this == o); }
 
@@ -400,8 +423,6 @@ void Reflect(TVisitor& visitor, VarDefDefinitionData<Family>& value) {
   REFLECT_MEMBER(detailed_name);
   REFLECT_MEMBER(short_name_size);
   REFLECT_MEMBER(short_name_offset);
-  REFLECT_MEMBER(hover);
-  REFLECT_MEMBER(comments);
   REFLECT_MEMBER(spell);
   REFLECT_MEMBER(extent);
   REFLECT_MEMBER(file);
@@ -418,6 +439,7 @@ struct IndexVar {
   IndexId::Var id;
 
   Def def;
+  IndexDocs docs;
 
   std::vector<IndexId::LexicalRef> declarations;
   std::vector<IndexId::LexicalRef> uses;
@@ -429,14 +451,16 @@ struct IndexVar {
 };
 MAKE_HASHABLE(IndexVar, t.id);
 
+// Consulted for every declaration and reference while indexing. Ids are dense,
+// so id -> usr is a vector indexed by id.
 struct IdCache {
   AbsolutePath primary_file;
-  std::unordered_map<Usr, IndexId::Type> usr_to_type_id;
-  std::unordered_map<Usr, IndexId::Func> usr_to_func_id;
-  std::unordered_map<Usr, IndexId::Var> usr_to_var_id;
-  std::unordered_map<IndexId::Type, Usr> type_id_to_usr;
-  std::unordered_map<IndexId::Func, Usr> func_id_to_usr;
-  std::unordered_map<IndexId::Var, Usr> var_id_to_usr;
+  UsrMap<IndexId::Type> usr_to_type_id;
+  UsrMap<IndexId::Func> usr_to_func_id;
+  UsrMap<IndexId::Var> usr_to_var_id;
+  std::vector<Usr> type_id_to_usr;
+  std::vector<Usr> func_id_to_usr;
+  std::vector<Usr> var_id_to_usr;
 
   IdCache(const AbsolutePath& primary_file);
 };
@@ -461,9 +485,28 @@ struct IndexFile {
   static const int kMinorVersion;
 
   AbsolutePath path;
-  std::vector<std::string> args;
+  InternedArgs args;
   int64_t last_modification_time = 0;
+  // HashUsr of the file contents at the time of index. With
+  // Config::relocatableCache, a file whose timestamp changed but whose
+  // contents did not is not reindexed.
+  uint64_t content_hash = 0;
+  // Fingerprint of what the file was preprocessed with: the text before the
+  // #include directives which led to it, which decides the macros it sees,
+  // and the contents of the files it includes. A header with the same
+  // |content_hash|, |include_context_hash| and |args| is not imported again
+  // when a translation unit which includes it is reparsed.
+  uint64_t include_context_hash = 0;
   LanguageId language = LanguageId::Unknown;
+  // Cost of the translation unit which produced this file: wall time of the
+  // parse and index, and the memory libclang holds for the translation unit
+  // once it is indexed. The latter is not the peak memory use of the process.
+  // Only set for the primary file.
+  int64_t parse_time_ms = 0;
+  int64_t tu_memory_mb = 0;
+  // A reduced index is replaced by a full one in the background, see
+  // Config::Index::reducedFirstPass.
+  IndexFidelity fidelity = IndexFidelity::Full;
 
   // The path to the translation unit cc file which caused the creation of this
   // IndexFile. When parsing a translation unit we generate many IndexFile
@@ -482,8 +525,14 @@ struct IndexFile {
 
   // Diagnostics found when indexing this file. Not serialized.
   std::vector<lsDiagnostic> diagnostics_;
-  // File contents at the time of index. Not serialized.
-  std::string file_contents;
+  // Uses of the symbols in this file found while it is being indexed; they are
+  // moved into |types|, |funcs| and |vars| before the file leaves the indexer.
+  // Not serialized, and null outside of indexing.
+  PendingUses* pending_uses_ = nullptr;
+  // Hashes of the lines of the file at the time of index (see ToLineHashes).
+  // The source itself is not kept; WorkingFile only needs these to map index
+  // positions into an edited buffer.
+  std::vector<uint64_t> line_hashes;
 
   IndexFile(const AbsolutePath& path);
 
@@ -497,11 +546,19 @@ struct IndexFile {
   IndexFunc* Resolve(IndexId::Func id);
   IndexVar* Resolve(IndexId::Var id);
 
+  // Returns hover and comments for every symbol in this file, in the form
+  // they are stored in the docs cache file.
+  std::vector<IndexSymbolDocs> CollectDocs();
+
   std::string ToString();
 };
 
 struct NamespaceHelper {
-  std::unordered_map<ClangCursor, std::string>
+  explicit NamespaceHelper(Arena* arena)
+      : container_cursor_to_qualified_name(
+            ArenaAllocator<ClangCursor>(arena)) {}
+
+  ArenaUnorderedMap<ClangCursor, std::string>
       container_cursor_to_qualified_name;
 
   std::string QualifiedName(const CXIdxContainerInfo* container,
@@ -512,12 +569,17 @@ struct NamespaceHelper {
 // |desired_index_file| is the (h or cc) file which has actually changed.
 // |dependencies| are the existing dependencies of |import_file| if this is a
 // reparse.
+// If |budget| is given, indexing is aborted once it has taken longer than
+// |budget->timeout_ms|. Parsing is not limited, so a parsed translation unit
+// is never thrown away only because parsing it was slow.
 optional<std::vector<std::unique_ptr<IndexFile>>> Parse(
     FileConsumerSharedState* file_consumer_shared,
     const std::string& file,
     const std::vector<std::string>& args,
     const std::vector<FileContents>& file_contents,
     ClangIndex* index,
+    IndexFidelity fidelity = IndexFidelity::Full,
+    ParseBudget* budget = nullptr,
     bool dump_ast = false);
 
 void ConcatTypeAndName(std::string& type, const std::string& name);
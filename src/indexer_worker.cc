@@ -0,0 +1,407 @@
+#include "indexer_worker.h"
+
+#include "clang_index.h"
+#include "config.h"
+#include "iindexer.h"
+#include "indexer.h"
+#include "metrics.h"
+#include "platform.h"
+#include "serializers/json.h"
+#include "utils.h"
+
+#include <doctest/doctest.h>
+#include <rapidjson/writer.h>
+#include <loguru.hpp>
+
+#include <stdio.h>
+#include <cstring>
+#include <unordered_set>
+
+namespace {
+
+// The worker first receives the server's Config and answers with
+// kReadyMessage. Then, for every IndexerWorkerRequest it answers with an
+// IndexerWorkerReply and two frames per file: its index and its docs, both
+// MessagePack.
+//
+// While indexing, the worker sends kClaimMessage followed by a path for every
+// file it encounters, and the server answers with kClaimed or kNotClaimed
+// (see FileConsumerSharedState::claim). Files owned by another translation
+// unit are then neither indexed nor sent.
+const char kReadyMessage[] = "ready";
+const char kClaimMessage[] = "claim ";
+const char kClaimed[] = "1";
+const char kNotClaimed[] = "0";
+
+struct IndexerWorkerRequest {
+  struct UnsavedFile {
+    std::string path;
+    std::string content;
+  };
+  std::string path;
+  std::vector<std::string> args;
+  std::vector<UnsavedFile> unsaved_files;
+  IndexFidelity fidelity = IndexFidelity::Full;
+  // ParseBudget::timeout_ms.
+  int timeout_ms = 0;
+};
+MAKE_REFLECT_STRUCT(IndexerWorkerRequest::UnsavedFile, path, content);
+MAKE_REFLECT_STRUCT(IndexerWorkerRequest,
+                    path,
+                    args,
+                    unsaved_files,
+                    fidelity,
+                    timeout_ms);
+
+struct IndexerWorkerReply {
+  struct File {
+    std::string path;
+    // IndexFile::diagnostics_ is not serialized with the index.
+    std::vector<lsDiagnostic> diagnostics;
+  };
+  bool ok = false;
+  bool timed_out = false;
+  int64_t index_ms = 0;
+  // Memory used by the worker after indexing the translation unit.
+  int memory_mb = 0;
+  std::vector<File> files;
+};
+MAKE_REFLECT_STRUCT(IndexerWorkerReply::File, path, diagnostics);
+MAKE_REFLECT_STRUCT(IndexerWorkerReply,
+                    ok,
+                    timed_out,
+                    index_ms,
+                    memory_mb,
+                    files);
+
+template <typename T>
+std::string ToJson(T& value) {
+  rapidjson::StringBuffer output;
+  rapidjson::Writer<rapidjson::StringBuffer> writer(output);
+  JsonWriter json_writer(&writer);
+  Reflect(json_writer, value);
+  return std::string(output.GetString(), output.GetSize());
+}
+
+template <typename T>
+bool FromJson(const std::string& json, T* value) {
+  rapidjson::Document document;
+  document.Parse(json.c_str(), json.size());
+  if (document.HasParseError())
+    return false;
+  JsonReader json_reader{&document};
+  try {
+    Reflect(json_reader, *value);
+  } catch (std::invalid_argument&) {
+    return false;
+  }
+  return true;
+}
+
+// A frame is the payload size as 8 little endian bytes, then the payload.
+// |write| is a bool(std::string_view) and |read| a bool(char*, size_t).
+template <typename TWrite>
+bool WriteFrame(TWrite&& write, std::string_view payload) {
+  char header[8];
+  uint64_t size = payload.size();
+  for (int i = 0; i < 8; ++i)
+    header[i] = char(size >> (8 * i));
+  return write(std::string_view(header, sizeof(header))) && write(payload);
+}
+
+template <typename TRead>
+optional<std::string> ReadFrame(TRead&& read) {
+  unsigned char header[8];
+  if (!read(reinterpret_cast<char*>(header), sizeof(header)))
+    return nullopt;
+  uint64_t size = 0;
+  for (int i = 0; i < 8; ++i)
+    size |= uint64_t(header[i]) << (8 * i);
+  std::string payload(size, '\0');
+  if (size && !read(&payload[0], size))
+    return nullopt;
+  return payload;
+}
+
+// Docs are serialized separately from the IndexFile, see
+// IndexFile::CollectDocs.
+void ApplyDocs(IndexFile* file, std::vector<IndexSymbolDocs>& docs) {
+  IdCache& id_cache = file->id_cache;
+  for (IndexSymbolDocs& entry : docs) {
+    switch (entry.kind) {
+      case SymbolKind::Type:
+        if (const IndexId::Type* id = id_cache.usr_to_type_id.Find(entry.usr))
+          file->Resolve(*id)->docs = std::move(entry.docs);
+        break;
+      case SymbolKind::Func:
+        if (const IndexId::Func* id = id_cache.usr_to_func_id.Find(entry.usr))
+          file->Resolve(*id)->docs = std::move(entry.docs);
+        break;
+      case SymbolKind::Var:
+        if (const IndexId::Var* id = id_cache.usr_to_var_id.Find(entry.usr))
+          file->Resolve(*id)->docs = std::move(entry.docs);
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+// Sends translation units to a worker process. The worker asks which files of
+// the translation unit it owns, which FileConsumerSharedState decides here
+// exactly like FileConsumer does in-process.
+struct WorkerIndexer : IIndexer {
+  ~WorkerIndexer() override = default;
+
+  optional<std::vector<std::unique_ptr<IndexFile>>> Index(
+      FileConsumerSharedState* file_consumer_shared,
+      std::string file,
+      const std::vector<std::string>& args,
+      const std::vector<FileContents>& file_contents,
+      IndexFidelity fidelity,
+      ParseBudget* budget) override {
+    if (!worker_ && !StartWorker()) {
+      if (!in_process_)
+        in_process_ = IIndexer::MakeClangIndexer();
+      return in_process_->Index(file_consumer_shared, file, args,
+                                file_contents, fidelity, budget);
+    }
+
+    IndexerWorkerRequest request;
+    request.path = file;
+    request.args = args;
+    request.fidelity = fidelity;
+    for (const FileContents& contents : file_contents) {
+      request.unsaved_files.push_back(
+          {contents.path.path, std::string(contents.content)});
+    }
+    if (budget)
+      request.timeout_ms = budget->timeout_ms;
+
+    IndexerWorkerReply reply;
+    std::vector<std::string> payloads;
+    // Files claimed for the worker which it did not return are released
+    // again, so another translation unit can index them.
+    std::unordered_set<std::string> claimed;
+    auto release_claimed = [&]() {
+      for (const std::string& path : claimed)
+        file_consumer_shared->Reset(path);
+    };
+    if (!Exchange(file_consumer_shared, request, &reply, &payloads,
+                  &claimed)) {
+      LOG_S(ERROR) << "Indexer worker exited while indexing " << file
+                   << "; starting a new one";
+      IncrementCounter("indexer.worker_crashes");
+      worker_.reset();
+      release_claimed();
+      return nullopt;
+    }
+    if (g_config->index.workerMemoryLimitMb > 0 &&
+        reply.memory_mb > g_config->index.workerMemoryLimitMb) {
+      LOG_S(INFO) << "Restarting indexer worker which uses "
+                  << reply.memory_mb << "MB";
+      IncrementCounter("indexer.worker_restarts");
+      worker_.reset();
+    }
+    if (budget) {
+      budget->timed_out = reply.timed_out;
+      budget->index_ms = reply.index_ms;
+    }
+    if (!reply.ok) {
+      release_claimed();
+      return nullopt;
+    }
+
+    std::vector<std::unique_ptr<IndexFile>> result;
+    for (size_t i = 0; i < reply.files.size(); ++i) {
+      AbsolutePath path = AbsolutePath::BuildDoNotUse(reply.files[i].path);
+      // The worker only indexes files it claimed.
+      if (!claimed.count(path.path))
+        continue;
+
+      std::unique_ptr<IndexFile> index =
+          Deserialize(SerializeFormat::MessagePack, path, payloads[2 * i],
+                      nullopt /*expected_version*/);
+      if (!index) {
+        LOG_S(ERROR) << "Cannot read the index of " << path
+                     << " from the indexer worker";
+        continue;
+      }
+      claimed.erase(path.path);
+      index->diagnostics_ = std::move(reply.files[i].diagnostics);
+      optional<std::vector<IndexSymbolDocs>> docs =
+          DeserializeDocs(SerializeFormat::MessagePack, payloads[2 * i + 1]);
+      if (docs)
+        ApplyDocs(index.get(), *docs);
+      result.push_back(std::move(index));
+    }
+    release_claimed();
+    return result;
+  }
+
+ private:
+  bool Write(std::string_view data) { return worker_->Write(data); }
+  bool Read(char* buffer, size_t size) { return worker_->Read(buffer, size); }
+
+  bool StartWorker() {
+    if (cannot_start_)
+      return false;
+    worker_ = StartChildProcess({GetExecutablePath().path, "--indexer-worker"});
+    auto write = [this](std::string_view data) { return Write(data); };
+    auto read = [this](char* buffer, size_t size) {
+      return Read(buffer, size);
+    };
+    optional<std::string> ready;
+    if (worker_ && WriteFrame(write, ToJson(*g_config)))
+      ready = ReadFrame(read);
+    if (!ready || *ready != kReadyMessage) {
+      LOG_S(WARNING) << "Cannot start indexer worker processes; indexing "
+                        "in-process instead";
+      worker_.reset();
+      cannot_start_ = true;
+      return false;
+    }
+    return true;
+  }
+
+  // Sends |request| and answers the worker's claims until it replies. Paths
+  // claimed for the worker are added to |claimed|.
+  bool Exchange(FileConsumerSharedState* file_consumer_shared,
+                IndexerWorkerRequest& request,
+                IndexerWorkerReply* reply,
+                std::vector<std::string>* payloads,
+                std::unordered_set<std::string>* claimed) {
+    auto write = [this](std::string_view data) { return Write(data); };
+    auto read = [this](char* buffer, size_t size) {
+      return Read(buffer, size);
+    };
+    if (!WriteFrame(write, ToJson(request)))
+      return false;
+    optional<std::string> reply_json;
+    while ((reply_json = ReadFrame(read)) &&
+           StartsWith(*reply_json, kClaimMessage)) {
+      std::string path = reply_json->substr(strlen(kClaimMessage));
+      bool did_claim = !file_consumer_shared->UseSharedIndex(
+                           AbsolutePath::BuildDoNotUse(path), request.args) &&
+                       file_consumer_shared->Mark(path);
+      if (did_claim)
+        claimed->insert(path);
+      if (!WriteFrame(write, did_claim ? kClaimed : kNotClaimed))
+        return false;
+    }
+    if (!reply_json || !FromJson(*reply_json, reply))
+      return false;
+    for (size_t i = 0; i < 2 * reply->files.size(); ++i) {
+      optional<std::string> payload = ReadFrame(read);
+      if (!payload)
+        return false;
+      payloads->push_back(std::move(*payload));
+    }
+    return true;
+  }
+
+  std::unique_ptr<PlatformChildProcess> worker_;
+  // Used when worker processes are not supported.
+  std::unique_ptr<IIndexer> in_process_;
+  bool cannot_start_ = false;
+};
+
+}  // namespace
+
+// static
+std::unique_ptr<IIndexer> IIndexer::MakeWorkerIndexer() {
+  return std::make_unique<WorkerIndexer>();
+}
+
+int RunIndexerWorker() {
+  auto write = [](std::string_view data) {
+    return fwrite(data.data(), 1, data.size(), stdout) == data.size();
+  };
+  auto read = [](char* buffer, size_t size) {
+    return fread(buffer, 1, size, stdin) == size;
+  };
+
+  optional<std::string> config = ReadFrame(read);
+  if (!config || !FromJson(*config, g_config)) {
+    LOG_S(ERROR) << "Indexer worker did not receive a configuration";
+    return 1;
+  }
+  ClangIndex index;
+  if (!WriteFrame(write, kReadyMessage) || fflush(stdout) != 0)
+    return 1;
+
+  while (optional<std::string> frame = ReadFrame(read)) {
+    IndexerWorkerRequest request;
+    if (!FromJson(*frame, &request)) {
+      LOG_S(ERROR) << "Indexer worker received a malformed request";
+      return 1;
+    }
+
+    std::vector<FileContents> file_contents;
+    for (const IndexerWorkerRequest::UnsavedFile& unsaved :
+         request.unsaved_files) {
+      file_contents.push_back(FileContents(
+          AbsolutePath::BuildDoNotUse(unsaved.path), unsaved.content));
+    }
+    // The server decides which files this translation unit owns.
+    FileConsumerSharedState file_consumer_shared;
+    file_consumer_shared.claim = [&](const std::string& path) {
+      optional<std::string> answer;
+      if (WriteFrame(write, kClaimMessage + path) && fflush(stdout) == 0)
+        answer = ReadFrame(read);
+      return answer && *answer == kClaimed;
+    };
+    ParseBudget budget;
+    budget.timeout_ms = request.timeout_ms;
+    optional<std::vector<std::unique_ptr<IndexFile>>> indexes =
+        Parse(&file_consumer_shared, request.path, request.args,
+              file_contents, &index, request.fidelity, &budget);
+
+    IndexerWorkerReply reply;
+    reply.ok = bool(indexes);
+    reply.timed_out = budget.timed_out;
+    reply.index_ms = budget.index_ms;
+    reply.memory_mb = (int)GetProcessMemoryUsedInMb();
+    std::vector<std::string> payloads;
+    if (indexes) {
+      for (std::unique_ptr<IndexFile>& file : *indexes) {
+        reply.files.push_back({file->path.path, file->diagnostics_});
+        payloads.push_back(Serialize(SerializeFormat::MessagePack, *file));
+        std::vector<IndexSymbolDocs> docs = file->CollectDocs();
+        payloads.push_back(SerializeDocs(SerializeFormat::MessagePack, docs));
+      }
+    }
+
+    bool ok = WriteFrame(write, ToJson(reply));
+    for (const std::string& payload : payloads)
+      ok = ok && WriteFrame(write, payload);
+    if (!ok || fflush(stdout) != 0)
+      return 1;
+  }
+  return 0;
+}
+
+TEST_SUITE("IndexerWorker") {
+  TEST_CASE("frames") {
+    std::string stream;
+    auto write = [&](std::string_view data) {
+      stream.append(data.data(), data.size());
+      return true;
+    };
+    REQUIRE(WriteFrame(write, ""));
+    REQUIRE(WriteFrame(write, std::string("a\0b", 3)));
+    REQUIRE(stream.size() == 8 + 8 + 3);
+
+    size_t offset = 0;
+    auto read = [&](char* buffer, size_t size) {
+      if (stream.size() - offset < size)
+        return false;
+      memcpy(buffer, stream.data() + offset, size);
+      offset += size;
+      return true;
+    };
+    REQUIRE(ReadFrame(read) == std::string());
+    REQUIRE(ReadFrame(read) == std::string("a\0b", 3));
+    REQUIRE(!ReadFrame(read));
+  }
+}
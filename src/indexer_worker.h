@@ -0,0 +1,9 @@
+#pragma once
+
+// Out-of-process indexing, see Config::Index::outOfProcess. Every indexer
+// thread of the language server starts a worker by running cquery with
+// --indexer-worker (see IIndexer::MakeWorkerIndexer), sends it translation
+// units over its stdin and reads the serialized indexes back from its stdout.
+
+// Runs the worker side until stdin is closed. Returns the exit code.
+int RunIndexerWorker();
@@ -0,0 +1,117 @@
+#include "interned_args.h"
+
+#include "serializer.h"
+#include "utils.h"
+
+#include <doctest/doctest.h>
+
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+
+namespace {
+
+std::mutex g_interned_mutex;
+// HashUsr of the flags to every interned copy with that hash. Copies are
+// dropped once no InternedArgs uses them.
+std::unordered_map<uint64_t, std::vector<std::weak_ptr<const void>>>
+    g_interned;
+// Expired copies are pruned when |g_interned| grows to this size.
+size_t g_prune_at = 1024;
+
+}  // namespace
+
+InternedArgs::InternedArgs(const std::vector<std::string>& args,
+                           const std::string& file)
+    : file_(file) {
+  if (args.empty())
+    return;
+  Flags flags;
+  flags.args = args;
+  if (!file.empty()) {
+    for (size_t i = 0; i < flags.args.size(); ++i) {
+      if (flags.args[i] == file) {
+        flags.args[i].clear();
+        flags.file_positions.push_back(i);
+      }
+    }
+  }
+  flags_ = Intern(std::move(flags));
+}
+
+std::vector<std::string> InternedArgs::Get() const {
+  if (!flags_)
+    return {};
+  std::vector<std::string> result = flags_->args;
+  for (size_t i : flags_->file_positions)
+    result[i] = file_;
+  return result;
+}
+
+size_t InternedArgs::size() const {
+  return flags_ ? flags_->args.size() : 0;
+}
+
+// static
+std::shared_ptr<const InternedArgs::Flags> InternedArgs::Intern(Flags flags) {
+  std::string key;
+  for (const std::string& arg : flags.args) {
+    key += arg;
+    key += '\0';
+  }
+  for (size_t i : flags.file_positions)
+    key += std::to_string(i) + ',';
+  uint64_t hash = HashUsr(key);
+
+  std::lock_guard<std::mutex> lock(g_interned_mutex);
+  if (g_interned.size() >= g_prune_at) {
+    for (auto it = g_interned.begin(); it != g_interned.end();) {
+      auto& copies = it->second;
+      copies.erase(std::remove_if(copies.begin(), copies.end(),
+                                  [](const std::weak_ptr<const void>& copy) {
+                                    return copy.expired();
+                                  }),
+                   copies.end());
+      if (copies.empty())
+        it = g_interned.erase(it);
+      else
+        ++it;
+    }
+    g_prune_at = std::max<size_t>(1024, g_interned.size() * 2);
+  }
+
+  std::vector<std::weak_ptr<const void>>& copies = g_interned[hash];
+  for (const std::weak_ptr<const void>& copy : copies) {
+    auto existing = std::static_pointer_cast<const Flags>(copy.lock());
+    if (existing && existing->args == flags.args &&
+        existing->file_positions == flags.file_positions)
+      return existing;
+  }
+  auto result = std::make_shared<const Flags>(std::move(flags));
+  copies.push_back(result);
+  return result;
+}
+
+void Reflect(Reader& visitor, InternedArgs& value) {
+  std::vector<std::string> args;
+  Reflect(visitor, args);
+  value = InternedArgs(args);
+}
+
+void Reflect(Writer& visitor, InternedArgs& value) {
+  std::vector<std::string> args = value.Get();
+  Reflect(visitor, args);
+}
+
+TEST_SUITE("InternedArgs") {
+  TEST_CASE("files with the same flags share them") {
+    InternedArgs a({"clang", "-DA", "/a.cc"}, "/a.cc");
+    InternedArgs b({"clang", "-DA", "/b.cc"}, "/b.cc");
+    InternedArgs c({"clang", "-DB", "/a.cc"}, "/a.cc");
+    REQUIRE(a.SameFlags(b));
+    REQUIRE(!a.SameFlags(c));
+    REQUIRE(a.Get() == std::vector<std::string>{"clang", "-DA", "/a.cc"});
+    REQUIRE(b.Get() == std::vector<std::string>{"clang", "-DA", "/b.cc"});
+    REQUIRE(InternedArgs().Get().empty());
+  }
+}
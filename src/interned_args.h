@@ -0,0 +1,49 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+class Reader;
+class Writer;
+
+// Compiler arguments for one file. Most files in a target are compiled with
+// the same flags apart from their own path, so the flags are interned with
+// the file's path factored out: files with equal flags share one immutable
+// copy, and comparing their flags is a pointer compare.
+struct InternedArgs {
+  InternedArgs() = default;
+  // Interns |args|. Arguments equal to |file| refer to the file instead, so
+  // they do not prevent sharing.
+  explicit InternedArgs(const std::vector<std::string>& args,
+                        const std::string& file = std::string());
+
+  // Returns the arguments, with |file| filled back in.
+  std::vector<std::string> Get() const;
+  const std::string& file() const { return file_; }
+  size_t size() const;
+  bool empty() const { return size() == 0; }
+
+  // True if both were interned from the same arguments, not counting their
+  // files.
+  bool SameFlags(const InternedArgs& other) const {
+    return flags_ == other.flags_;
+  }
+
+ private:
+  struct Flags {
+    // Positions in |file_positions| hold an empty string.
+    std::vector<std::string> args;
+    std::vector<size_t> file_positions;
+  };
+
+  static std::shared_ptr<const Flags> Intern(Flags flags);
+
+  std::shared_ptr<const Flags> flags_;
+  std::string file_;
+};
+
+// Serialized as the plain argument list. Deserialized arguments are interned
+// without a file; see Deserialize for IndexFile.
+void Reflect(Reader& visitor, InternedArgs& value);
+void Reflect(Writer& visitor, InternedArgs& value);
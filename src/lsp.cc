@@ -64,9 +64,9 @@ lsVersionedTextDocumentIdentifier::AsTextDocumentIdentifier() const {
   return result;
 }
 
-// Reads a JsonRpc message. |read| returns the next input character.
 optional<std::string> ReadJsonRpcContentFrom(
-    std::function<optional<char>()> read) {
+    std::function<optional<char>()> read,
+    optional<long long>* recorded_time_ms) {
   // Read the header. The header itself, along with each field, is terminated by
   // the "\r\n" sequence.
   const char* kContentLengthStart = "Content-Length: ";
@@ -99,6 +99,12 @@ optional<std::string> ReadJsonRpcContentFrom(
           atoi(stringified_header_field.c_str() + strlen(kContentLengthStart));
       } else if (StartsWith(stringified_header_field, kContentTypeStart)) {
         // Content-Type field is ignored.
+      } else if (StartsWith(stringified_header_field, kRecordedTimeHeader)) {
+        // Written by --record; only --replay cares about it.
+        if (recorded_time_ms) {
+          *recorded_time_ms = atoll(stringified_header_field.c_str() +
+                                    strlen(kRecordedTimeHeader));
+        }
       } else {
         LOG_S(INFO) << "Unknown field in the header";
         return nullopt;
@@ -160,6 +166,8 @@ TEST_SUITE("FindIncludeLine") {
     REQUIRE(parse_correct("Content-Length: 0\r\n\r\n") == "");
     REQUIRE(parse_correct("Content-Length: 1\r\n\r\na") == "a");
     REQUIRE(parse_correct("Content-Length: 4\r\n\r\nabcd") == "abcd");
+    REQUIRE(parse_correct(
+                "Cquery-Time-Ms: 12\r\nContent-Length: 1\r\n\r\na") == "a");
 
     REQUIRE(parse_incorrect("ggg") == optional<std::string>());
     REQUIRE(parse_incorrect("Content-Length: 0\r\n") ==
@@ -27,6 +27,13 @@
 #define REGISTER_IN_MESSAGE(type) \
   static MessageRegistryRegister<type> type##message_handler_instance_;
 
+// Reads a JsonRpc message. |read| returns the next input character. If the
+// message was written by --record, |recorded_time_ms| receives the time it was
+// received at.
+optional<std::string> ReadJsonRpcContentFrom(
+    std::function<optional<char>()> read,
+    optional<long long>* recorded_time_ms = nullptr);
+
 struct MessageRegistry {
   static MessageRegistry* instance_;
   static MessageRegistry* instance();
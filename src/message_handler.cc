@@ -172,11 +172,11 @@ void EmitSemanticHighlighting(QueryDatabase* db,
         // The function is not there if this isn't at least zero.
         if (start_line < 0)
           continue;
-        if (start_line >= 0 && start_line < working_file->index_lines.size()) {
-          std::string_view line = working_file->index_lines[start_line];
+        if (optional<std::string_view> line =
+                working_file->GetIndexLine(start_line)) {
           sym.range.end.line = start_line;
-          if (start_col + concise_name.size() <= line.size() &&
-              line.compare(start_col, concise_name.size(), concise_name) == 0)
+          if (start_col + concise_name.size() <= line->size() &&
+              line->compare(start_col, concise_name.size(), concise_name) == 0)
             sym.range.end.column = start_col + concise_name.size();
           else
             continue;  // applies to for loop
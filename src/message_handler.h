@@ -13,6 +13,7 @@ struct ClangCompleteManager;
 struct CodeCompleteCache;
 struct Config;
 struct DiagnosticsEngine;
+struct DocsCache;
 struct FileConsumerSharedState;
 struct ImportManager;
 struct ImportPipelineStatus;
@@ -77,6 +78,7 @@ struct MessageHandler {
   ImportPipelineStatus* import_pipeline_status = nullptr;
   TimestampManager* timestamp_manager = nullptr;
   SemanticHighlightSymbolCache* semantic_cache = nullptr;
+  DocsCache* docs_cache = nullptr;
   WorkingFiles* working_files = nullptr;
   ClangCompleteManager* clang_complete = nullptr;
   IncludeComplete* include_complete = nullptr;
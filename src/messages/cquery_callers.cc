@@ -31,7 +31,8 @@ struct Handler_CqueryCallers : BaseMessageHandler<In_CqueryCallers> {
          FindSymbolsAtLocation(working_file, file, request->params.position)) {
       if (sym.kind == SymbolKind::Func) {
         QueryFunc& func = db->GetFunc(sym);
-        std::vector<QueryId::LexicalRef> uses = func.uses;
+        std::vector<QueryId::LexicalRef> uses(func.uses.begin(),
+                                              func.uses.end());
         for (QueryId::LexicalRef func_ref : GetRefsForAllBases(db, func))
           uses.push_back(func_ref);
         for (QueryId::LexicalRef func_ref : GetRefsForAllDerived(db, func))
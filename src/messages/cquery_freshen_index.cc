@@ -40,8 +40,6 @@ struct Handler_CqueryFreshenIndex : BaseMessageHandler<In_CqueryFreshenIndex> {
     GroupMatch matcher(request->params.whitelist, request->params.blacklist);
 
     // Unmark all files whose timestamp has changed.
-    std::shared_ptr<ICacheManager> cache_manager = ICacheManager::Make();
-
     std::queue<const QueryFile*> q;
     // |need_index| stores every filename ever enqueued.
     std::unordered_set<std::string> need_index;
@@ -69,6 +67,8 @@ struct Handler_CqueryFreshenIndex : BaseMessageHandler<In_CqueryFreshenIndex> {
           GetLastModificationTime(file->def->path);
       if (!modification_timestamp)
         continue;
+      std::shared_ptr<ICacheManager> cache_manager =
+          ICacheManager::Make(file->def->args.Get());
       optional<int64_t> cached_modification =
           timestamp_manager->GetLastCachedModificationTime(cache_manager.get(),
                                                            file->def->path);
@@ -35,9 +35,10 @@ struct Handler_CqueryIndexFile : BaseMessageHandler<In_CqueryIndexFile> {
 
     LOG_S(INFO) << "Indexing file " << request->params.path;
     QueueManager::instance()->index_request.Enqueue(
-        Index_Request(path->path, request->params.args,
+        Index_Request(path->path,
+                      InternedArgs(request->params.args, path->path),
                       request->params.is_interactive, request->params.contents,
-                      ICacheManager::Make()),
+                      ICacheManager::Make(request->params.args)),
         true /*priority*/);
   }
 };
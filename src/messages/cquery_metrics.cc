@@ -0,0 +1,218 @@
+#include "message_handler.h"
+#include "metrics.h"
+#include "query.h"
+#include "queue_manager.h"
+#include "timer.h"
+#include "working_files.h"
+
+namespace {
+MethodType kMethodType = "$cquery/metrics";
+
+struct In_CqueryMetrics : public RequestInMessage {
+  MethodType GetMethodType() const override { return kMethodType; }
+};
+MAKE_REFLECT_STRUCT(In_CqueryMetrics, id);
+REGISTER_IN_MESSAGE(In_CqueryMetrics);
+
+struct Out_CqueryMetrics : public lsOutMessage<Out_CqueryMetrics> {
+  struct Histogram {
+    std::string name;
+    long long count = 0;
+    double meanMs = 0;
+    double p50Ms = 0;
+    double p90Ms = 0;
+    double p99Ms = 0;
+    double maxMs = 0;
+    // buckets[i] counts durations below 2^i microseconds (and at least
+    // 2^(i-1)). Trailing empty buckets are omitted.
+    std::vector<long long> buckets;
+  };
+  struct Queue {
+    std::string name;
+    int size = 0;
+    long long enqueued = 0;
+    long long dequeued = 0;
+    // Rates since the previous $cquery/metrics request.
+    double enqueuedPerSecond = 0;
+    double dequeuedPerSecond = 0;
+  };
+  struct Counter {
+    std::string name;
+    long long value = 0;
+  };
+  struct Cache {
+    long long memoryHits = 0;
+    long long diskHits = 0;
+    long long misses = 0;
+    // Fraction of lookups that found an index, in memory or on disk.
+    double hitRatio = 0;
+  };
+  struct Memory {
+    double processMb = 0;
+    int queryDbFiles = 0;
+    int queryDbTypes = 0;
+    int queryDbFuncs = 0;
+    int queryDbVars = 0;
+    // Size of the symbol tables themselves; strings and reference lists they
+    // point to are not included.
+    double queryDbTablesMb = 0;
+    int workingFiles = 0;
+    double workingFilesContentMb = 0;
+  };
+  struct Result {
+    // Latencies of LSP requests, named lsp.<method>, and of pipeline stages.
+    std::vector<Histogram> histograms;
+    std::vector<Queue> queues;
+    std::vector<Counter> counters;
+    Cache cache;
+    Memory memory;
+  };
+  lsRequestId id;
+  Result result;
+};
+MAKE_REFLECT_STRUCT(Out_CqueryMetrics::Histogram,
+                    name,
+                    count,
+                    meanMs,
+                    p50Ms,
+                    p90Ms,
+                    p99Ms,
+                    maxMs,
+                    buckets);
+MAKE_REFLECT_STRUCT(Out_CqueryMetrics::Queue,
+                    name,
+                    size,
+                    enqueued,
+                    dequeued,
+                    enqueuedPerSecond,
+                    dequeuedPerSecond);
+MAKE_REFLECT_STRUCT(Out_CqueryMetrics::Counter, name, value);
+MAKE_REFLECT_STRUCT(Out_CqueryMetrics::Cache,
+                    memoryHits,
+                    diskHits,
+                    misses,
+                    hitRatio);
+MAKE_REFLECT_STRUCT(Out_CqueryMetrics::Memory,
+                    processMb,
+                    queryDbFiles,
+                    queryDbTypes,
+                    queryDbFuncs,
+                    queryDbVars,
+                    queryDbTablesMb,
+                    workingFiles,
+                    workingFilesContentMb);
+MAKE_REFLECT_STRUCT(Out_CqueryMetrics::Result,
+                    histograms,
+                    queues,
+                    counters,
+                    cache,
+                    memory);
+MAKE_REFLECT_STRUCT(Out_CqueryMetrics, jsonrpc, id, result);
+
+const double kBytesToMb = 1000000;
+
+template <typename T>
+size_t TableBytes(const std::vector<T>& table) {
+  return table.capacity() * sizeof(T);
+}
+
+struct Handler_CqueryMetrics : BaseMessageHandler<In_CqueryMetrics> {
+  MethodType GetMethodType() const override { return kMethodType; }
+
+  void Run(In_CqueryMetrics* request) override {
+    Out_CqueryMetrics out;
+    out.id = request->id;
+
+    ForEachLatencyHistogram([&](const std::string& name,
+                                const LatencyHistogram& histogram) {
+      Out_CqueryMetrics::Histogram entry;
+      entry.name = name;
+      entry.count = histogram.count;
+      if (entry.count)
+        entry.meanMs = histogram.total_us / 1000.0 / entry.count;
+      entry.p50Ms = histogram.Percentile(50) / 1000.0;
+      entry.p90Ms = histogram.Percentile(90) / 1000.0;
+      entry.p99Ms = histogram.Percentile(99) / 1000.0;
+      entry.maxMs = histogram.max_us / 1000.0;
+      for (const std::atomic<long long>& bucket : histogram.buckets)
+        entry.buckets.push_back(bucket);
+      while (!entry.buckets.empty() && entry.buckets.back() == 0)
+        entry.buckets.pop_back();
+      out.result.histograms.push_back(std::move(entry));
+    });
+
+    double elapsed_seconds =
+        since_last_request_.ElapsedMicrosecondsAndReset() / 1000000.0;
+    auto* queue = QueueManager::instance();
+    auto add_queue = [&](const char* name, const auto& q) {
+      Out_CqueryMetrics::Queue entry;
+      entry.name = name;
+      entry.size = (int)q.Size();
+      entry.enqueued = q.TotalEnqueued();
+      entry.dequeued = q.TotalDequeued();
+      std::pair<long long, long long>& previous = previous_queue_totals_[name];
+      if (elapsed_seconds > 0) {
+        entry.enqueuedPerSecond =
+            (entry.enqueued - previous.first) / elapsed_seconds;
+        entry.dequeuedPerSecond =
+            (entry.dequeued - previous.second) / elapsed_seconds;
+      }
+      previous = {entry.enqueued, entry.dequeued};
+      out.result.queues.push_back(std::move(entry));
+    };
+    add_queue("for_stdout", queue->for_stdout);
+    add_queue("for_querydb", queue->for_querydb);
+    add_queue("do_id_map", queue->do_id_map);
+    add_queue("index_request", queue->index_request);
+    add_queue("load_previous_index", queue->load_previous_index);
+    add_queue("on_id_mapped", queue->on_id_mapped);
+    add_queue("on_indexed_for_merge", queue->on_indexed_for_merge);
+    add_queue("on_indexed_for_querydb", queue->on_indexed_for_querydb);
+
+    ForEachCounter([&](const std::string& name, long long value) {
+      Out_CqueryMetrics::Counter entry;
+      entry.name = name;
+      entry.value = value;
+      out.result.counters.push_back(std::move(entry));
+
+      if (name == "cache.memory_hits")
+        out.result.cache.memoryHits = value;
+      else if (name == "cache.disk_hits")
+        out.result.cache.diskHits = value;
+      else if (name == "cache.misses")
+        out.result.cache.misses = value;
+    });
+    Out_CqueryMetrics::Cache& cache = out.result.cache;
+    long long lookups = cache.memoryHits + cache.diskHits + cache.misses;
+    if (lookups)
+      cache.hitRatio = double(cache.memoryHits + cache.diskHits) / lookups;
+
+    // |db| is only touched by the querydb thread, which is running us.
+    Out_CqueryMetrics::Memory& memory = out.result.memory;
+    memory.processMb = GetProcessMemoryUsedInMb();
+    memory.queryDbFiles = (int)db->files.size();
+    memory.queryDbTypes = (int)db->types.size();
+    memory.queryDbFuncs = (int)db->funcs.size();
+    memory.queryDbVars = (int)db->vars.size();
+    size_t table_bytes = TableBytes(db->symbols) + TableBytes(db->files) +
+                         TableBytes(db->types) + TableBytes(db->funcs) +
+                         TableBytes(db->vars);
+    memory.queryDbTablesMb = table_bytes / kBytesToMb;
+    working_files->DoAction([&]() {
+      size_t content_bytes = 0;
+      for (const auto& file : working_files->files)
+        content_bytes += file->buffer_content.size();
+      memory.workingFiles = (int)working_files->files.size();
+      memory.workingFilesContentMb = content_bytes / kBytesToMb;
+    });
+
+    QueueManager::WriteStdout(kMethodType, out);
+  }
+
+ private:
+  Timer since_last_request_;
+  std::unordered_map<std::string, std::pair<long long, long long>>
+      previous_queue_totals_;
+};
+REGISTER_MESSAGE_HANDLER(Handler_CqueryMetrics);
+}  // namespace
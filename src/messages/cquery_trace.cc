@@ -0,0 +1,60 @@
+#include "message_handler.h"
+#include "queue_manager.h"
+#include "trace.h"
+
+namespace {
+MethodType kMethodType = "$cquery/trace";
+
+struct In_CqueryTrace : public RequestInMessage {
+  MethodType GetMethodType() const override { return kMethodType; }
+  struct Params {
+    // If set, the events recorded so far are written to this file in Chrome
+    // trace-event format and then forgotten.
+    std::string path;
+    // Whether to keep recording afterwards.
+    bool enabled = true;
+  };
+  Params params;
+};
+MAKE_REFLECT_STRUCT(In_CqueryTrace::Params, path, enabled);
+MAKE_REFLECT_STRUCT(In_CqueryTrace, id, params);
+REGISTER_IN_MESSAGE(In_CqueryTrace);
+
+struct Out_CqueryTrace : public lsOutMessage<Out_CqueryTrace> {
+  struct Result {
+    // Number of events written to |path|.
+    int eventCount = 0;
+  };
+  lsRequestId id;
+  Result result;
+};
+MAKE_REFLECT_STRUCT(Out_CqueryTrace::Result, eventCount);
+MAKE_REFLECT_STRUCT(Out_CqueryTrace, jsonrpc, id, result);
+
+struct Handler_CqueryTrace : BaseMessageHandler<In_CqueryTrace> {
+  MethodType GetMethodType() const override { return kMethodType; }
+  void Run(In_CqueryTrace* request) override {
+    Out_CqueryTrace response;
+    response.id = request->id;
+    if (!request->params.path.empty()) {
+      optional<size_t> event_count = WriteTrace(request->params.path);
+      if (!event_count) {
+        Out_Error out;
+        out.id = request->id;
+        out.error.code = lsErrorCodes::InternalError;
+        out.error.message = "Cannot write " + request->params.path;
+        QueueManager::WriteStdout(kMethodType, out);
+        return;
+      }
+      response.result.eventCount = (int)*event_count;
+    }
+
+    if (request->params.enabled)
+      StartTracing();
+    else
+      StopTracing();
+    QueueManager::WriteStdout(kMethodType, response);
+  }
+};
+REGISTER_MESSAGE_HANDLER(Handler_CqueryTrace);
+}  // namespace
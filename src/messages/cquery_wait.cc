@@ -28,7 +28,7 @@ struct Handler_CqueryWait : MessageHandler {
       has_work |= import_pipeline_status->num_active_threads != 0;
       has_work |= QueueManager::instance()->HasWork();
       has_work |= QueryDb_ImportMain(db, import_manager, import_pipeline_status,
-                                     semantic_cache, working_files);
+                                     semantic_cache, docs_cache, working_files);
       if (!has_work)
         ++idle_count;
       else
@@ -3,6 +3,7 @@
 #include "import_pipeline.h"
 #include "include_complete.h"
 #include "message_handler.h"
+#include "parse_quarantine.h"
 #include "platform.h"
 #include "project.h"
 #include "queue_manager.h"
@@ -605,10 +606,9 @@ struct Handler_Initialize : BaseMessageHandler<In_InitializeRequest> {
       g_config->projectRoot = project_path;
       // Create two cache directories for files inside and outside of the
       // project.
-      MakeDirectoryRecursive(g_config->cacheDirectory +
-                             EscapeFileName(g_config->projectRoot));
-      MakeDirectoryRecursive(g_config->cacheDirectory + '@' +
-                             EscapeFileName(g_config->projectRoot));
+      ICacheManager::MakeCacheDirectories();
+      ParseQuarantine::instance()->Load(
+          ICacheManager::GetProjectCachePath("@parse_quarantine.json"));
 
       Timer time;
       diag_engine->Init();
@@ -636,7 +636,7 @@ struct Handler_Initialize : BaseMessageHandler<In_InitializeRequest> {
         WorkThread::StartThread("indexer" + std::to_string(i), [=]() {
           Indexer_Main(diag_engine, file_consumer_shared, timestamp_manager,
                        import_manager, import_pipeline_status, project,
-                       working_files);
+                       working_files, clang_complete);
         });
       }
 
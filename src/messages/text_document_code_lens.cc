@@ -40,11 +40,13 @@ QueryId::LexicalRef OffsetStartColumn(QueryId::LexicalRef ref, int16_t offset) {
   return ref;
 }
 
+// |uses| is a std::vector or PackedLexicalRefs of QueryId::LexicalRef.
+template <typename TUses>
 void AddCodeLens(const char* singular,
                  const char* plural,
                  CommonCodeLensParams* common,
                  QueryId::LexicalRef ref,
-                 const std::vector<QueryId::LexicalRef>& uses,
+                 const TUses& uses,
                  bool force_display) {
   TCodeLens code_lens;
   optional<lsRange> range = GetLsRange(common->working_file, ref.range);
@@ -30,7 +30,8 @@ struct Handler_TextDocumentDidChange
       Project::Entry entry = project->FindCompilationEntryForFile(path);
       QueueManager::instance()->index_request.Enqueue(
           Index_Request(entry.filename, entry.args, true /*is_interactive*/,
-                        working_file->buffer_content, ICacheManager::Make()),
+                        working_file->buffer_content,
+                        ICacheManager::Make(entry.args.Get())),
           true /*priority*/);
     }
     clang_complete->NotifyEdit(path);
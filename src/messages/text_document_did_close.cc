@@ -1,4 +1,5 @@
 #include "clang_complete.h"
+#include "diagnostics_engine.h"
 #include "message_handler.h"
 #include "queue_manager.h"
 #include "working_files.h"
@@ -24,10 +25,12 @@ struct Handler_TextDocumentDidClose
   void Run(In_TextDocumentDidClose* request) override {
     AbsolutePath path = request->params.textDocument.uri.GetAbsolutePath();
 
-    // Clear any diagnostics for the file.
+    // Clear any diagnostics for the file. The engine has to forget them too,
+    // or it would not publish them again when the file is reopened.
     Out_TextDocumentPublishDiagnostics out;
     out.params.uri = request->params.textDocument.uri;
     QueueManager::WriteStdout(kMethodType, out);
+    diag_engine->OnClose(path);
 
     // Remove internal state.
     working_files->OnClose(request->params.textDocument);
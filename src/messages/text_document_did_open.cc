@@ -43,32 +43,30 @@ struct Handler_TextDocumentDidOpen
     if (ShouldIgnoreFileForIndexing(path))
       return;
 
-    std::shared_ptr<ICacheManager> cache_manager = ICacheManager::Make();
     WorkingFile* working_file = working_files->OnOpen(params.textDocument);
-    optional<std::string> cached_file_contents =
-        cache_manager->LoadCachedFileContents(path);
-    if (cached_file_contents)
-      working_file->SetIndexContent(*cached_file_contents);
 
     QueryFile* file = nullptr;
     FindFileOrFail(db, project, nullopt, path, &file);
     if (file && file->def) {
+      working_file->SetIndexLineHashes(file->def->line_hashes);
       EmitInactiveLines(working_file, file->def->inactive_regions);
       EmitSemanticHighlighting(db, semantic_cache, working_file, file);
     }
 
     time.ResetAndPrint(
-        "[querydb] Loading cached index file for DidOpen (blocks "
-        "CodeLens)");
+        "[querydb] Loading index state for DidOpen (blocks CodeLens)");
 
     include_complete->AddFile(working_file->filename);
 
     // Submit new index request.
     Project::Entry entry = project->FindCompilationEntryForFile(path);
+    InternedArgs args = params.args.size()
+                            ? InternedArgs(params.args, entry.filename)
+                            : entry.args;
     QueueManager::instance()->index_request.Enqueue(
-        Index_Request(
-            entry.filename, params.args.size() ? params.args : entry.args,
-            true /*is_interactive*/, params.textDocument.text, cache_manager),
+        Index_Request(entry.filename, args, true /*is_interactive*/,
+                      params.textDocument.text,
+                      ICacheManager::Make(args.Get())),
         true /*priority*/);
 
     if (params.args.size()) {
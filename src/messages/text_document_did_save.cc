@@ -49,16 +49,20 @@ struct Handler_TextDocumentDidSave
     //      mutex and check to see if we should skip the current request.
     //      if so, ignore that index response.
     // TODO: send as priority request
+
+    // The indexer publishes the diagnostics of its parse of the file, so there
+    // is no separate diagnostics reparse for it.
     if (!g_config->enableIndexOnDidChange) {
       Project::Entry entry = project->FindCompilationEntryForFile(path);
       QueueManager::instance()->index_request.Enqueue(
           Index_Request(entry.filename, entry.args, true /*is_interactive*/,
-                        nullopt, ICacheManager::Make()),
+                        nullopt, ICacheManager::Make(entry.args.Get())),
           true /*priority*/);
+    } else {
+      clang_complete->DiagnosticsUpdate(path);
     }
 
     clang_complete->NotifySave(path);
-    clang_complete->DiagnosticsUpdate(path);
   }
 };
 REGISTER_MESSAGE_HANDLER(Handler_TextDocumentDidSave);
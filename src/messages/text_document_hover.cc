@@ -1,3 +1,4 @@
+#include "docs_cache.h"
 #include "message_handler.h"
 #include "query_utils.h"
 #include "queue_manager.h"
@@ -5,29 +6,37 @@
 namespace {
 MethodType kMethodType = "textDocument/hover";
 
-// Find the comments for |sym|, if any.
-optional<lsMarkedString> GetComments(QueryDatabase* db,
-                                     QueryId::SymbolRef sym) {
-  auto make = [](std::string_view comment) -> optional<lsMarkedString> {
-    lsMarkedString result;
-    result.value = std::string(comment.data(), comment.length());
-    return result;
-  };
-
-  optional<lsMarkedString> result;
+// Finds hover and comments for |sym| in the docs of the file which defines
+// it. These are not stored in querydb.
+optional<IndexDocs> LoadDocs(QueryDatabase* db,
+                             DocsCache* docs_cache,
+                             QueryId::SymbolRef sym) {
+  optional<IndexDocs> result;
   WithEntity(db, sym, [&](const auto& entity) {
-    if (const auto* def = entity.AnyDef()) {
-      if (!def->comments.empty())
-        result = make(def->comments);
-    }
+    const auto* def = entity.AnyDef();
+    if (!def || !def->file.HasValueForMaybe_())
+      return;
+    const QueryFile& file = db->files[def->file.id];
+    if (file.def)
+      result = docs_cache->Get(*file.def, sym.kind, entity.usr);
   });
   return result;
 }
 
+// Find the comments for |sym|, if any.
+optional<lsMarkedString> GetComments(const optional<IndexDocs>& docs) {
+  if (!docs || docs->comments.empty())
+    return nullopt;
+  lsMarkedString result;
+  result.value = docs->comments;
+  return result;
+}
+
 // Returns the hover or detailed name for `sym`, if any.
 optional<lsMarkedString> GetHoverOrName(QueryDatabase* db,
                                         const std::string& language,
-                                        QueryId::SymbolRef sym) {
+                                        QueryId::SymbolRef sym,
+                                        const optional<IndexDocs>& docs) {
   auto make = [&](std::string_view comment) {
     lsMarkedString result;
     result.language = language;
@@ -35,12 +44,13 @@ optional<lsMarkedString> GetHoverOrName(QueryDatabase* db,
     return result;
   };
 
+  if (docs && !docs->hover.empty())
+    return make(docs->hover);
+
   optional<lsMarkedString> result;
   WithEntity(db, sym, [&](const auto& entity) {
     if (const auto* def = entity.AnyDef()) {
-      if (!def->hover.empty())
-        result = make(def->hover);
-      else if (!def->detailed_name.empty())
+      if (!def->detailed_name.empty())
         result = make(def->detailed_name);
     }
   });
@@ -93,9 +103,10 @@ struct Handler_TextDocumentHover : BaseMessageHandler<In_TextDocumentHover> {
       if (!ls_range)
         continue;
 
-      optional<lsMarkedString> comments = GetComments(db, sym);
+      optional<IndexDocs> docs = LoadDocs(db, docs_cache, sym);
+      optional<lsMarkedString> comments = GetComments(docs);
       optional<lsMarkedString> hover =
-          GetHoverOrName(db, file->def->language, sym);
+          GetHoverOrName(db, file->def->language, sym, docs);
       if (comments || hover) {
         out.result = Out_TextDocumentHover::Result();
         out.result->range = *ls_range;
@@ -55,7 +55,7 @@ struct Handler_WorkspaceDidChangeWatchedFiles
         case lsFileChangeType::Changed: {
           QueueManager::instance()->index_request.Enqueue(
               Index_Request(path, entry.args, is_interactive, nullopt,
-                            ICacheManager::Make()),
+                            ICacheManager::Make(entry.args.Get())),
               false /*priority*/);
           if (is_interactive)
             clang_complete->NotifySave(path);
@@ -64,7 +64,7 @@ struct Handler_WorkspaceDidChangeWatchedFiles
         case lsFileChangeType::Deleted:
           QueueManager::instance()->index_request.Enqueue(
               Index_Request(path, entry.args, is_interactive, std::string(),
-                            ICacheManager::Make()),
+                            ICacheManager::Make(entry.args.Get())),
               false /*priority*/);
           break;
       }
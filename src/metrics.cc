@@ -0,0 +1,106 @@
+#include "metrics.h"
+
+#include <doctest/doctest.h>
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+
+namespace {
+
+std::mutex g_metrics_mutex;
+std::map<std::string, std::unique_ptr<LatencyHistogram>> g_histograms;
+std::map<std::string, std::unique_ptr<std::atomic<long long>>> g_counters;
+
+int BucketFor(long long duration_us) {
+  int bucket = 0;
+  while (duration_us > 0 && bucket < LatencyHistogram::kNumBuckets - 1) {
+    duration_us >>= 1;
+    ++bucket;
+  }
+  return bucket;
+}
+
+}  // namespace
+
+void LatencyHistogram::Record(long long duration_us) {
+  if (duration_us < 0)
+    duration_us = 0;
+  buckets[BucketFor(duration_us)]++;
+  total_us += duration_us;
+  long long max = max_us;
+  while (duration_us > max && !max_us.compare_exchange_weak(max, duration_us)) {
+  }
+  // Incremented last so readers never see more samples than bucket entries.
+  count++;
+}
+
+long long LatencyHistogram::Percentile(double percentile) const {
+  long long total = count;
+  if (total == 0)
+    return 0;
+  long long target = (long long)(total * percentile / 100);
+  if (target >= total)
+    target = total - 1;
+  long long seen = 0;
+  for (int i = 0; i < kNumBuckets; ++i) {
+    seen += buckets[i];
+    if (seen > target)
+      return std::min(i == 0 ? 0 : 1ll << i, (long long)max_us);
+  }
+  return max_us;
+}
+
+LatencyHistogram* GetLatencyHistogram(const std::string& name) {
+  std::lock_guard<std::mutex> lock(g_metrics_mutex);
+  std::unique_ptr<LatencyHistogram>& histogram = g_histograms[name];
+  if (!histogram)
+    histogram = std::make_unique<LatencyHistogram>();
+  return histogram.get();
+}
+
+std::atomic<long long>* GetCounter(const std::string& name) {
+  std::lock_guard<std::mutex> lock(g_metrics_mutex);
+  std::unique_ptr<std::atomic<long long>>& counter = g_counters[name];
+  if (!counter)
+    counter = std::make_unique<std::atomic<long long>>(0);
+  return counter.get();
+}
+
+void RecordLatency(const std::string& name, long long duration_us) {
+  GetLatencyHistogram(name)->Record(duration_us);
+}
+
+void IncrementCounter(const std::string& name, long long delta) {
+  *GetCounter(name) += delta;
+}
+
+void ForEachLatencyHistogram(
+    std::function<void(const std::string&, const LatencyHistogram&)> fn) {
+  std::lock_guard<std::mutex> lock(g_metrics_mutex);
+  for (const auto& entry : g_histograms)
+    fn(entry.first, *entry.second);
+}
+
+void ForEachCounter(std::function<void(const std::string&, long long)> fn) {
+  std::lock_guard<std::mutex> lock(g_metrics_mutex);
+  for (const auto& entry : g_counters)
+    fn(entry.first, *entry.second);
+}
+
+TEST_SUITE("Metrics") {
+  TEST_CASE("histogram percentiles") {
+    LatencyHistogram histogram;
+    REQUIRE(histogram.Percentile(50) == 0);
+    for (int i = 0; i < 90; ++i)
+      histogram.Record(10);
+    for (int i = 0; i < 10; ++i)
+      histogram.Record(1000);
+    REQUIRE(histogram.count == 100);
+    REQUIRE(histogram.max_us == 1000);
+    // 10us lands in the [8, 16) bucket, 1000us in [512, 1024).
+    REQUIRE(histogram.Percentile(50) == 16);
+    REQUIRE(histogram.Percentile(95) == 1000);
+  }
+}
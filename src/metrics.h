@@ -0,0 +1,38 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <functional>
+#include <string>
+
+// Process-wide counters and latency histograms, reported by $cquery/metrics.
+// Recording is lock-free once a metric has been looked up, so hot paths should
+// look up their metric once and keep the pointer; metrics are never destroyed.
+
+// Latency histogram with power-of-two microsecond buckets. Bucket i holds
+// durations in [2^(i-1), 2^i) microseconds; bucket 0 holds durations below 1us.
+struct LatencyHistogram {
+  static constexpr int kNumBuckets = 36;
+
+  void Record(long long duration_us);
+  // Returns an upper bound of the |percentile| (0-100) duration, accurate to a
+  // factor of two.
+  long long Percentile(double percentile) const;
+
+  std::atomic<long long> count{0};
+  std::atomic<long long> total_us{0};
+  std::atomic<long long> max_us{0};
+  std::array<std::atomic<long long>, kNumBuckets> buckets{};
+};
+
+// Returns the histogram or counter called |name|, creating it if needed.
+LatencyHistogram* GetLatencyHistogram(const std::string& name);
+std::atomic<long long>* GetCounter(const std::string& name);
+
+void RecordLatency(const std::string& name, long long duration_us);
+void IncrementCounter(const std::string& name, long long delta = 1);
+
+// Visits every metric in name order.
+void ForEachLatencyHistogram(
+    std::function<void(const std::string&, const LatencyHistogram&)> fn);
+void ForEachCounter(std::function<void(const std::string&, long long)> fn);
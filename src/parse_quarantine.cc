@@ -0,0 +1,164 @@
+#include "parse_quarantine.h"
+
+#include "config.h"
+#include "serializers/json.h"
+#include "utils.h"
+
+#include <doctest/doctest.h>
+#include <rapidjson/writer.h>
+#include <loguru.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+namespace {
+
+struct QuarantineEntry {
+  std::string path;
+  int timeouts = 0;
+};
+MAKE_REFLECT_STRUCT(QuarantineEntry, path, timeouts);
+
+}  // namespace
+
+// static
+ParseQuarantine* ParseQuarantine::instance() {
+  static ParseQuarantine* instance = new ParseQuarantine();
+  return instance;
+}
+
+void ParseQuarantine::Load(const std::string& path) {
+  optional<std::string> content = ReadContent(path);
+  std::lock_guard<std::mutex> lock(mutex_);
+  path_ = path;
+  timeouts_.clear();
+  if (!content || content->empty())
+    return;
+
+  rapidjson::Document document;
+  document.Parse(content->c_str(), content->size());
+  if (document.HasParseError()) {
+    LOG_S(WARNING) << "Ignoring malformed " << path;
+    return;
+  }
+  std::vector<QuarantineEntry> entries;
+  JsonReader json_reader{&document};
+  try {
+    Reflect(json_reader, entries);
+  } catch (std::invalid_argument&) {
+    LOG_S(WARNING) << "Ignoring malformed " << path;
+    return;
+  }
+  for (const QuarantineEntry& entry : entries)
+    timeouts_[entry.path] = entry.timeouts;
+}
+
+int ParseQuarantine::GetTimeoutMs(const std::string& path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (IsQuarantinedLocked(path) || timed_out_this_session_.count(path))
+    return 0;
+  return std::max(0, g_config->index.parseTimeoutMs);
+}
+
+bool ParseQuarantine::IsQuarantined(const std::string& path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return IsQuarantinedLocked(path);
+}
+
+int ParseQuarantine::Count() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  int count = 0;
+  for (auto& entry : timeouts_)
+    if (IsQuarantinedLocked(entry.first))
+      ++count;
+  return count;
+}
+
+void ParseQuarantine::RecordTimeout(const std::string& path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  // Count one timeout per session.
+  if (!timed_out_this_session_.insert(path).second)
+    return;
+  ++timeouts_[path];
+  Save();
+}
+
+void ParseQuarantine::RecordSuccess(const std::string& path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (timeouts_.erase(path))
+    Save();
+}
+
+bool ParseQuarantine::IsQuarantinedLocked(const std::string& path) const {
+  int after = g_config->index.quarantineAfterTimeouts;
+  if (after <= 0)
+    return false;
+  auto it = timeouts_.find(path);
+  return it != timeouts_.end() && it->second >= after;
+}
+
+void ParseQuarantine::Save() {
+  if (path_.empty())
+    return;
+
+  std::vector<QuarantineEntry> entries;
+  for (auto& entry : timeouts_)
+    entries.push_back({entry.first, entry.second});
+  std::sort(entries.begin(), entries.end(),
+            [](const QuarantineEntry& a, const QuarantineEntry& b) {
+              return a.path < b.path;
+            });
+
+  rapidjson::StringBuffer output;
+  rapidjson::Writer<rapidjson::StringBuffer> writer(output);
+  JsonWriter json_writer(&writer);
+  Reflect(json_writer, entries);
+  WriteToFile(path_, std::string(output.GetString(), output.GetSize()));
+}
+
+TEST_SUITE("ParseQuarantine") {
+  TEST_CASE("quarantined after timeouts in a row") {
+    ParseQuarantine quarantine;
+    int timeout = g_config->index.parseTimeoutMs;
+    REQUIRE(g_config->index.quarantineAfterTimeouts == 2);
+
+    REQUIRE(quarantine.GetTimeoutMs("a.cc") == timeout);
+    quarantine.RecordTimeout("a.cc");
+    // The timed out file is retried without a limit in the same session, but
+    // it is not quarantined yet.
+    REQUIRE(quarantine.GetTimeoutMs("a.cc") == 0);
+    REQUIRE(!quarantine.IsQuarantined("a.cc"));
+    quarantine.RecordTimeout("a.cc");
+    REQUIRE(!quarantine.IsQuarantined("a.cc"));
+    REQUIRE(quarantine.GetTimeoutMs("b.cc") == timeout);
+
+    quarantine.RecordSuccess("a.cc");
+    REQUIRE(quarantine.Count() == 0);
+  }
+
+  TEST_CASE("quarantine is kept across sessions") {
+    std::string path = "parse_quarantine_test.json";
+    std::remove(path.c_str());
+    REQUIRE(g_config->index.quarantineAfterTimeouts == 2);
+
+    // Each session reads what the previous one saved, and "a.cc" times out in
+    // both.
+    for (int session = 0; session < 2; ++session) {
+      ParseQuarantine quarantine;
+      quarantine.Load(path);
+      REQUIRE(!quarantine.IsQuarantined("a.cc"));
+      REQUIRE(quarantine.GetTimeoutMs("a.cc") > 0);
+      quarantine.RecordTimeout("a.cc");
+    }
+
+    ParseQuarantine quarantine;
+    quarantine.Load(path);
+    REQUIRE(quarantine.IsQuarantined("a.cc"));
+    REQUIRE(quarantine.Count() == 1);
+    // Quarantined files are indexed without a limit.
+    REQUIRE(quarantine.GetTimeoutMs("a.cc") == 0);
+    REQUIRE(quarantine.GetTimeoutMs("b.cc") > 0);
+    std::remove(path.c_str());
+  }
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+// Remembers translation units which ran out of their parse budget (see
+// Config::Index::parseTimeoutMs), across sessions. A translation unit which
+// times out in |quarantineAfterTimeouts| sessions in a row is quarantined; it
+// is then indexed after every other file and without a time limit, instead of
+// holding an indexer thread at startup only to time out again.
+struct ParseQuarantine {
+  static ParseQuarantine* instance();
+
+  // Reads the state of previous sessions from |path|, which is also where
+  // changes are saved.
+  void Load(const std::string& path);
+
+  // Returns the time limit for indexing |path| in milliseconds, or 0 if there
+  // is none. Quarantined files and files which already timed out in this
+  // session are not limited.
+  int GetTimeoutMs(const std::string& path);
+  bool IsQuarantined(const std::string& path);
+  // Number of quarantined translation units.
+  int Count();
+
+  void RecordTimeout(const std::string& path);
+  // Called when |path| was indexed within the time limit.
+  void RecordSuccess(const std::string& path);
+
+ private:
+  bool IsQuarantinedLocked(const std::string& path) const;
+  void Save();
+
+  std::mutex mutex_;
+  std::string path_;
+  // Number of sessions in a row in which a translation unit timed out.
+  std::unordered_map<std::string, int> timeouts_;
+  std::unordered_set<std::string> timed_out_this_session_;
+};
@@ -53,6 +53,8 @@ PlatformScopedMutexLock::~PlatformScopedMutexLock() = default;
 
 PlatformSharedMemory::~PlatformSharedMemory() = default;
 
+PlatformChildProcess::~PlatformChildProcess() = default;
+
 void MakeDirectoryRecursive(const AbsolutePath& path) {
   if (TryMakeDirectory(path))
     return;
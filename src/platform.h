@@ -21,6 +21,17 @@ struct PlatformSharedMemory {
   size_t capacity;
   std::string name;
 };
+// A child process whose stdin and stdout are pipes to this process. Destroying
+// it kills the child if it is still running.
+struct PlatformChildProcess {
+  virtual ~PlatformChildProcess();
+  // Writes all of |data| to the child's stdin. Returns false if the child is
+  // gone.
+  virtual bool Write(std::string_view data) = 0;
+  // Reads exactly |size| bytes from the child's stdout. Returns false if the
+  // child is gone or closed its stdout first.
+  virtual bool Read(char* buffer, size_t size) = 0;
+};
 
 void PlatformInit();
 
@@ -61,4 +72,10 @@ void TraceMe();
 optional<std::string> RunExecutable(const std::vector<std::string>& command,
                                     std::string_view input);
 
+// Starts |command| connected to this process through pipes. The child shares
+// stderr with this process. Returns null if the process cannot be started or
+// the platform does not support it.
+std::unique_ptr<PlatformChildProcess> StartChildProcess(
+    const std::vector<std::string>& command);
+
 optional<std::string> GetGlobalConfigDirectory();
@@ -42,6 +42,7 @@
 #include <malloc.h>
 #endif
 
+#include <mutex>
 #include <string>
 
 namespace {
@@ -209,8 +210,11 @@ optional<int64_t> GetLastModificationTime(const AbsolutePath& absolute_path) {
 }
 
 void MoveFileTo(const AbsolutePath& dest, const AbsolutePath& source) {
-  // TODO/FIXME - do a real move.
+  // rename replaces |dest| atomically when both are on the same file system.
+  if (rename(source.path.c_str(), dest.path.c_str()) == 0)
+    return;
   CopyFileTo(dest, source);
+  unlink(source.path.c_str());
 }
 
 // See http://stackoverflow.com/q/13198627
@@ -287,6 +291,114 @@ void TraceMe() {
     raise(SIGTSTP);
 }
 
+namespace {
+struct PlatformChildProcessPosix : PlatformChildProcess {
+  pid_t pid;
+  int to_child;
+  int from_child;
+
+  PlatformChildProcessPosix(pid_t pid, int to_child, int from_child)
+      : pid(pid), to_child(to_child), from_child(from_child) {}
+
+  ~PlatformChildProcessPosix() override {
+    close(to_child);
+    close(from_child);
+    kill(pid, SIGKILL);
+    while (waitpid(pid, nullptr, 0) < 0 && errno == EINTR)
+      ;
+  }
+
+  bool Write(std::string_view data) override {
+    while (!data.empty()) {
+      ssize_t written = write(to_child, data.data(), data.size());
+      if (written < 0 && errno == EINTR)
+        continue;
+      if (written <= 0)
+        return false;
+      data.remove_prefix(written);
+    }
+    return true;
+  }
+
+  bool Read(char* buffer, size_t size) override {
+    while (size > 0) {
+      ssize_t n = read(from_child, buffer, size);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return false;
+      buffer += n;
+      size -= n;
+    }
+    return true;
+  }
+};
+
+// Creates a pipe whose ends are closed on exec, so that a child started by
+// another thread does not inherit them. Otherwise a worker's stdout would stay
+// open after it exits and reading from it would never see EOF.
+bool MakeCloseOnExecPipe(int fds[2]) {
+#if defined(__APPLE__)
+  // There is no pipe2; StartChildProcess serializes this with fork instead.
+  if (pipe(fds) != 0)
+    return false;
+  fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+  fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+  return true;
+#else
+  return pipe2(fds, O_CLOEXEC) == 0;
+#endif
+}
+}  // namespace
+
+std::unique_ptr<PlatformChildProcess> StartChildProcess(
+    const std::vector<std::string>& command) {
+  // A child which exits while we write to it must not kill us.
+  signal(SIGPIPE, SIG_IGN);
+
+  // Build argv before forking; only async-signal-safe calls are allowed in the
+  // child of a multithreaded process.
+  std::vector<char*> argv;
+  for (const std::string& arg : command)
+    argv.push_back(const_cast<char*>(arg.c_str()));
+  argv.push_back(nullptr);
+
+  // Where pipes cannot be created with O_CLOEXEC, no other thread may fork
+  // before the flag is set.
+  static std::mutex fork_mutex;
+  std::unique_lock<std::mutex> fork_lock(fork_mutex);
+  int to_child[2], from_child[2];
+  if (!MakeCloseOnExecPipe(to_child))
+    return nullptr;
+  if (!MakeCloseOnExecPipe(from_child)) {
+    close(to_child[0]);
+    close(to_child[1]);
+    return nullptr;
+  }
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    // dup2 clears FD_CLOEXEC on stdin and stdout.
+    dup2(to_child[0], STDIN_FILENO);
+    dup2(from_child[1], STDOUT_FILENO);
+    execv(argv[0], argv.data());
+    _exit(127);
+  }
+  fork_lock.unlock();
+
+  close(to_child[0]);
+  close(from_child[1]);
+  if (pid < 0) {
+    LOG_S(ERROR) << "Failed to start " << command[0] << ": "
+                 << strerror(errno);
+    close(to_child[1]);
+    close(from_child[0]);
+    return nullptr;
+  }
+  return std::make_unique<PlatformChildProcessPosix>(pid, to_child[1],
+                                                     from_child[0]);
+}
+
 optional<std::string> GetGlobalConfigDirectory() {
   char const* xdg_config_home = std::getenv("XDG_CONFIG_HOME");
   char const* home = std::getenv("HOME");
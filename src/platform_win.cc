@@ -181,7 +181,8 @@ optional<int64_t> GetLastModificationTime(const AbsolutePath& absolute_path) {
 }
 
 void MoveFileTo(const AbsolutePath& destination, const AbsolutePath& source) {
-  MoveFile(source.path.c_str(), destination.path.c_str());
+  MoveFileEx(source.path.c_str(), destination.path.c_str(),
+             MOVEFILE_REPLACE_EXISTING | MOVEFILE_COPY_ALLOWED);
 }
 
 void CopyFileTo(const AbsolutePath& destination, const AbsolutePath& source) {
@@ -221,6 +222,12 @@ bool RunObjectiveCIndexTests() {
 // TODO Wait for debugger to attach
 void TraceMe() {}
 
+// TODO Implement with CreateProcess and anonymous pipes.
+std::unique_ptr<PlatformChildProcess> StartChildProcess(
+    const std::vector<std::string>& command) {
+  return nullptr;
+}
+
 optional<std::string> GetGlobalConfigDirectory() {
   wchar_t* roaming_path = NULL;
   optional<std::string> cfg_path = {};
@@ -7,15 +7,19 @@
 #include "compiler.h"
 #include "language.h"
 #include "match.h"
+#include "parse_quarantine.h"
 #include "platform.h"
 #include "queue_manager.h"
 #include "serializers/json.h"
+#include "sharded_map.h"
 #include "timer.h"
 #include "utils.h"
 #include "working_files.h"
 
-#include <clang-c/CXCompilationDatabase.h>
 #include <doctest/doctest.h>
+#include <rapidjson/error/en.h>
+#include <rapidjson/filereadstream.h>
+#include <rapidjson/reader.h>
 #include <rapidjson/writer.h>
 #include <loguru.hpp>
 
@@ -24,10 +28,13 @@
 #endif
 
 #include <optional.h>
+#include <algorithm>
+#include <atomic>
 #include <fstream>
 #include <iostream>
 #include <limits>
 #include <sstream>
+#include <thread>
 #include <unordered_set>
 #include <vector>
 
@@ -45,29 +52,31 @@ namespace {
 
 bool g_disable_normalize_path_for_test = false;
 
+// Safe to use from multiple threads.
 struct NormalizationCache {
   // input path -> normalized path
-  std::unordered_map<std::string, AbsolutePath> paths;
+  ShardedMap<std::string, AbsolutePath> paths;
 
   AbsolutePath Get(const std::string& path) {
-    auto it = paths.find(path);
-    if (it != paths.end())
-      return it->second;
+    optional<AbsolutePath> cached = paths.TryGet(path);
+    if (cached)
+      return *cached;
 
     if (g_disable_normalize_path_for_test) {
       // Add a & so we can test to verify a path is normalized.
-      paths[path] = AbsolutePath("&" + path);
-      return paths[path];
+      AbsolutePath result("&" + path);
+      paths.Set(path, result);
+      return result;
     }
 
     optional<AbsolutePath> normalized = NormalizePath(path);
     if (normalized) {
-      paths[path] = *normalized;
+      paths.Set(path, *normalized);
       return *normalized;
     }
 
     LOG_S(WARNING) << "Failed to normalize " << path;
-    paths[path] = AbsolutePath(path);
+    paths.Set(path, AbsolutePath(path));
     return AbsolutePath(path);
   }
 };
@@ -79,9 +88,13 @@ enum class ProjectMode {
   ExternalCommand
 };
 
+// Entries are built from a ProjectConfig on multiple threads; members that are
+// written during that are guarded by a mutex.
 struct ProjectConfig {
+  std::mutex discovered_system_includes_mutex;
   std::unordered_map<LanguageId, std::vector<std::string>>
       discovered_system_includes;
+  std::mutex dirs_mutex;
   std::unordered_set<Directory> quote_dirs;
   std::unordered_set<Directory> angle_dirs;
   std::vector<std::string> extra_flags;
@@ -97,6 +110,9 @@ const std::vector<std::string>& GetSystemIncludes(
     LanguageId language,
     const std::string& working_directory,
     const std::vector<std::string>& flags) {
+  // Hold the lock during discovery so it only runs once per language.
+  std::lock_guard<std::mutex> lock(
+      project_config->discovered_system_includes_mutex);
   auto it = project_config->discovered_system_includes.find(language);
   if (it != project_config->discovered_system_includes.end())
     return it->second;
@@ -328,26 +344,30 @@ Project::Entry GetCompilationEntryFromCompileCommandEntry(
   std::string compiler_driver = args[i - 1];
   if (FindAnyPartial(compiler_driver, {"/", ".."}))
     compiler_driver = cleanup_maybe_relative_path(compiler_driver).path;
-  result.args.push_back(compiler_driver);
+  std::vector<std::string> result_args;
+  result_args.push_back(compiler_driver);
 
   // Add -working-directory if not provided.
   if (!clang_cl && !AnyStartsWith(args, "-working-directory"))
-    result.args.push_back("-working-directory=" + entry.directory);
+    result_args.push_back("-working-directory=" + entry.directory);
 
   if (!gTestOutputMode) {
     std::vector<const char*> platform = GetPlatformClangArguments();
     for (auto arg : platform)
-      result.args.push_back(arg);
+      result_args.push_back(arg);
   }
 
   bool next_flag_is_path = false;
   bool add_next_flag_to_quote_dirs = false;
   bool add_next_flag_to_angle_dirs = false;
+  // Added to |config| in one go at the end to keep the lock short.
+  std::vector<Directory> quote_dirs;
+  std::vector<Directory> angle_dirs;
 
   // Note that when processing paths, some arguments support multiple forms, ie,
   // {"-Ifoo"} or {"-I", "foo"}.  Support both styles.
 
-  result.args.reserve(args.size() + config->extra_flags.size());
+  result_args.reserve(args.size() + config->extra_flags.size());
   for (; i < args.size(); ++i) {
     std::string arg = args[i];
 
@@ -366,9 +386,9 @@ Project::Entry GetCompilationEntryFromCompileCommandEntry(
     if (next_flag_is_path) {
       AbsolutePath normalized_arg = cleanup_maybe_relative_path(arg);
       if (add_next_flag_to_quote_dirs)
-        config->quote_dirs.insert(Directory(normalized_arg));
+        quote_dirs.push_back(Directory(normalized_arg));
       if (add_next_flag_to_angle_dirs)
-        config->angle_dirs.insert(Directory(normalized_arg));
+        angle_dirs.push_back(Directory(normalized_arg));
       if (clang_cl)
         arg = normalized_arg.path;
 
@@ -394,9 +414,9 @@ Project::Entry GetCompilationEntryFromCompileCommandEntry(
           if (clang_cl || StartsWithAny(arg, kNormalizePathArgs))
             arg = flag_type + path.path;
           if (ShouldAddToQuoteIncludes(flag_type))
-            config->quote_dirs.insert(Directory(path));
+            quote_dirs.push_back(Directory(path));
           if (ShouldAddToAngleIncludes(flag_type))
-            config->angle_dirs.insert(Directory(path));
+            angle_dirs.push_back(Directory(path));
           break;
         }
       }
@@ -414,38 +434,45 @@ Project::Entry GetCompilationEntryFromCompileCommandEntry(
         continue;
     }
 
-    result.args.push_back(arg);
+    result_args.push_back(arg);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(config->dirs_mutex);
+    config->quote_dirs.insert(quote_dirs.begin(), quote_dirs.end());
+    config->angle_dirs.insert(angle_dirs.begin(), angle_dirs.end());
   }
 
   // We don't do any special processing on user-given extra flags.
   for (const auto& flag : config->extra_flags)
-    result.args.push_back(flag);
+    result_args.push_back(flag);
 
   // Add -resource-dir so clang can correctly resolve system includes like
   // <cstddef>
-  if (!clang_cl && !AnyStartsWith(result.args, "-resource-dir") &&
+  if (!clang_cl && !AnyStartsWith(result_args, "-resource-dir") &&
       !config->resource_dir.empty()) {
-    result.args.push_back("-resource-dir=" + config->resource_dir);
+    result_args.push_back("-resource-dir=" + config->resource_dir);
   }
 
   // There could be a clang version mismatch between what the project uses and
   // what cquery uses. Make sure we do not emit warnings for mismatched
   // options.
-  if (!clang_cl && !AnyStartsWith(result.args, "-Wno-unknown-warning-option"))
-    result.args.push_back("-Wno-unknown-warning-option");
+  if (!clang_cl && !AnyStartsWith(result_args, "-Wno-unknown-warning-option"))
+    result_args.push_back("-Wno-unknown-warning-option");
 
   // Using -fparse-all-comments enables documentation in the indexer and in
   // code completion.
   if (!clang_cl && g_config->index.comments > 1 &&
-      !AnyStartsWith(result.args, "-fparse-all-comments")) {
-    result.args.push_back("-fparse-all-comments");
+      !AnyStartsWith(result_args, "-fparse-all-comments")) {
+    result_args.push_back("-fparse-all-comments");
   }
 
   const auto& system_includes = GetSystemIncludes(config, compiler_driver, lang,
-                                                  entry.directory, result.args);
+                                                  entry.directory, result_args);
   for (const auto& flag : system_includes)
-    result.args.push_back(flag);
+    result_args.push_back(flag);
 
+  result.args = InternedArgs(result_args, result.filename);
   return result;
 }
 
@@ -555,13 +582,282 @@ std::vector<Project::Entry> LoadFromDirectoryListing(
   return result;
 }
 
+// Splits the "command" of a compile_commands.json entry into arguments, using
+// the quoting rules clang's JSON compilation database uses on this platform.
+std::vector<std::string> SplitCommandLine(const std::string& command) {
+  std::vector<std::string> result;
+  std::string current;
+  // True if |current| is an argument, even if it is empty (ie, "").
+  bool in_arg = false;
+  auto is_space = [](char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+  };
+
+#if defined(_WIN32)
+  bool in_quotes = false;
+  for (size_t i = 0; i < command.size(); ++i) {
+    char c = command[i];
+    if (c == '\\') {
+      // Backslashes are literal unless they precede a quote.
+      size_t num_backslashes = 0;
+      for (; i < command.size() && command[i] == '\\'; ++i)
+        ++num_backslashes;
+      if (i < command.size() && command[i] == '"') {
+        current.append(num_backslashes / 2, '\\');
+        if (num_backslashes % 2)
+          current += '"';
+        else
+          in_quotes = !in_quotes;
+      } else {
+        current.append(num_backslashes, '\\');
+        --i;
+      }
+      in_arg = true;
+    } else if (c == '"') {
+      in_quotes = !in_quotes;
+      in_arg = true;
+    } else if (!in_quotes && is_space(c)) {
+      if (in_arg)
+        result.push_back(std::move(current));
+      current.clear();
+      in_arg = false;
+    } else {
+      current += c;
+      in_arg = true;
+    }
+  }
+#else
+  for (size_t i = 0; i < command.size(); ++i) {
+    char c = command[i];
+    if (is_space(c)) {
+      if (in_arg)
+        result.push_back(std::move(current));
+      current.clear();
+      in_arg = false;
+      continue;
+    }
+
+    in_arg = true;
+    if (c == '\\') {
+      if (i + 1 < command.size())
+        current += command[++i];
+    } else if (c == '\'') {
+      while (++i < command.size() && command[i] != '\'')
+        current += command[i];
+    } else if (c == '"') {
+      while (++i < command.size() && command[i] != '"') {
+        if (command[i] == '\\' && i + 1 < command.size())
+          ++i;
+        current += command[i];
+      }
+    } else {
+      current += c;
+    }
+  }
+#endif
+
+  if (in_arg)
+    result.push_back(std::move(current));
+  return result;
+}
+
+// SAX handler for compile_commands.json, so large databases are read without
+// building a DOM of the whole file.
+struct CompileCommandsReader
+    : rapidjson::BaseReaderHandler<rapidjson::UTF8<>, CompileCommandsReader> {
+  std::vector<CompileCommandsEntry> entries;
+
+  bool StartObject() {
+    // The database is an array of objects.
+    if (++depth_ == 1)
+      return false;
+    if (depth_ == 2)
+      entries.emplace_back();
+    return true;
+  }
+  bool EndObject(rapidjson::SizeType) {
+    --depth_;
+    return true;
+  }
+  bool StartArray() {
+    ++depth_;
+    return true;
+  }
+  bool EndArray(rapidjson::SizeType) {
+    --depth_;
+    return true;
+  }
+  bool Key(const char* str, rapidjson::SizeType length, bool) {
+    if (depth_ != 2)
+      return true;
+    std::string_view key(str, length);
+    if (key == "directory")
+      field_ = Field::Directory;
+    else if (key == "file")
+      field_ = Field::File;
+    else if (key == "command")
+      field_ = Field::Command;
+    else if (key == "arguments")
+      field_ = Field::Arguments;
+    else
+      field_ = Field::None;
+    return true;
+  }
+  bool String(const char* str, rapidjson::SizeType length, bool) {
+    if (depth_ == 3 && field_ == Field::Arguments) {
+      entries.back().args.emplace_back(str, length);
+      return true;
+    }
+    if (depth_ != 2)
+      return true;
+    switch (field_) {
+      case Field::Directory:
+        entries.back().directory.assign(str, length);
+        break;
+      case Field::File:
+        entries.back().file.assign(str, length);
+        break;
+      case Field::Command:
+        entries.back().command.assign(str, length);
+        break;
+      default:
+        break;
+    }
+    return true;
+  }
+
+ private:
+  enum class Field { None, Directory, File, Command, Arguments };
+  int depth_ = 0;
+  Field field_ = Field::None;
+};
+
+optional<std::vector<CompileCommandsEntry>> ReadCompileCommands(
+    const std::string& path) {
+  FILE* file = fopen(path.c_str(), "rb");
+  if (!file)
+    return nullopt;
+  char buffer[1 << 16];
+  rapidjson::FileReadStream stream(file, buffer, sizeof(buffer));
+  CompileCommandsReader handler;
+  rapidjson::Reader reader;
+  rapidjson::ParseResult ok = reader.Parse(stream, handler);
+  fclose(file);
+  if (!ok) {
+    LOG_S(WARNING) << "Failed to parse " << path << ": "
+                   << rapidjson::GetParseError_En(ok.Code()) << " ("
+                   << ok.Offset() << ")";
+    return nullopt;
+  }
+
+  std::vector<CompileCommandsEntry> result;
+  result.reserve(handler.entries.size());
+  for (CompileCommandsEntry& entry : handler.entries) {
+    if (entry.file.empty())
+      continue;
+    if (entry.args.empty())
+      entry.args = SplitCommandLine(entry.command);
+    entry.command.clear();
+    result.push_back(std::move(entry));
+  }
+  return result;
+}
+
+// Identifies the inputs GetCompilationEntryFromCompileCommandEntry uses for
+// |entry|, so an unchanged command can reuse the entry from the previous load.
+uint64_t FingerprintCompileCommand(const std::string& salt,
+                                   const CompileCommandsEntry& entry) {
+  std::string key = salt;
+  key += entry.directory;
+  key += '\0';
+  key += entry.file;
+  for (const std::string& arg : entry.args) {
+    key += '\0';
+    key += arg;
+  }
+  return HashUsr(key);
+}
+
+// Builds project entries for |commands| on all cores. Entries of |previous|
+// that were built from an identical command are reused as-is. Writes the
+// fingerprint of each result to |fingerprints|.
+std::vector<Project::Entry> ProcessCompileCommands(
+    ProjectConfig* config,
+    std::vector<CompileCommandsEntry>* commands,
+    const Project& previous,
+    std::vector<uint64_t>* fingerprints) {
+  // Everything besides the command itself that affects the result.
+  std::string salt = StringJoin(config->extra_flags) + '\0' +
+                     config->resource_dir + '\0' +
+                     std::to_string((int)config->mode) + '\0' +
+                     std::to_string(g_config->index.comments) + '\0' +
+                     std::to_string(g_config->discoverSystemIncludes) + '\0';
+
+  spp::sparse_hash_map<uint64_t, int> previous_entries;
+  for (int i = 0; i < previous.entry_fingerprints_.size(); ++i) {
+    if (previous.entry_fingerprints_[i])
+      previous_entries[previous.entry_fingerprints_[i]] = i;
+  }
+
+  std::vector<Project::Entry> result(commands->size());
+  std::vector<size_t> to_process;
+  fingerprints->resize(commands->size());
+  for (size_t i = 0; i < commands->size(); ++i) {
+    uint64_t fingerprint = FingerprintCompileCommand(salt, (*commands)[i]);
+    (*fingerprints)[i] = fingerprint;
+    auto it = previous_entries.find(fingerprint);
+    if (it != previous_entries.end())
+      result[i] = previous.entries[it->second];
+    else
+      to_process.push_back(i);
+  }
+
+  // Reused entries do not add their include directories again.
+  if (to_process.size() != commands->size()) {
+    config->quote_dirs.insert(previous.quote_include_directories.begin(),
+                              previous.quote_include_directories.end());
+    config->angle_dirs.insert(previous.angle_include_directories.begin(),
+                              previous.angle_include_directories.end());
+  }
+  LOG_S(INFO) << "Processing " << to_process.size() << " of "
+              << commands->size() << " compile_commands.json entries";
+
+  std::atomic<size_t> next(0);
+  auto process = [&]() {
+    for (size_t i; (i = next++) < to_process.size();) {
+      CompileCommandsEntry& entry = (*commands)[to_process[i]];
+      if (!IsAbsolutePath(entry.file))
+        entry.file = entry.directory + "/" + entry.file;
+      entry.file = config->normalization_cache.Get(entry.file);
+      result[to_process[i]] =
+          GetCompilationEntryFromCompileCommandEntry(config, entry);
+    }
+  };
+  // Small databases are not worth starting threads for.
+  const size_t kEntriesPerThread = 256;
+  size_t num_threads =
+      std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()),
+                       to_process.size() / kEntriesPerThread + 1);
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < num_threads; ++i)
+    threads.emplace_back(process);
+  process();
+  for (std::thread& thread : threads)
+    thread.join();
+
+  return result;
+}
+
 std::vector<Project::Entry> LoadCompilationEntriesFromDirectory(
     ProjectConfig* project,
-    const std::string& opt_compilation_db_dir) {
+    const std::string& opt_compilation_db_dir,
+    const Project& previous,
+    std::vector<uint64_t>* fingerprints) {
   // If there is a .cquery file always load using directory listing.
   // The .cquery file can be in the project or home dir but the project
   // dir takes precedence.
   if (FileExists(project->project_dir + ".cquery")) {
+    fingerprints->clear();
     return LoadFromDirectoryListing(project);
   }
 
@@ -576,8 +872,10 @@ std::vector<Project::Entry> LoadCompilationEntriesFromDirectory(
 // TODO
 #else
     char tmpdir[] = "/tmp/cquery-compdb-XXXXXX";
-    if (!mkdtemp(tmpdir))
+    if (!mkdtemp(tmpdir)) {
+      fingerprints->clear();
       return {};
+    }
     comp_db_dir = tmpdir;
     rapidjson::StringBuffer input;
     rapidjson::Writer<rapidjson::StringBuffer> writer(input);
@@ -592,10 +890,6 @@ std::vector<Project::Entry> LoadCompilationEntriesFromDirectory(
 #endif
   }
 
-  CXCompilationDatabase_Error cx_db_load_error =
-      CXCompilationDatabase_CanNotLoadDatabase;
-  CXCompilationDatabase cx_db = nullptr;
-
   if (!IsAbsolutePath(comp_db_dir)) {
     comp_db_dir =
         project->normalization_cache.Get(project->project_dir + comp_db_dir);
@@ -603,18 +897,17 @@ std::vector<Project::Entry> LoadCompilationEntriesFromDirectory(
 
   EnsureEndsInSlash(comp_db_dir);
 
+  Timer timer;
+  optional<std::vector<CompileCommandsEntry>> commands;
   LOG_S(INFO) << "Trying to load " << comp_db_dir << "compile_commands.json";
-  // Do not call clang_CompilationDatabase_fromDirectory if
-  // compile_commands.json does not exist; it will report an error on stderr.
   if (FileExists(comp_db_dir + "compile_commands.json")) {
-    cx_db = clang_CompilationDatabase_fromDirectory(comp_db_dir.c_str(),
-                                                    &cx_db_load_error);
+    commands = ReadCompileCommands(comp_db_dir + "compile_commands.json");
   } else {
     LOG_S(INFO) << "Trying to load " << project->project_dir
                 << "compile_commands.json";
     if (FileExists(project->project_dir + "compile_commands.json")) {
-      cx_db = clang_CompilationDatabase_fromDirectory(
-          project->project_dir.c_str(), &cx_db_load_error);
+      commands =
+          ReadCompileCommands(project->project_dir + "compile_commands.json");
     }
   }
 
@@ -627,66 +920,17 @@ std::vector<Project::Entry> LoadCompilationEntriesFromDirectory(
 #endif
   }
 
-  if (cx_db_load_error != CXCompilationDatabase_NoError) {
+  if (!commands) {
     LOG_S(INFO) << "Unable to load compile_commands.json located at \""
                 << comp_db_dir << "\"; using directory listing instead.";
+    fingerprints->clear();
     return LoadFromDirectoryListing(project, true);
   }
+  timer.ResetAndPrint("Reading compile_commands.json");
 
-  Timer clang_time;
-  Timer our_time;
-  clang_time.Pause();
-  our_time.Pause();
-
-  clang_time.Resume();
-  CXCompileCommands cx_commands =
-      clang_CompilationDatabase_getAllCompileCommands(cx_db);
-  unsigned int num_commands = clang_CompileCommands_getSize(cx_commands);
-  clang_time.Pause();
-
-  std::vector<Project::Entry> result;
-  for (unsigned int i = 0; i < num_commands; i++) {
-    clang_time.Resume();
-    CXCompileCommand cx_command =
-        clang_CompileCommands_getCommand(cx_commands, i);
-
-    std::string directory =
-        ToString(clang_CompileCommand_getDirectory(cx_command));
-    std::string relative_filename =
-        ToString(clang_CompileCommand_getFilename(cx_command));
-
-    unsigned num_args = clang_CompileCommand_getNumArgs(cx_command);
-    CompileCommandsEntry entry;
-    entry.args.reserve(num_args);
-    for (unsigned j = 0; j < num_args; ++j) {
-      entry.args.push_back(
-          ToString(clang_CompileCommand_getArg(cx_command, j)));
-    }
-    clang_time.Pause();  // TODO: don't call ToString in this block.
-    // LOG_S(INFO) << "Got args " << StringJoin(entry.args);
-
-    our_time.Resume();
-    entry.directory = directory;
-    std::string absolute_filename;
-    if (IsAbsolutePath(relative_filename)) {
-      absolute_filename = relative_filename;
-    } else {
-      absolute_filename = directory + "/" + relative_filename;
-    }
-    entry.file = project->normalization_cache.Get(absolute_filename);
-
-    result.push_back(
-        GetCompilationEntryFromCompileCommandEntry(project, entry));
-    our_time.Pause();
-  }
-
-  clang_time.Resume();
-  clang_CompileCommands_dispose(cx_commands);
-  clang_CompilationDatabase_dispose(cx_db);
-  clang_time.Pause();
-
-  clang_time.ResetAndPrint("compile_commands.json clang time");
-  our_time.ResetAndPrint("compile_commands.json our time");
+  std::vector<Project::Entry> result =
+      ProcessCompileCommands(project, &*commands, previous, fingerprints);
+  timer.ResetAndPrint("Processing compile_commands.json");
   return result;
 }
 
@@ -728,6 +972,21 @@ int ComputeGuessScore(const std::string& a, const std::string& b) {
   return score;
 }
 
+// Upper bound on the number of entries kept per directory for inference, so
+// a lookup never scores more than this many entries.
+const size_t kMaxInferenceCandidates = 64;
+
+// Calls |fn| with every directory containing |path|, deepest first. The last
+// directory is "", which contains every path.
+template <typename TFn>
+void ForEachParentDirectory(const std::string& path, TFn fn) {
+  for (size_t i = path.size(); i > 0; --i) {
+    if (path[i - 1] == '/')
+      fn(path.substr(0, i));
+  }
+  fn(std::string());
+}
+
 }  // namespace
 
 void Project::Load(const AbsolutePath& root_directory) {
@@ -736,10 +995,14 @@ void Project::Load(const AbsolutePath& root_directory) {
   project.extra_flags = g_config->extraClangArguments;
   project.project_dir = root_directory;
   project.resource_dir = g_config->resourceDirectory;
+  std::vector<uint64_t> fingerprints;
   entries = LoadCompilationEntriesFromDirectory(
-      &project, g_config->compilationDatabaseDirectory.empty()
-                    ? "build"
-                    : g_config->compilationDatabaseDirectory);
+      &project,
+      g_config->compilationDatabaseDirectory.empty()
+          ? "build"
+          : g_config->compilationDatabaseDirectory,
+      *this, &fingerprints);
+  entry_fingerprints_ = std::move(fingerprints);
 
   // Cleanup / postprocess include directories.
   quote_include_directories.assign(project.quote_dirs.begin(),
@@ -754,9 +1017,16 @@ void Project::Load(const AbsolutePath& root_directory) {
   }
 
   // Setup project entries.
+  absolute_path_to_entry_index_.clear();
   absolute_path_to_entry_index_.resize(entries.size());
   for (int i = 0; i < entries.size(); ++i)
     absolute_path_to_entry_index_[entries[i].filename] = i;
+
+  std::lock_guard<std::mutex> lock(inferred_entries_mutex_);
+  directory_to_entries_.clear();
+  stem_to_entries_.clear();
+  directory_to_entries_size_ = 0;
+  inferred_entry_index_.clear();
 }
 
 void Project::SetFlagsForFile(const std::vector<std::string>& flags,
@@ -764,14 +1034,18 @@ void Project::SetFlagsForFile(const std::vector<std::string>& flags,
   auto it = absolute_path_to_entry_index_.find(path);
   if (it != absolute_path_to_entry_index_.end()) {
     // The entry already exists in the project, just set the flags.
-    this->entries[it->second].args = flags;
+    this->entries[it->second].args = InternedArgs(flags, path);
+    // The entry no longer matches its command; do not reuse it on reload.
+    if (it->second < entry_fingerprints_.size())
+      entry_fingerprints_[it->second] = 0;
   } else {
     // Entry wasn't found, so we create a new one.
     Entry entry;
     entry.is_inferred = false;
     entry.filename = path;
-    entry.args = flags;
+    entry.args = InternedArgs(flags, path);
     this->entries.emplace_back(entry);
+    absolute_path_to_entry_index_[path] = (int)entries.size() - 1;
   }
 }
 
@@ -781,36 +1055,93 @@ Project::Entry Project::FindCompilationEntryForFile(
   if (it != absolute_path_to_entry_index_.end())
     return entries[it->second];
 
-  // We couldn't find the file. Try to infer it.
-  // TODO: Cache inferred file in a separate array (using a lock or similar)
+  // We couldn't find the file. Try to infer it from the entries in the
+  // closest directory that has any.
   Entry* best_entry = nullptr;
-  int best_score = std::numeric_limits<int>::min();
-  for (Entry& entry : entries) {
-    int score = ComputeGuessScore(filename, entry.filename);
-    if (score > best_score) {
-      best_score = score;
-      best_entry = &entry;
+  {
+    std::lock_guard<std::mutex> lock(inferred_entries_mutex_);
+    if (directory_to_entries_size_ != entries.size()) {
+      directory_to_entries_.clear();
+      stem_to_entries_.clear();
+      inferred_entry_index_.clear();
+      directory_to_entries_size_ = entries.size();
+
+      // Visit shallow entries first so they are the ones kept when a
+      // directory has more than kMaxInferenceCandidates entries.
+      std::vector<std::pair<int, int>> depth_and_index;
+      depth_and_index.reserve(entries.size());
+      for (int i = 0; i < entries.size(); ++i) {
+        const std::string& path = entries[i].filename.path;
+        depth_and_index.emplace_back(
+            (int)std::count(path.begin(), path.end(), '/'), i);
+        stem_to_entries_[StripFileType(GetBaseName(path))].push_back(i);
+      }
+      std::sort(depth_and_index.begin(), depth_and_index.end());
+      for (const auto& it : depth_and_index) {
+        ForEachParentDirectory(
+            entries[it.second].filename.path, [&](std::string&& directory) {
+              std::vector<int>& candidates = directory_to_entries_[directory];
+              if (candidates.size() < kMaxInferenceCandidates)
+                candidates.push_back(it.second);
+            });
+      }
+    }
+
+    auto cached = inferred_entry_index_.find(filename);
+    int best_index = -1;
+    if (cached != inferred_entry_index_.end()) {
+      best_index = cached->second;
+    } else {
+      const std::vector<int>* candidates = nullptr;
+      ForEachParentDirectory(filename.path, [&](std::string&& directory) {
+        if (candidates)
+          return;
+        auto it = directory_to_entries_.find(directory);
+        if (it != directory_to_entries_.end())
+          candidates = &it->second;
+      });
+
+      int best_score = std::numeric_limits<int>::min();
+      auto score_candidates = [&](const std::vector<int>& candidates) {
+        for (int i : candidates) {
+          int score = ComputeGuessScore(filename, entries[i].filename);
+          // Break ties by project order, as a full scan would.
+          if (score > best_score || (score == best_score && i < best_index)) {
+            best_score = score;
+            best_index = i;
+          }
+        }
+      };
+      if (candidates)
+        score_candidates(*candidates);
+      auto same_stem =
+          stem_to_entries_.find(StripFileType(GetBaseName(filename.path)));
+      if (same_stem != stem_to_entries_.end())
+        score_candidates(same_stem->second);
+      inferred_entry_index_[filename] = best_index;
     }
+    if (best_index >= 0)
+      best_entry = &entries[best_index];
   }
 
   Project::Entry result;
   result.is_inferred = true;
   result.filename = filename;
   if (!best_entry) {
-    result.args.push_back("%clang");
-    result.args.push_back(filename);
+    result.args = InternedArgs({"%clang", filename.path}, filename);
   } else {
-    result.args = best_entry->args;
+    std::vector<std::string> args = best_entry->args.Get();
 
     // |best_entry| probably has its own path in the arguments. We need to remap
     // that path to the new filename.
     std::string best_entry_base_name = GetBaseName(best_entry->filename);
-    for (std::string& arg : result.args) {
+    for (std::string& arg : args) {
       if (arg == best_entry->filename.path ||
           GetBaseName(arg) == best_entry_base_name) {
         arg = filename;
       }
     }
+    result.args = InternedArgs(args, filename);
   }
 
   return result;
@@ -836,14 +1167,27 @@ void Project::ForAllFilteredFiles(
 void Project::Index(QueueManager* queue,
                     WorkingFiles* working_files,
                     lsRequestId id) {
+  // Quarantined translation units are indexed after everything else.
+  std::vector<Index_Request> quarantined;
+  ParseQuarantine* quarantine = ParseQuarantine::instance();
   ForAllFilteredFiles([&](int i, const Project::Entry& entry) {
     bool is_interactive =
         working_files->GetFileByFilename(entry.filename) != nullptr;
-    queue->index_request.Enqueue(
-        Index_Request(entry.filename, entry.args, is_interactive, nullopt,
-                      ICacheManager::Make(), id),
-        false /*priority*/);
+    Index_Request request(entry.filename, entry.args, is_interactive, nullopt,
+                          ICacheManager::Make(entry.args.Get()), id);
+    if (g_config->index.reducedFirstPass && !is_interactive)
+      request.fidelity = IndexFidelity::Reduced;
+    if (!is_interactive && quarantine->IsQuarantined(entry.filename)) {
+      quarantined.push_back(std::move(request));
+      return;
+    }
+    queue->index_request.Enqueue(std::move(request), false /*priority*/);
   });
+  if (!quarantined.empty()) {
+    LOG_S(INFO) << "Indexing " << quarantined.size()
+                << " quarantined files last";
+  }
+  queue->index_request.EnqueueAll(std::move(quarantined), false /*priority*/);
 }
 
 TEST_SUITE("Project") {
@@ -863,21 +1207,22 @@ TEST_SUITE("Project") {
     entry.file = file;
     Project::Entry result =
         GetCompilationEntryFromCompileCommandEntry(&project, entry);
+    std::vector<std::string> result_args = result.args.Get();
 
-    if (result.args != expected) {
+    if (result_args != expected) {
       std::cout << "Raw:      " << StringJoin(raw) << std::endl;
       std::cout << "Expected: " << StringJoin(expected) << std::endl;
-      std::cout << "Actual:   " << StringJoin(result.args) << std::endl;
+      std::cout << "Actual:   " << StringJoin(result_args) << std::endl;
     }
-    for (int i = 0; i < std::min(result.args.size(), expected.size()); ++i) {
-      if (result.args[i] != expected[i]) {
+    for (int i = 0; i < std::min(result_args.size(), expected.size()); ++i) {
+      if (result_args[i] != expected[i]) {
         std::cout << std::endl;
         std::cout << "mismatch at " << i << std::endl;
         std::cout << "  expected: " << expected[i] << std::endl;
-        std::cout << "  actual:   " << result.args[i] << std::endl;
+        std::cout << "  actual:   " << result_args[i] << std::endl;
       }
     }
-    REQUIRE(result.args == expected);
+    REQUIRE(result_args == expected);
   }
 
   void CheckFlags(std::vector<std::string> raw,
@@ -1630,6 +1975,16 @@ TEST_SUITE("Project") {
          "-fparse-all-comments"});
   }
 
+#if !defined(_WIN32)
+  TEST_CASE("Split compile command") {
+    REQUIRE(SplitCommandLine("  clang++  -c foo.cc ") ==
+            std::vector<std::string>{"clang++", "-c", "foo.cc"});
+    REQUIRE(SplitCommandLine(R"(clang "-DA=\"b c\"" '-DD=e f' a\ b.cc "")") ==
+            std::vector<std::string>{"clang", "-DA=\"b c\"", "-DD=e f",
+                                     "a b.cc", ""});
+  }
+#endif
+
   TEST_CASE("Directory extraction") {
     ProjectConfig config;
     config.project_dir = "/w/c/s/";
@@ -1677,13 +2032,13 @@ TEST_SUITE("Project") {
     Project p;
     {
       Project::Entry e;
-      e.args = {"arg1"};
+      e.args = InternedArgs({"arg1"});
       e.filename = AbsolutePath("/a/b/c/d/bar.cc");
       p.entries.push_back(e);
     }
     {
       Project::Entry e;
-      e.args = {"arg2"};
+      e.args = InternedArgs({"arg2"});
       e.filename = AbsolutePath("/a/b/c/baz.cc");
       p.entries.push_back(e);
     }
@@ -1693,7 +2048,7 @@ TEST_SUITE("Project") {
       optional<Project::Entry> entry =
           p.FindCompilationEntryForFile(AbsolutePath("/a/b/c/d/new.cc"));
       REQUIRE(entry.has_value());
-      REQUIRE(entry->args == std::vector<std::string>{"arg1"});
+      REQUIRE(entry->args.Get() == std::vector<std::string>{"arg1"});
     }
 
     // Guess at same directory level, when there are child directories.
@@ -1701,7 +2056,7 @@ TEST_SUITE("Project") {
       optional<Project::Entry> entry =
           p.FindCompilationEntryForFile(AbsolutePath("/a/b/c/new.cc"));
       REQUIRE(entry.has_value());
-      REQUIRE(entry->args == std::vector<std::string>{"arg2"});
+      REQUIRE(entry->args.Get() == std::vector<std::string>{"arg2"});
     }
 
     // Guess at new directory (use the closest parent directory).
@@ -1709,15 +2064,35 @@ TEST_SUITE("Project") {
       optional<Project::Entry> entry =
           p.FindCompilationEntryForFile(AbsolutePath("/a/b/c/new/new.cc"));
       REQUIRE(entry.has_value());
-      REQUIRE(entry->args == std::vector<std::string>{"arg2"});
+      REQUIRE(entry->args.Get() == std::vector<std::string>{"arg2"});
+    }
+  }
+
+  TEST_CASE("Entry inference is updated when entries change") {
+    Project p;
+    {
+      Project::Entry e;
+      e.args = InternedArgs({"arg1"});
+      e.filename = AbsolutePath("/a/b/bar.cc");
+      p.entries.push_back(e);
     }
+    REQUIRE(p.FindCompilationEntryForFile(AbsolutePath("/a/b/c/new.h")).args.Get() ==
+            std::vector<std::string>{"arg1"});
+
+    p.SetFlagsForFile({"arg2"}, AbsolutePath("/a/b/c/baz.cc"));
+    REQUIRE(p.FindCompilationEntryForFile(AbsolutePath("/a/b/c/new.h")).args.Get() ==
+            std::vector<std::string>{"arg2"});
+
+    p.SetFlagsForFile({"arg3"}, AbsolutePath("/a/b/c/baz.cc"));
+    REQUIRE(p.FindCompilationEntryForFile(AbsolutePath("/a/b/c/new.h")).args.Get() ==
+            std::vector<std::string>{"arg3"});
   }
 
   TEST_CASE("Entry inference remaps file names") {
     Project p;
     {
       Project::Entry e;
-      e.args = {"a", "b", "aaaa.cc", "d"};
+      e.args = InternedArgs({"a", "b", "aaaa.cc", "d"});
       e.filename = AbsolutePath("absolute/aaaa.cc");
       p.entries.push_back(e);
     }
@@ -1726,27 +2101,47 @@ TEST_SUITE("Project") {
       optional<Project::Entry> entry =
           p.FindCompilationEntryForFile(AbsolutePath("ee.cc"));
       REQUIRE(entry.has_value());
-      REQUIRE(entry->args == std::vector<std::string>{"a", "b", "ee.cc", "d"});
+      REQUIRE(entry->args.Get() == std::vector<std::string>{"a", "b", "ee.cc", "d"});
+    }
+  }
+
+  TEST_CASE("Entry inference finds entries with the same name") {
+    Project p;
+    // More entries than are kept per directory, all as shallow as foo.cc.
+    for (int i = 0; i < 64; ++i) {
+      Project::Entry e;
+      e.args = InternedArgs({"other"});
+      e.filename = AbsolutePath("/p/e/g" + std::to_string(i) + "/x.cc");
+      p.entries.push_back(e);
     }
+    {
+      Project::Entry e;
+      e.args = InternedArgs({"foo"});
+      e.filename = AbsolutePath("/p/e/f/foo.cc");
+      p.entries.push_back(e);
+    }
+
+    REQUIRE(p.FindCompilationEntryForFile(AbsolutePath("/p/e/foo.h"))
+                .args.Get() == std::vector<std::string>{"foo"});
   }
 
   TEST_CASE("Entry inference prefers same file endings") {
     Project p;
     {
       Project::Entry e;
-      e.args = {"arg1"};
+      e.args = InternedArgs({"arg1"});
       e.filename = AbsolutePath("common/simple_browsertest.cc");
       p.entries.push_back(e);
     }
     {
       Project::Entry e;
-      e.args = {"arg2"};
+      e.args = InternedArgs({"arg2"});
       e.filename = AbsolutePath("common/simple_unittest.cc");
       p.entries.push_back(e);
     }
     {
       Project::Entry e;
-      e.args = {"arg3"};
+      e.args = InternedArgs({"arg3"});
       e.filename = AbsolutePath("common/a/simple_unittest.cc");
       p.entries.push_back(e);
     }
@@ -1756,25 +2151,25 @@ TEST_SUITE("Project") {
       optional<Project::Entry> entry =
           p.FindCompilationEntryForFile(AbsolutePath("my_browsertest.cc"));
       REQUIRE(entry.has_value());
-      REQUIRE(entry->args == std::vector<std::string>{"arg1"});
+      REQUIRE(entry->args.Get() == std::vector<std::string>{"arg1"});
     }
     {
       optional<Project::Entry> entry =
           p.FindCompilationEntryForFile(AbsolutePath("my_unittest.cc"));
       REQUIRE(entry.has_value());
-      REQUIRE(entry->args == std::vector<std::string>{"arg2"});
+      REQUIRE(entry->args.Get() == std::vector<std::string>{"arg2"});
     }
     {
       optional<Project::Entry> entry = p.FindCompilationEntryForFile(
           AbsolutePath("common/my_browsertest.cc"));
       REQUIRE(entry.has_value());
-      REQUIRE(entry->args == std::vector<std::string>{"arg1"});
+      REQUIRE(entry->args.Get() == std::vector<std::string>{"arg1"});
     }
     {
       optional<Project::Entry> entry =
           p.FindCompilationEntryForFile(AbsolutePath("common/my_unittest.cc"));
       REQUIRE(entry.has_value());
-      REQUIRE(entry->args == std::vector<std::string>{"arg2"});
+      REQUIRE(entry->args.Get() == std::vector<std::string>{"arg2"});
     }
 
     // Prefer the same directory over matching file-ending.
@@ -1782,7 +2177,7 @@ TEST_SUITE("Project") {
       optional<Project::Entry> entry =
           p.FindCompilationEntryForFile(AbsolutePath("common/a/foo.cc"));
       REQUIRE(entry.has_value());
-      REQUIRE(entry->args == std::vector<std::string>{"arg3"});
+      REQUIRE(entry->args.Get() == std::vector<std::string>{"arg3"});
     }
   }
 }
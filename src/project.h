@@ -1,6 +1,7 @@
 #pragma once
 
 #include "config.h"
+#include "interned_args.h"
 #include "method.h"
 
 #include <optional.h>
@@ -17,7 +18,7 @@ struct WorkingFiles;
 struct Project {
   struct Entry {
     AbsolutePath filename;
-    std::vector<std::string> args;
+    InternedArgs args;
     // If true, this entry is inferred and was not read from disk.
     bool is_inferred = false;
   };
@@ -29,6 +30,26 @@ struct Project {
 
   std::vector<Entry> entries;
   spp::sparse_hash_map<AbsolutePath, int> absolute_path_to_entry_index_;
+  // Fingerprint of the compile_commands.json command each entry was built
+  // from, or 0. Load reuses entries whose command did not change instead of
+  // processing them again.
+  std::vector<uint64_t> entry_fingerprints_;
+
+  // State used to infer entries for files that are not in |entries|, guarded
+  // by |inferred_entries_mutex_|. Rebuilt lazily whenever |entries| changes
+  // size and dropped on Load.
+  std::mutex inferred_entries_mutex_;
+  // Number of entries |directory_to_entries_| was built from.
+  size_t directory_to_entries_size_ = 0;
+  // Directory (ending in '/', or "" for the root of relative paths) to a
+  // bounded set of entries in its subtree, preferring the shallowest ones.
+  spp::sparse_hash_map<std::string, std::vector<int>> directory_to_entries_;
+  // File name without its extension (eg, "foo" for "src/foo.cc") to every
+  // entry with that name. These are scored too, so an entry with the same
+  // name is found even if it is not in the bounded set of its directory.
+  spp::sparse_hash_map<std::string, std::vector<int>> stem_to_entries_;
+  // Memoized index into |entries| of the entry used for inference, or -1.
+  spp::sparse_hash_map<AbsolutePath, int> inferred_entry_index_;
 
   // Loads a project for the given |directory|.
   //
@@ -8,10 +8,12 @@
 #include <optional.h>
 #include <loguru.hpp>
 
+#include <algorithm>
 #include <cassert>
 #include <cstdint>
 #include <functional>
 #include <string>
+#include <tuple>
 #include <unordered_map>
 #include <unordered_set>
 
@@ -36,6 +38,43 @@ void RemoveRange(std::vector<T>* dest, const std::vector<T>& to_remove) {
   RemoveIf(dest, [&](const T& t) { return to_remove_lookup.count(t) > 0; });
 }
 
+template <typename T>
+void ApplyMergeable(std::vector<T>* values,
+                    const std::vector<T>& to_add,
+                    const std::vector<T>& to_remove) {
+  AddRange(values, to_add);
+  RemoveRange(values, to_remove);
+  VerifyUnique(*values);
+}
+void ApplyMergeable(PackedLexicalRefs* values,
+                    const std::vector<QueryId::LexicalRef>& to_add,
+                    const std::vector<QueryId::LexicalRef>& to_remove) {
+  values->Update(to_add, to_remove);
+}
+
+void WriteVarint(std::vector<uint8_t>* out, uint32_t value) {
+  for (; value >= 0x80; value >>= 7)
+    out->push_back(uint8_t(value) | 0x80);
+  out->push_back(uint8_t(value));
+}
+uint32_t ReadVarint(const uint8_t** pos) {
+  uint32_t value = 0;
+  for (int shift = 0;; shift += 7) {
+    uint8_t byte = *(*pos)++;
+    value |= uint32_t(byte & 0x7f) << shift;
+    if (!(byte & 0x80))
+      return value;
+  }
+}
+// Maps integers of small magnitude to small unsigned ones: 0, -1, 1, -2...
+// become 0, 1, 2, 3...
+uint32_t ZigZag(int32_t value) {
+  return (uint32_t(value) << 1) ^ uint32_t(value >> 31);
+}
+int32_t UnZigZag(uint32_t value) {
+  return int32_t(value >> 1) ^ -int32_t(value & 1);
+}
+
 optional<QueryType::Def> ToQuery(const IdMap& id_map,
                                  const IndexType::Def& type) {
   if (type.detailed_name.empty())
@@ -46,10 +85,6 @@ optional<QueryType::Def> ToQuery(const IdMap& id_map,
   result.short_name_offset = type.short_name_offset;
   result.short_name_size = type.short_name_size;
   result.kind = type.kind;
-  if (!type.hover.empty())
-    result.hover = type.hover;
-  if (!type.comments.empty())
-    result.comments = type.comments;
   result.file = id_map.primary_file;
   result.spell = id_map.ToQuery(type.spell);
   result.extent = id_map.ToQuery(type.extent);
@@ -72,10 +107,6 @@ optional<QueryFunc::Def> ToQuery(const IdMap& id_map,
   result.short_name_size = func.short_name_size;
   result.kind = func.kind;
   result.storage = func.storage;
-  if (!func.hover.empty())
-    result.hover = func.hover;
-  if (!func.comments.empty())
-    result.comments = func.comments;
   result.file = id_map.primary_file;
   result.spell = id_map.ToQuery(func.spell);
   result.extent = id_map.ToQuery(func.extent);
@@ -94,10 +125,6 @@ optional<QueryVar::Def> ToQuery(const IdMap& id_map, const IndexVar::Def& var) {
   result.detailed_name = var.detailed_name;
   result.short_name_offset = var.short_name_offset;
   result.short_name_size = var.short_name_size;
-  if (!var.hover.empty())
-    result.hover = var.hover;
-  if (!var.comments.empty())
-    result.comments = var.comments;
   result.file = id_map.primary_file;
   result.spell = id_map.ToQuery(var.spell);
   result.extent = id_map.ToQuery(var.extent);
@@ -224,6 +251,8 @@ QueryFile::DefUpdate BuildFileDefUpdate(const IdMap& id_map,
   def.includes = indexed.includes;
   def.inactive_regions = indexed.skipped_by_preprocessor;
   def.dependencies = indexed.dependencies;
+  def.line_hashes = indexed.line_hashes;
+  def.content_hash = indexed.content_hash;
 
   // Convert enum to markdown compatible strings
   def.language = [&indexed]() {
@@ -311,7 +340,7 @@ QueryFile::DefUpdate BuildFileDefUpdate(const IdMap& id_map,
               return a.range.start < b.range.start;
             });
 
-  return QueryFile::DefUpdate{id_map.primary_file, indexed.file_contents, def};
+  return QueryFile::DefUpdate{id_map.primary_file, def};
 }
 
 Maybe<QueryId::File> GetQueryFileIdFromPath(QueryDatabase* query_db,
@@ -390,25 +419,144 @@ void PushFront(std::vector<T>& v, T&& value) {
 
 }  // namespace
 
+// Each reference is encoded as
+//   (line delta << 1) | new file, [file id + 1 if new file], start column,
+//   lines spanned, end column, id + 1, kind | role << 3
+// where the signed values are zigzag encoded. The line delta is relative to
+// the start line of the previous reference in the same file, or to 0.
+PackedLexicalRefs::iterator::iterator(const uint8_t* pos, const uint8_t* end)
+    : pos_(pos), next_(pos), end_(end) {
+  if (pos_ != end_)
+    Decode();
+}
+
+PackedLexicalRefs::iterator& PackedLexicalRefs::iterator::operator++() {
+  pos_ = next_;
+  if (pos_ != end_)
+    Decode();
+  return *this;
+}
+
+void PackedLexicalRefs::iterator::Decode() {
+  const uint8_t* p = pos_;
+  uint32_t header = ReadVarint(&p);
+  int line = value_.range.start.line;
+  if (header & 1) {
+    value_.file = QueryId::File(ReadVarint(&p) - 1);
+    line = 0;
+  }
+  line += UnZigZag(header >> 1);
+  value_.range.start.line = int16_t(line);
+  value_.range.start.column = int16_t(UnZigZag(ReadVarint(&p)));
+  value_.range.end.line = int16_t(line + UnZigZag(ReadVarint(&p)));
+  value_.range.end.column = int16_t(UnZigZag(ReadVarint(&p)));
+  value_.id = AnyId(ReadVarint(&p) - 1);
+  uint32_t kind_and_role = ReadVarint(&p);
+  value_.kind = static_cast<SymbolKind>(kind_and_role & 7);
+  value_.role = static_cast<Role>(kind_and_role >> 3);
+  next_ = p;
+}
+
+size_t PackedLexicalRefs::size() const {
+  return std::distance(begin(), end());
+}
+
+void PackedLexicalRefs::Update(
+    const std::vector<QueryId::LexicalRef>& to_add,
+    const std::vector<QueryId::LexicalRef>& to_remove) {
+  if (to_add.empty() && to_remove.empty())
+    return;
+
+  auto by_file = [](const QueryId::LexicalRef& a,
+                    const QueryId::LexicalRef& b) { return a.file < b.file; };
+  std::vector<QueryId::LexicalRef> adds = to_add;
+  std::vector<QueryId::LexicalRef> removes = to_remove;
+  std::stable_sort(adds.begin(), adds.end(), by_file);
+  std::stable_sort(removes.begin(), removes.end(), by_file);
+  std::vector<QueryId::File> files;
+  for (const QueryId::LexicalRef& ref : adds)
+    files.push_back(ref.file);
+  for (const QueryId::LexicalRef& ref : removes)
+    files.push_back(ref.file);
+  std::sort(files.begin(), files.end());
+  files.erase(std::unique(files.begin(), files.end()), files.end());
+
+  // Appends the references of |file|, which start with |refs|, once the
+  // changes to it are applied.
+  std::vector<uint8_t> data;
+  data.reserve(data_.size());
+  auto write_file = [&](QueryId::File file,
+                        std::vector<QueryId::LexicalRef>&& refs) {
+    QueryId::LexicalRef key;
+    key.file = file;
+    auto added = std::equal_range(adds.begin(), adds.end(), key, by_file);
+    auto removed =
+        std::equal_range(removes.begin(), removes.end(), key, by_file);
+    ApplyMergeable(
+        &refs, std::vector<QueryId::LexicalRef>(added.first, added.second),
+        std::vector<QueryId::LexicalRef>(removed.first, removed.second));
+    std::sort(refs.begin(), refs.end());
+
+    int line = 0;
+    for (size_t i = 0; i < refs.size(); i++) {
+      const QueryId::LexicalRef& ref = refs[i];
+      bool new_file = i == 0;
+      WriteVarint(&data, ZigZag(ref.range.start.line - line) << 1 | new_file);
+      if (new_file)
+        WriteVarint(&data, ref.file.id + 1);
+      line = ref.range.start.line;
+      WriteVarint(&data, ZigZag(ref.range.start.column));
+      WriteVarint(&data, ZigZag(ref.range.end.line - ref.range.start.line));
+      WriteVarint(&data, ZigZag(ref.range.end.column));
+      WriteVarint(&data, ref.id.id + 1);
+      WriteVarint(&data, uint32_t(ref.kind) | uint32_t(ref.role) << 3);
+    }
+  };
+
+  // Each file's references are encoded on their own, so the files which do
+  // not change are copied as they are.
+  auto next_file = files.begin();
+  for (iterator it = begin(); it != end();) {
+    QueryId::File file = it->file;
+    const uint8_t* file_start = it.pos_;
+    bool changed = next_file != files.end() && *next_file == file;
+    std::vector<QueryId::LexicalRef> refs;
+    for (; it != end() && it->file == file; ++it) {
+      if (changed)
+        refs.push_back(*it);
+    }
+    for (; next_file != files.end() && *next_file < file; ++next_file)
+      write_file(*next_file, {});
+    if (changed) {
+      write_file(file, std::move(refs));
+      ++next_file;
+    } else {
+      data.insert(data.end(), file_start, it.pos_);
+    }
+  }
+  for (; next_file != files.end(); ++next_file)
+    write_file(*next_file, {});
+
+  // Copy rather than move so the capacity is exact.
+  data_ = std::vector<uint8_t>(data.begin(), data.end());
+}
+
 IdMap::IdMap(QueryDatabase* query_db, const IdCache& local_ids)
     : local_ids(local_ids) {
   primary_file =
       *GetQueryFileIdFromPath(query_db, local_ids.primary_file);
 
-  cached_type_ids_.resize(local_ids.type_id_to_usr.size());
-  for (const auto& entry : local_ids.type_id_to_usr)
-    cached_type_ids_[entry.first] =
-        *GetQueryTypeIdFromUsr(query_db, entry.second);
+  cached_type_ids_.reserve(local_ids.type_id_to_usr.size());
+  for (Usr usr : local_ids.type_id_to_usr)
+    cached_type_ids_.push_back(*GetQueryTypeIdFromUsr(query_db, usr));
 
-  cached_func_ids_.resize(local_ids.func_id_to_usr.size());
-  for (const auto& entry : local_ids.func_id_to_usr)
-    cached_func_ids_[entry.first] =
-        *GetQueryFuncIdFromUsr(query_db, entry.second);
+  cached_func_ids_.reserve(local_ids.func_id_to_usr.size());
+  for (Usr usr : local_ids.func_id_to_usr)
+    cached_func_ids_.push_back(*GetQueryFuncIdFromUsr(query_db, usr));
 
-  cached_var_ids_.resize(local_ids.var_id_to_usr.size());
-  for (const auto& entry : local_ids.var_id_to_usr)
-    cached_var_ids_[entry.first] =
-        *GetQueryVarIdFromUsr(query_db, entry.second);
+  cached_var_ids_.reserve(local_ids.var_id_to_usr.size());
+  for (Usr usr : local_ids.var_id_to_usr)
+    cached_var_ids_.push_back(*GetQueryVarIdFromUsr(query_db, usr));
 }
 
 Id<void> IdMap::ToQuery(SymbolKind kind, Id<void> id) const {
@@ -429,16 +577,16 @@ Id<void> IdMap::ToQuery(SymbolKind kind, Id<void> id) const {
 }
 
 QueryId::Type IdMap::ToQuery(IndexId::Type id) const {
-  assert(cached_type_ids_.find(id) != cached_type_ids_.end());
-  return QueryId::Type(cached_type_ids_.find(id)->second);
+  assert(id.id < cached_type_ids_.size());
+  return cached_type_ids_[id.id];
 }
 QueryId::Func IdMap::ToQuery(IndexId::Func id) const {
-  assert(cached_func_ids_.find(id) != cached_func_ids_.end());
-  return QueryId::Func(cached_func_ids_.find(id)->second);
+  assert(id.id < cached_func_ids_.size());
+  return cached_func_ids_[id.id];
 }
 QueryId::Var IdMap::ToQuery(IndexId::Var id) const {
-  assert(cached_var_ids_.find(id) != cached_var_ids_.end());
-  return QueryId::Var(cached_var_ids_.find(id)->second);
+  assert(id.id < cached_var_ids_.size());
+  return cached_var_ids_[id.id];
 }
 
 QueryId::SymbolRef IdMap::ToQuery(IndexId::SymbolRef ref) const {
@@ -795,9 +943,8 @@ void QueryDatabase::ApplyIndexUpdate(IndexUpdate* update) {
 #define HANDLE_MERGEABLE(update_var_name, def_var_name, storage_name) \
   for (auto merge_update : update->update_var_name) {                 \
     auto& def = storage_name[merge_update.id.id];                     \
-    AddRange(&def.def_var_name, merge_update.to_add);                 \
-    RemoveRange(&def.def_var_name, merge_update.to_remove);           \
-    VerifyUnique(def.def_var_name);                                   \
+    ApplyMergeable(&def.def_var_name, merge_update.to_add,            \
+                   merge_update.to_remove);                           \
   }
 
   for (const AbsolutePath& filename : update->files_removed)
@@ -1096,21 +1243,67 @@ TEST_SUITE("query") {
         &previous_map, &current_map, &previous, &current);
 
     db.ApplyIndexUpdate(&import_update);
-    REQUIRE(db.funcs[0].uses.size() == 2);
-    REQUIRE(db.funcs[0].uses[0].range == Range(Position(1, 0)));
-    REQUIRE(db.funcs[0].uses[1].range == Range(Position(2, 0)));
+    std::vector<QueryId::LexicalRef> uses(db.funcs[0].uses.begin(),
+                                          db.funcs[0].uses.end());
+    REQUIRE(uses.size() == 2);
+    REQUIRE(uses[0].range == Range(Position(1, 0)));
+    REQUIRE(uses[1].range == Range(Position(2, 0)));
 
     db.ApplyIndexUpdate(&delta_update);
-    REQUIRE(db.funcs[0].uses.size() == 2);
-    REQUIRE(db.funcs[0].uses[0].range == Range(Position(4, 0)));
-    REQUIRE(db.funcs[0].uses[1].range == Range(Position(5, 0)));
+    uses.assign(db.funcs[0].uses.begin(), db.funcs[0].uses.end());
+    REQUIRE(uses.size() == 2);
+    REQUIRE(uses[0].range == Range(Position(4, 0)));
+    REQUIRE(uses[1].range == Range(Position(5, 0)));
+  }
+
+  TEST_CASE("packed uses") {
+    QueryId::LexicalRef a(Range(Position(300, 4), Position(300, 7)), AnyId(3),
+                          SymbolKind::Func, Role::Read, QueryId::File(1));
+    QueryId::LexicalRef b(Range(Position(12, 0), Position(40, 1)), AnyId(),
+                          SymbolKind::File, Role::Write | Role::Implicit,
+                          QueryId::File(0));
+    QueryId::LexicalRef c(Range(Position(2, 5), Position(2, 9)), AnyId(70000),
+                          SymbolKind::Type, Role::Reference, QueryId::File(1));
+    QueryId::LexicalRef d(Range(Position(-1, 0), Position(-1, 1)), AnyId(1),
+                          SymbolKind::Func, Role::Call, QueryId::File());
+
+    PackedLexicalRefs uses;
+    REQUIRE(uses.empty());
+    uses.Update({a, b, c, d}, {});
+    // Sorted by file, then position.
+    std::vector<QueryId::LexicalRef> expected{b, c, a, d};
+    std::vector<QueryId::LexicalRef> actual(uses.begin(), uses.end());
+    REQUIRE(uses.size() == 4);
+    REQUIRE(actual.size() == 4);
+    for (size_t i = 0; i < expected.size(); i++) {
+      REQUIRE(actual[i] == expected[i]);
+      REQUIRE(actual[i].file == expected[i].file);
+    }
+
+    uses.Update({}, {c, d});
+    actual.assign(uses.begin(), uses.end());
+    REQUIRE(actual.size() == 2);
+    REQUIRE(actual[0] == b);
+    REQUIRE(actual[1] == a);
+    REQUIRE(actual[1].file == a.file);
+
+    // Files are added, changed and emptied without disturbing the others.
+    QueryId::LexicalRef e(Range(Position(1, 0), Position(1, 2)), AnyId(5),
+                          SymbolKind::Var, Role::Read, QueryId::File(2));
+    uses.Update({e, c}, {b});
+    expected = {c, a, e};
+    actual.assign(uses.begin(), uses.end());
+    REQUIRE(actual.size() == 3);
+    for (size_t i = 0; i < expected.size(); i++) {
+      REQUIRE(actual[i] == expected[i]);
+      REQUIRE(actual[i].file == expected[i].file);
+    }
   }
 
   TEST_CASE("Remove variable with usage") {
     auto load_index_from_json = [](const char* json) {
       return Deserialize(SerializeFormat::Json,
-                         AbsolutePath::BuildDoNotUse("foo.cc"), json, "<empty>",
-                         nullopt);
+                         AbsolutePath::BuildDoNotUse("foo.cc"), json, nullopt);
     };
 
     auto previous = load_index_from_json(R"RAW(
@@ -5,7 +5,10 @@
 
 #include <sparsepp/spp.h>
 
+#include <cstdint>
 #include <functional>
+#include <iterator>
+#include <vector>
 
 struct QueryFile;
 struct QueryType;
@@ -45,6 +48,66 @@ struct QueryId {
   using LexicalRef = QueryLexicalRef;
 };
 
+// The uses of a type, func or var, which are the most numerous objects in the
+// database, packed into a byte string. References are sorted by file and
+// position and each is stored as a few varints: the file only when it differs
+// from the previous reference, the start line as a delta from the previous
+// reference in the same file, and kind and role in one integer. Most
+// references take 6-8 bytes instead of sizeof(QueryId::LexicalRef).
+//
+// References are decoded while iterating, so there is no random access.
+struct PackedLexicalRefs {
+  struct iterator {
+    using iterator_category = std::input_iterator_tag;
+    using value_type = QueryId::LexicalRef;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const QueryId::LexicalRef*;
+    using reference = const QueryId::LexicalRef&;
+
+    iterator(const uint8_t* pos, const uint8_t* end);
+
+    reference operator*() const { return value_; }
+    pointer operator->() const { return &value_; }
+    iterator& operator++();
+    iterator operator++(int) {
+      iterator ret = *this;
+      ++*this;
+      return ret;
+    }
+    bool operator==(const iterator& o) const { return pos_ == o.pos_; }
+    bool operator!=(const iterator& o) const { return pos_ != o.pos_; }
+
+   private:
+    friend struct PackedLexicalRefs;
+    void Decode();
+
+    // |value_| is decoded from |pos_|; the next reference starts at |next_|.
+    const uint8_t* pos_;
+    const uint8_t* next_;
+    const uint8_t* end_;
+    QueryId::LexicalRef value_;
+  };
+
+  iterator begin() const {
+    return iterator(data_.data(), data_.data() + data_.size());
+  }
+  iterator end() const {
+    return iterator(data_.data() + data_.size(), data_.data() + data_.size());
+  }
+  bool empty() const { return data_.empty(); }
+  // Decodes every reference.
+  size_t size() const;
+
+  // Same as AddRange(to_add) followed by RemoveRange(to_remove) on a vector.
+  // References are kept sorted by file, so only the files in |to_add| and
+  // |to_remove| are decoded and encoded again.
+  void Update(const std::vector<QueryId::LexicalRef>& to_add,
+              const std::vector<QueryId::LexicalRef>& to_remove);
+
+ private:
+  std::vector<uint8_t> data_;
+};
+
 // There are two sources of reindex updates: the (single) definition of a
 // symbol has changed, or one of many users of the symbol has changed.
 //
@@ -99,7 +162,7 @@ struct QueryFile {
   struct Def {
     QueryId::File file;
     AbsolutePath path;
-    std::vector<std::string> args;
+    InternedArgs args;
     // Language identifier
     std::string language;
     // Includes in the file.
@@ -112,11 +175,15 @@ struct QueryFile {
     std::vector<Range> inactive_regions;
     // Used by |$cquery/freshenIndex|.
     std::vector<AbsolutePath> dependencies;
+    // Line hashes of the indexed contents, used by WorkingFile to map index
+    // positions into the buffer.
+    std::vector<uint64_t> line_hashes;
+    // See IndexFile::content_hash. Used by DocsCache.
+    uint64_t content_hash = 0;
   };
 
   struct DefUpdate {
     QueryId::File id;
-    std::string file_content;
     Def value;
   };
   optional<Def> def;
@@ -135,7 +202,9 @@ MAKE_REFLECT_STRUCT(QueryFile::Def,
                     outline,
                     all_symbols,
                     inactive_regions,
-                    dependencies);
+                    dependencies,
+                    line_hashes,
+                    content_hash);
 
 template <typename TDerived, typename TDefinitionData>
 struct QueryEntity {
@@ -166,7 +235,7 @@ struct QueryType : QueryEntity<QueryType, TypeDefDefinitionData<QueryId>> {
   std::vector<QueryId::LexicalRef> declarations;
   std::vector<QueryId::Type> derived;
   std::vector<QueryId::Var> instances;
-  std::vector<QueryId::LexicalRef> uses;
+  PackedLexicalRefs uses;
 
   explicit QueryType(const Usr& usr) : usr(usr) {}
 };
@@ -179,7 +248,7 @@ struct QueryFunc : QueryEntity<QueryFunc, FuncDefDefinitionData<QueryId>> {
   std::vector<Def> def;
   std::vector<QueryId::LexicalRef> declarations;
   std::vector<QueryId::Func> derived;
-  std::vector<QueryId::LexicalRef> uses;
+  PackedLexicalRefs uses;
 
   explicit QueryFunc(const Usr& usr) : usr(usr) {}
 };
@@ -189,7 +258,7 @@ struct QueryVar : QueryEntity<QueryVar, VarDefDefinitionData<QueryId>> {
   size_t symbol_idx = -1;
   std::vector<Def> def;
   std::vector<QueryId::LexicalRef> declarations;
-  std::vector<QueryId::LexicalRef> uses;
+  PackedLexicalRefs uses;
 
   explicit QueryVar(const Usr& usr) : usr(usr) {}
 };
@@ -335,7 +404,8 @@ struct IdMap {
   // clang-format on
 
  private:
-  spp::sparse_hash_map<IndexId::Type, QueryId::Type> cached_type_ids_;
-  spp::sparse_hash_map<IndexId::Func, QueryId::Func> cached_func_ids_;
-  spp::sparse_hash_map<IndexId::Var, QueryId::Var> cached_var_ids_;
+  // Indexed by the IndexId, like IdCache::*_id_to_usr.
+  std::vector<QueryId::Type> cached_type_ids_;
+  std::vector<QueryId::Func> cached_func_ids_;
+  std::vector<QueryId::Var> cached_var_ids_;
 };
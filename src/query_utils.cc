@@ -139,7 +139,7 @@ std::vector<QueryId::LexicalRef> GetRefsForAllBases(QueryDatabase* db,
         if (!seen.count(func1.usr)) {
           seen.insert(func1.usr);
           stack.push_back(&func1);
-          AddRange(&ret, func1.uses);
+          ret.insert(ret.end(), func1.uses.begin(), func1.uses.end());
         }
       });
     }
@@ -161,7 +161,7 @@ std::vector<QueryId::LexicalRef> GetRefsForAllDerived(QueryDatabase* db,
       if (!seen.count(func1.usr)) {
         seen.insert(func1.usr);
         stack.push_back(&func1);
-        AddRange(&ret, func1.uses);
+        ret.insert(ret.end(), func1.uses.begin(), func1.uses.end());
       }
     });
   }
@@ -8,7 +8,7 @@
 
 Index_Request::Index_Request(
     const AbsolutePath& path,
-    const std::vector<std::string>& args,
+    const InternedArgs& args,
     bool is_interactive,
     const optional<std::string>& contents,
     const std::shared_ptr<ICacheManager>& cache_manager,
@@ -18,7 +18,9 @@ Index_Request::Index_Request(
       is_interactive(is_interactive),
       contents(contents),
       cache_manager(cache_manager),
-      id(id) {}
+      id(id) {
+  trace.Enqueue(path);
+}
 
 Index_DoIdMap::Index_DoIdMap(
     std::unique_ptr<IndexFile> current,
@@ -30,6 +32,7 @@ Index_DoIdMap::Index_DoIdMap(
       is_interactive(is_interactive),
       write_to_disk(write_to_disk) {
   assert(this->current);
+  trace.Enqueue(this->current->path);
 }
 
 Index_OnIdMapped::File::File(std::unique_ptr<IndexFile> file,
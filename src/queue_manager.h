@@ -1,8 +1,10 @@
 #pragma once
 
+#include "docs_cache.h"
 #include "method.h"
 #include "query.h"
 #include "threaded_queue.h"
+#include "trace.h"
 
 #include <memory>
 
@@ -16,15 +18,17 @@ struct Stdout_Request {
 
 struct Index_Request {
   AbsolutePath path;
-  // TODO: make |args| a string that is parsed lazily.
-  std::vector<std::string> args;
+  InternedArgs args;
   bool is_interactive;
   optional<std::string> contents;
   std::shared_ptr<ICacheManager> cache_manager;
   lsRequestId id;
+  // A reduced index is followed by a full index request once it is done.
+  IndexFidelity fidelity = IndexFidelity::Full;
+  PipelineTrace trace;
 
   Index_Request(const AbsolutePath& path,
-                const std::vector<std::string>& args,
+                const InternedArgs& args,
                 bool is_interactive,
                 const optional<std::string>& contents,
                 const std::shared_ptr<ICacheManager>& cache_manager,
@@ -38,6 +42,7 @@ struct Index_DoIdMap {
 
   bool is_interactive = false;
   bool write_to_disk = false;
+  PipelineTrace trace;
 
   Index_DoIdMap(std::unique_ptr<IndexFile> current,
                 const std::shared_ptr<ICacheManager>& cache_manager,
@@ -59,6 +64,8 @@ struct Index_OnIdMapped {
 
   bool is_interactive;
   bool write_to_disk;
+  // Started by the creator once |current| is set.
+  PipelineTrace trace;
 
   Index_OnIdMapped(const std::shared_ptr<ICacheManager>& cache_manager,
                    bool is_interactive,
@@ -67,6 +74,11 @@ struct Index_OnIdMapped {
 
 struct Index_OnIndexed {
   IndexUpdate update;
+  // One per file in |update|, since updates are merged.
+  std::vector<PipelineTrace> traces;
+  // Docs of the files in |update| which were freshly indexed, for
+  // DocsCache::Update.
+  std::vector<IndexFileDocs> docs;
 
   Index_OnIndexed(IndexUpdate&& update);
 };
@@ -1,13 +1,18 @@
 #include "recorder.h"
 
+#include "timer.h"
+
 #include <loguru.hpp>
 
 #include <cassert>
 #include <fstream>
 
+const char kRecordedTimeHeader[] = "Cquery-Time-Ms: ";
+
 namespace {
 std::ofstream* g_file_in = nullptr;
 std::ofstream* g_file_out = nullptr;
+Timer* g_record_timer = nullptr;
 }  // namespace
 
 void EnableRecording(std::string path) {
@@ -38,13 +43,18 @@ void EnableRecording(std::string path) {
     delete g_file_out;
     g_file_in = nullptr;
     g_file_out = nullptr;
+    return;
   }
+  g_record_timer = new Timer();
 }
 
 void RecordInput(std::string_view content) {
   if (!g_file_in)
     return;
-  (*g_file_in) << "Content-Length: " << content.size() << "\r\n\r\n" << content;
+  (*g_file_in) << kRecordedTimeHeader
+               << g_record_timer->ElapsedMicroseconds() / 1000 << "\r\n"
+               << "Content-Length: " << content.size() << "\r\n\r\n"
+               << content;
   (*g_file_in).flush();
 }
 
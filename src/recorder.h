@@ -4,6 +4,10 @@
 
 #include <string>
 
+// Header written before each message in <path>.in holding the milliseconds
+// since recording started, so --replay can reproduce the original timing.
+extern const char kRecordedTimeHeader[];
+
 void EnableRecording(std::string path);
 void RecordInput(std::string_view content);
 void RecordOutput(std::string_view content);
\ No newline at end of file
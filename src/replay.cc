@@ -0,0 +1,398 @@
+#include "replay.h"
+
+#include "lsp.h"
+#include "platform.h"
+#include "queue_manager.h"
+#include "serializers/json.h"
+#include "utils.h"
+#include "work_thread.h"
+
+#include <doctest/doctest.h>
+#include <rapidjson/document.h>
+#include <rapidjson/prettywriter.h>
+#include <rapidjson/stringbuffer.h>
+#include <loguru.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+namespace {
+
+// Ids of the requests replay sends itself to find out when the import pipeline
+// is idle; see WaitForIdle. They count up from here, which clients do not use.
+const int kFirstSyncRequestId = std::numeric_limits<int>::min();
+
+struct RecordedMessage {
+  // Not set for recordings made before timing was recorded.
+  optional<long long> time_ms;
+  std::string method;
+  std::string content;
+};
+
+struct PendingRequest {
+  std::string method;
+  Timer timer;
+};
+
+std::atomic<bool> g_replaying(false);
+ReplayOptions g_options;
+std::vector<RecordedMessage> g_messages;
+
+std::mutex g_mutex;
+// Guarded by |g_mutex|. |g_replay_timer| starts with the first message.
+optional<Timer> g_replay_timer;
+size_t g_sent_messages = 0;
+std::unordered_map<std::string, PendingRequest> g_pending;
+std::map<std::string, std::vector<long long>> g_latencies_us;
+// Time from the first message until the import pipeline was first idle.
+optional<long long> g_import_us;
+int g_next_sync_id = kFirstSyncRequestId;
+std::unordered_set<std::string> g_sync_pending;
+std::unordered_map<std::string, std::string> g_sync_responses;
+std::condition_variable g_sync_cv;
+
+// Returns the method of the JSON-RPC message |content|, if any.
+std::string GetMethod(const std::string& content) {
+  rapidjson::Document document;
+  document.Parse(content.c_str(), content.size());
+  if (document.HasParseError() || !document.IsObject() ||
+      !document.HasMember("method") || !document["method"].IsString())
+    return "";
+  return document["method"].GetString();
+}
+
+std::vector<RecordedMessage> ParseRecording(const std::string& content) {
+  std::vector<RecordedMessage> result;
+  size_t offset = 0;
+  auto read = [&]() -> optional<char> {
+    if (offset >= content.size())
+      return nullopt;
+    return content[offset++];
+  };
+  while (offset < content.size()) {
+    RecordedMessage message;
+    optional<std::string> body = ReadJsonRpcContentFrom(read, &message.time_ms);
+    if (!body)
+      break;
+    message.content = std::move(*body);
+    message.method = GetMethod(message.content);
+    result.push_back(std::move(message));
+  }
+  return result;
+}
+
+// Rewrites the workspace root of the recorded initialize request, both as a
+// uri and as a path, to |root| in every message.
+void RewriteRoot(std::vector<RecordedMessage>* messages,
+                 const AbsolutePath& root) {
+  std::string recorded_uri;
+  for (const RecordedMessage& message : *messages) {
+    if (message.method != "initialize")
+      continue;
+    rapidjson::Document document;
+    document.Parse(message.content.c_str(), message.content.size());
+    if (document.HasMember("params") && document["params"].IsObject() &&
+        document["params"].HasMember("rootUri") &&
+        document["params"]["rootUri"].IsString())
+      recorded_uri = document["params"]["rootUri"].GetString();
+    break;
+  }
+  if (recorded_uri.empty()) {
+    LOG_S(WARNING) << "replay: recording has no rootUri; not rewriting it";
+    return;
+  }
+
+  auto trim = [](std::string path) {
+    while (path.size() > 1 && path.back() == '/')
+      path.pop_back();
+    return path;
+  };
+  lsDocumentUri uri;
+  uri.raw_uri_ = recorded_uri;
+  std::string from_uri = trim(recorded_uri);
+  std::string from_path = trim(uri.GetRawPath());
+  std::string to_uri = trim(lsDocumentUri::FromPath(root).raw_uri_);
+  std::string to_path = trim(root.path);
+
+  // Go through placeholders so that paths which are already rewritten are not
+  // rewritten again. Control characters cannot appear unescaped in JSON.
+  for (RecordedMessage& message : *messages) {
+    message.content = ReplaceAll(message.content, from_uri, "\x01");
+    message.content = ReplaceAll(message.content, from_path, "\x02");
+    message.content = ReplaceAll(message.content, "\x01", to_uri);
+    message.content = ReplaceAll(message.content, "\x02", to_path);
+  }
+}
+
+// Sends |content| to querydb. Responses to |recorded| messages are timed.
+void SendMessage(const std::string& content,
+                 bool recorded,
+                 std::unordered_map<MethodType, Timer>* request_times) {
+  rapidjson::Document document;
+  document.Parse(content.c_str(), content.size());
+  if (document.HasParseError()) {
+    LOG_S(WARNING) << "replay: skipping malformed message";
+    return;
+  }
+  JsonReader json_reader{&document};
+  std::unique_ptr<InMessage> message;
+  optional<std::string> err =
+      MessageRegistry::instance()->Parse(json_reader, &message);
+  if (err) {
+    LOG_S(WARNING) << "replay: skipping message; " << *err;
+    return;
+  }
+
+  // The replay decides when cquery exits.
+  MethodType method_type = message->GetMethodType();
+  if (method_type == kMethodType_Exit)
+    return;
+
+  lsRequestId id = message->GetRequestId();
+  if (recorded) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    if (!g_replay_timer)
+      g_replay_timer = Timer();
+    ++g_sent_messages;
+    if (id.has_value())
+      g_pending[ToString(id)] = PendingRequest{method_type, Timer()};
+  }
+  (*request_times)[method_type] = Timer();
+  QueueManager::instance()->for_querydb.Enqueue(std::move(message),
+                                                false /*priority*/);
+}
+
+// Sends $cquery/wait followed by a request, whose response therefore arrives
+// once the import pipeline is idle. Blocks until then and returns the response.
+std::string WaitForIdle(std::unordered_map<MethodType, Timer>* request_times) {
+  std::string id;
+  {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    id = std::to_string(g_next_sync_id++);
+    g_sync_pending.insert(id);
+  }
+  SendMessage(R"({"jsonrpc":"2.0","method":"$cquery/wait"})",
+              false /*recorded*/, request_times);
+  SendMessage(R"({"jsonrpc":"2.0","id":)" + id +
+                  R"(,"method":"$cquery/metrics"})",
+              false /*recorded*/, request_times);
+
+  std::unique_lock<std::mutex> lock(g_mutex);
+  g_sync_cv.wait(lock, [&]() { return g_sync_responses.count(id) != 0; });
+  std::string response = std::move(g_sync_responses[id]);
+  g_sync_responses.erase(id);
+  if (!g_import_us && g_replay_timer)
+    g_import_us = g_replay_timer->ElapsedMicroseconds();
+  return response;
+}
+
+// |sorted| must not be empty.
+long long Percentile(const std::vector<long long>& sorted, int percentile) {
+  size_t index = (sorted.size() * percentile + 99) / 100;
+  return sorted[std::max<size_t>(index, 1) - 1];
+}
+
+// Prints the report to stdout and writes it to |g_options.report_path|.
+// |metrics| is the result of $cquery/metrics. Requires |g_mutex|.
+void WriteReport(rapidjson::Value* metrics) {
+  long long import_us = g_import_us.value_or(0);
+  rapidjson::StringBuffer output;
+  rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(output);
+  writer.StartObject();
+  writer.Key("recording");
+  writer.String(g_options.path.c_str());
+  writer.Key("speed");
+  writer.Double(g_options.speed);
+  writer.Key("messages");
+  writer.Uint64(g_sent_messages);
+  writer.Key("unanswered");
+  writer.Uint64(g_pending.size());
+  writer.Key("importMs");
+  writer.Double(import_us / 1000.0);
+  writer.Key("methods");
+  writer.StartArray();
+
+  fprintf(stdout, "Replayed %zu messages from %s\n", g_sent_messages,
+          g_options.path.c_str());
+  fprintf(stdout, "%-40s %7s %9s %9s %9s %9s\n", "method", "count", "p50 ms",
+          "p95 ms", "p99 ms", "max ms");
+  for (auto& entry : g_latencies_us) {
+    std::vector<long long>& latencies = entry.second;
+    std::sort(latencies.begin(), latencies.end());
+    double p50 = Percentile(latencies, 50) / 1000.0;
+    double p95 = Percentile(latencies, 95) / 1000.0;
+    double p99 = Percentile(latencies, 99) / 1000.0;
+    double max = latencies.back() / 1000.0;
+    fprintf(stdout, "%-40s %7zu %9.2f %9.2f %9.2f %9.2f\n",
+            entry.first.c_str(), latencies.size(), p50, p95, p99, max);
+
+    writer.StartObject();
+    writer.Key("method");
+    writer.String(entry.first.c_str());
+    writer.Key("count");
+    writer.Uint64(latencies.size());
+    writer.Key("p50Ms");
+    writer.Double(p50);
+    writer.Key("p95Ms");
+    writer.Double(p95);
+    writer.Key("p99Ms");
+    writer.Double(p99);
+    writer.Key("maxMs");
+    writer.Double(max);
+    writer.EndObject();
+  }
+  writer.EndArray();
+  if (metrics) {
+    writer.Key("metrics");
+    metrics->Accept(writer);
+  }
+  writer.EndObject();
+
+  if (!g_pending.empty())
+    fprintf(stdout, "%zu requests were never answered\n", g_pending.size());
+  fprintf(stdout, "Import was done %.2f ms after the first message\n",
+          import_us / 1000.0);
+  fflush(stdout);
+
+  if (!g_options.report_path.empty()) {
+    std::ofstream file(g_options.report_path,
+                       std::ios::out | std::ios::trunc | std::ios::binary);
+    if (!file.good()) {
+      LOG_S(ERROR) << "replay: cannot write to " << g_options.report_path;
+      return;
+    }
+    file << output.GetString();
+  }
+}
+
+}  // namespace
+
+bool LaunchReplayThread(const ReplayOptions& options,
+                        std::unordered_map<MethodType, Timer>* request_times) {
+  optional<AbsolutePath> path = NormalizePath(options.path);
+  optional<std::string> content;
+  if (path)
+    content = ReadContent(*path);
+  if (!content) {
+    fprintf(stderr, "Cannot read recording %s\n", options.path.c_str());
+    return false;
+  }
+  g_messages = ParseRecording(*content);
+  if (!options.root.empty()) {
+    optional<AbsolutePath> root = NormalizePath(options.root);
+    if (!root) {
+      fprintf(stderr, "Cannot find replay root %s\n", options.root.c_str());
+      return false;
+    }
+    RewriteRoot(&g_messages, *root);
+  }
+
+  g_options = options;
+  g_replaying = true;
+  WorkThread::StartThread("replay", [request_times]() {
+    using namespace std::chrono;
+    auto start = steady_clock::now();
+    optional<long long> first_time_ms;
+    for (const RecordedMessage& message : g_messages) {
+      if (g_options.speed > 0 && message.time_ms) {
+        if (!first_time_ms)
+          first_time_ms = message.time_ms;
+        auto offset = duration<double, std::milli>(
+            (*message.time_ms - *first_time_ms) / g_options.speed);
+        std::this_thread::sleep_until(start +
+                                      duration_cast<microseconds>(offset));
+      }
+
+      // $cquery/wait only blocks querydb, so pause the replay as well; later
+      // requests are then timed against an idle pipeline. They keep their
+      // recorded timing relative to the end of the wait.
+      if (message.method == "$cquery/wait") {
+        WaitForIdle(request_times);
+        start = steady_clock::now();
+        first_time_ms = message.time_ms;
+        continue;
+      }
+      SendMessage(message.content, true /*recorded*/, request_times);
+    }
+
+    std::string response = WaitForIdle(request_times);
+    rapidjson::Document document;
+    document.Parse(response.c_str(), response.size());
+    rapidjson::Value* metrics = nullptr;
+    if (!document.HasParseError() && document.IsObject() &&
+        document.HasMember("result"))
+      metrics = &document["result"];
+    std::lock_guard<std::mutex> lock(g_mutex);
+    WriteReport(metrics);
+    exit(0);
+  });
+  return true;
+}
+
+bool IsReplaying() {
+  return g_replaying;
+}
+
+void OnReplayOutput(const std::string& content) {
+  rapidjson::Document document;
+  document.Parse(content.c_str(), content.size());
+  // Only responses are timed; notifications and requests to the client are
+  // not.
+  if (document.HasParseError() || !document.IsObject() ||
+      !document.HasMember("id") || document.HasMember("method"))
+    return;
+  const rapidjson::Value& id = document["id"];
+  std::string key;
+  if (id.IsInt())
+    key = std::to_string(id.GetInt());
+  else if (id.IsString())
+    key = id.GetString();
+  else
+    return;
+
+  std::lock_guard<std::mutex> lock(g_mutex);
+  if (g_sync_pending.erase(key)) {
+    g_sync_responses[key] = content;
+    g_sync_cv.notify_all();
+    return;
+  }
+  auto it = g_pending.find(key);
+  if (it == g_pending.end())
+    return;
+  g_latencies_us[it->second.method].push_back(
+      it->second.timer.ElapsedMicroseconds());
+  g_pending.erase(it);
+}
+
+TEST_SUITE("Replay") {
+  TEST_CASE("parse recording") {
+    std::vector<RecordedMessage> messages = ParseRecording(
+        "Cquery-Time-Ms: 5\r\nContent-Length: 14\r\n\r\n{\"method\":\"a\"}"
+        "Content-Length: 3\r\n\r\n[1]");
+    REQUIRE(messages.size() == 2);
+    REQUIRE(messages[0].time_ms == 5ll);
+    REQUIRE(messages[0].method == "a");
+    REQUIRE(!messages[1].time_ms);
+    REQUIRE(messages[1].method == "");
+    REQUIRE(messages[1].content == "[1]");
+  }
+
+  TEST_CASE("percentile") {
+    std::vector<long long> sorted;
+    for (int i = 1; i <= 100; ++i)
+      sorted.push_back(i);
+    REQUIRE(Percentile(sorted, 50) == 50);
+    REQUIRE(Percentile(sorted, 99) == 99);
+    REQUIRE(Percentile({7}, 50) == 7);
+  }
+}
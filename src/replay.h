@@ -0,0 +1,37 @@
+#pragma once
+
+#include "method.h"
+#include "timer.h"
+
+#include <string>
+#include <unordered_map>
+
+// Benchmarks cquery by feeding it a session recorded with --record instead of
+// reading stdin, then reporting the latency of every request and how long the
+// import took. Runs are deterministic enough to compare between commits.
+
+struct ReplayOptions {
+  // The <path>.in file written by --record.
+  std::string path;
+  // Speed up the recorded timing by this factor. 0 sends every message as
+  // soon as the previous one has been queued.
+  double speed = 1;
+  // If set, paths under the root of the recorded session are rewritten to
+  // point here, so a recording can be replayed against a fixture checkout.
+  std::string root;
+  // If set, the report is also written here as JSON.
+  std::string report_path;
+};
+
+// Starts the thread which replays the session. It takes the place of the stdin
+// thread, and like it, sets |request_times|. Once every message has been sent
+// and the import pipeline is idle, the report is printed and cquery exits. A
+// recorded $cquery/wait pauses the replay until the import pipeline is idle.
+// Returns false if the recording cannot be read.
+bool LaunchReplayThread(const ReplayOptions& options,
+                        std::unordered_map<MethodType, Timer>* request_times);
+
+// True once LaunchReplayThread has been called. Responses should then be passed
+// to OnReplayOutput instead of being written to stdout.
+bool IsReplaying();
+void OnReplayOutput(const std::string& content);
@@ -161,19 +161,23 @@ void Reflect(Writer& visitor, IndexInclude& value) {
   REFLECT_MEMBER_END();
 }
 
-template <typename Def>
-void ReflectHoverAndComments(Reader& visitor, Def& def) {
-  ReflectMember(visitor, "hover", def.hover);
-  ReflectMember(visitor, "comments", def.comments);
+// Hover and comments are stored in a separate docs cache file (see
+// SerializeDocs), so they are only inlined into the index in test mode.
+void ReflectHoverAndComments(Reader& visitor, IndexDocs& docs) {
+  if (!gTestOutputMode)
+    return;
+  ReflectMember(visitor, "hover", docs.hover);
+  ReflectMember(visitor, "comments", docs.comments);
 }
 
-template <typename Def>
-void ReflectHoverAndComments(Writer& visitor, Def& def) {
+void ReflectHoverAndComments(Writer& visitor, IndexDocs& docs) {
+  if (!gTestOutputMode)
+    return;
   // Don't emit empty hover and comments in JSON test mode.
-  if (!gTestOutputMode || !def.hover.empty())
-    ReflectMember(visitor, "hover", def.hover);
-  if (!gTestOutputMode || !def.comments.empty())
-    ReflectMember(visitor, "comments", def.comments);
+  if (!docs.hover.empty())
+    ReflectMember(visitor, "hover", docs.hover);
+  if (!docs.comments.empty())
+    ReflectMember(visitor, "comments", docs.comments);
 }
 
 template <typename Def>
@@ -210,7 +214,7 @@ void Reflect(TVisitor& visitor, IndexType& value) {
   REFLECT_MEMBER2("detailed_name", value.def.detailed_name);
   ReflectShortName(visitor, value.def);
   REFLECT_MEMBER2("kind", value.def.kind);
-  ReflectHoverAndComments(visitor, value.def);
+  ReflectHoverAndComments(visitor, value.docs);
   REFLECT_MEMBER2("declarations", value.declarations);
   REFLECT_MEMBER2("spell", value.def.spell);
   REFLECT_MEMBER2("extent", value.def.extent);
@@ -234,7 +238,7 @@ void Reflect(TVisitor& visitor, IndexFunc& value) {
   ReflectShortName(visitor, value.def);
   REFLECT_MEMBER2("kind", value.def.kind);
   REFLECT_MEMBER2("storage", value.def.storage);
-  ReflectHoverAndComments(visitor, value.def);
+  ReflectHoverAndComments(visitor, value.docs);
   REFLECT_MEMBER2("declarations", value.declarations);
   REFLECT_MEMBER2("spell", value.def.spell);
   REFLECT_MEMBER2("extent", value.def.extent);
@@ -254,7 +258,7 @@ void Reflect(TVisitor& visitor, IndexVar& value) {
   REFLECT_MEMBER2("usr", value.usr);
   REFLECT_MEMBER2("detailed_name", value.def.detailed_name);
   ReflectShortName(visitor, value.def);
-  ReflectHoverAndComments(visitor, value.def);
+  ReflectHoverAndComments(visitor, value.docs);
   REFLECT_MEMBER2("declarations", value.declarations);
   REFLECT_MEMBER2("spell", value.def.spell);
   REFLECT_MEMBER2("extent", value.def.extent);
@@ -268,10 +272,10 @@ void Reflect(TVisitor& visitor, IndexVar& value) {
 // IndexFile
 bool ReflectMemberStart(Writer& visitor, IndexFile& value) {
   // FIXME
-  auto it = value.id_cache.usr_to_type_id.find(HashUsr(""));
-  if (it != value.id_cache.usr_to_type_id.end()) {
-    value.Resolve(it->second)->def.detailed_name = "<fundamental>";
-    assert(value.Resolve(it->second)->uses.size() == 0);
+  if (const IndexId::Type* id =
+          value.id_cache.usr_to_type_id.Find(HashUsr(""))) {
+    value.Resolve(*id)->def.detailed_name = "<fundamental>";
+    assert(value.Resolve(*id)->uses.size() == 0);
   }
 
   DefaultReflectMemberStart(visitor);
@@ -282,9 +286,15 @@ void Reflect(TVisitor& visitor, IndexFile& value) {
   REFLECT_MEMBER_START();
   if (!gTestOutputMode) {
     REFLECT_MEMBER(last_modification_time);
+    REFLECT_MEMBER(content_hash);
+    REFLECT_MEMBER(include_context_hash);
     REFLECT_MEMBER(language);
+    REFLECT_MEMBER(parse_time_ms);
+    REFLECT_MEMBER(tu_memory_mb);
+    REFLECT_MEMBER(fidelity);
     REFLECT_MEMBER(import_file);
     REFLECT_MEMBER(args);
+    REFLECT_MEMBER(line_hashes);
   }
   REFLECT_MEMBER(includes);
   if (!gTestOutputMode)
@@ -349,7 +359,6 @@ std::unique_ptr<IndexFile> Deserialize(
     SerializeFormat format,
     const AbsolutePath& path,
     const std::string& serialized_index_content,
-    const std::string& file_content,
     optional<int> expected_version) {
   if (serialized_index_content.empty())
     return nullptr;
@@ -372,7 +381,6 @@ std::unique_ptr<IndexFile> Deserialize(
         return nullptr;
 
       file = std::make_unique<IndexFile>(path);
-      file->file_contents = file_content;
       JsonReader json_reader{&reader};
       try {
         Reflect(json_reader, *file);
@@ -395,7 +403,6 @@ std::unique_ptr<IndexFile> Deserialize(
                serialized_index_content.size());
         upk.buffer_consumed(serialized_index_content.size());
         file = std::make_unique<IndexFile>(path);
-        file->file_contents = file_content;
         MessagePackReader reader(&upk);
         Reflect(reader, major);
         Reflect(reader, minor);
@@ -414,28 +421,165 @@ std::unique_ptr<IndexFile> Deserialize(
 
   // Restore non-serialized state.
   file->path = path;
-  file->id_cache.primary_file = file->path;
+  // Intern with the translation unit factored out, so the arguments are
+  // shared with the project entry and the other files of the translation
+  // unit.
+  file->args = InternedArgs(file->args.Get(), file->import_file);
+  IdCache& id_cache = file->id_cache;
+  id_cache.primary_file = file->path;
+  id_cache.type_id_to_usr.resize(file->types.size());
+  id_cache.usr_to_type_id.Reserve(file->types.size());
   for (const auto& type : file->types) {
-    file->id_cache.type_id_to_usr[type.id] = type.usr;
-    file->id_cache.usr_to_type_id[type.usr] = type.id;
+    id_cache.type_id_to_usr[type.id.id] = type.usr;
+    id_cache.usr_to_type_id.Set(type.usr, type.id);
   }
+  id_cache.func_id_to_usr.resize(file->funcs.size());
+  id_cache.usr_to_func_id.Reserve(file->funcs.size());
   for (const auto& func : file->funcs) {
-    file->id_cache.func_id_to_usr[func.id] = func.usr;
-    file->id_cache.usr_to_func_id[func.usr] = func.id;
+    id_cache.func_id_to_usr[func.id.id] = func.usr;
+    id_cache.usr_to_func_id.Set(func.usr, func.id);
   }
+  id_cache.var_id_to_usr.resize(file->vars.size());
+  id_cache.usr_to_var_id.Reserve(file->vars.size());
   for (const auto& var : file->vars) {
-    file->id_cache.var_id_to_usr[var.id] = var.usr;
-    file->id_cache.usr_to_var_id[var.usr] = var.id;
+    id_cache.var_id_to_usr[var.id.id] = var.usr;
+    id_cache.usr_to_var_id.Set(var.usr, var.id);
   }
 
   return file;
 }
 
+std::string SerializeDocs(SerializeFormat format,
+                          std::vector<IndexSymbolDocs>& docs) {
+  switch (format) {
+    case SerializeFormat::Json: {
+      rapidjson::StringBuffer output;
+      rapidjson::Writer<rapidjson::StringBuffer> writer(output);
+      JsonWriter json_writer(&writer);
+      std::string version = std::to_string(IndexFile::kMajorVersion);
+      for (char c : version)
+        output.Put(c);
+      output.Put('\n');
+      Reflect(json_writer, docs);
+      return output.GetString();
+    }
+    case SerializeFormat::MessagePack: {
+      msgpack::sbuffer buf;
+      msgpack::packer<msgpack::sbuffer> pk(&buf);
+      MessagePackWriter msgpack_writer(&pk);
+      uint64_t magic = IndexFile::kMajorVersion;
+      int version = IndexFile::kMinorVersion;
+      Reflect(msgpack_writer, magic);
+      Reflect(msgpack_writer, version);
+      Reflect(msgpack_writer, docs);
+      return std::string(buf.data(), buf.size());
+    }
+  }
+  return "";
+}
+
+optional<std::vector<IndexSymbolDocs>> DeserializeDocs(
+    SerializeFormat format,
+    const std::string& serialized_docs) {
+  if (serialized_docs.empty())
+    return nullopt;
+
+  std::vector<IndexSymbolDocs> docs;
+  switch (format) {
+    case SerializeFormat::Json: {
+      const char* p = strchr(serialized_docs.c_str(), '\n');
+      if (!p || atoi(serialized_docs.c_str()) != IndexFile::kMajorVersion)
+        return nullopt;
+      rapidjson::Document reader;
+      reader.Parse(p + 1);
+      if (reader.HasParseError())
+        return nullopt;
+      JsonReader json_reader{&reader};
+      try {
+        Reflect(json_reader, docs);
+      } catch (std::invalid_argument& e) {
+        LOG_S(INFO) << "Failed to deserialize docs " << json_reader.GetPath()
+                    << "." << e.what();
+        return nullopt;
+      }
+      break;
+    }
+
+    case SerializeFormat::MessagePack: {
+      try {
+        int major, minor;
+        msgpack::unpacker upk;
+        upk.reserve_buffer(serialized_docs.size());
+        memcpy(upk.buffer(), serialized_docs.data(), serialized_docs.size());
+        upk.buffer_consumed(serialized_docs.size());
+        MessagePackReader reader(&upk);
+        Reflect(reader, major);
+        Reflect(reader, minor);
+        if (major != IndexFile::kMajorVersion ||
+            minor != IndexFile::kMinorVersion)
+          throw std::invalid_argument("Invalid version");
+        Reflect(reader, docs);
+      } catch (std::invalid_argument& e) {
+        LOG_S(INFO) << "Failed to deserialize msgpack docs: " << e.what();
+        return nullopt;
+      }
+      break;
+    }
+  }
+  return docs;
+}
+
 void SetTestOutputMode() {
   gTestOutputMode = true;
 }
 
 TEST_SUITE("Serializer utils") {
+  TEST_CASE("Docs round trip") {
+    for (SerializeFormat format :
+         {SerializeFormat::Json, SerializeFormat::MessagePack}) {
+      std::vector<IndexSymbolDocs> docs(2);
+      docs[0].kind = SymbolKind::Type;
+      docs[0].usr = 17;
+      docs[0].docs.comments = "/// Foo";
+      docs[1].kind = SymbolKind::Var;
+      docs[1].usr = 18446744073709551615ull;
+      docs[1].docs.hover = "int a = 1";
+
+      optional<std::vector<IndexSymbolDocs>> result =
+          DeserializeDocs(format, SerializeDocs(format, docs));
+      REQUIRE(result);
+      REQUIRE(result->size() == 2);
+      REQUIRE((*result)[0].kind == SymbolKind::Type);
+      REQUIRE((*result)[0].usr == 17);
+      REQUIRE((*result)[0].docs.comments == "/// Foo");
+      REQUIRE((*result)[1].kind == SymbolKind::Var);
+      REQUIRE((*result)[1].usr == 18446744073709551615ull);
+      REQUIRE((*result)[1].docs.hover == "int a = 1");
+    }
+  }
+
+  TEST_CASE("Packed references round trip") {
+    IndexFile file(AbsolutePath::BuildDoNotUse("foo.cc"));
+    IndexVar var(IndexId::Var(0), 42);
+    var.uses.push_back(IndexLexicalRef(Range(Position(300, 4), Position(300, 7)),
+                                       AnyId(3), SymbolKind::Func, Role::Read));
+    var.uses.push_back(IndexLexicalRef(Range(Position(12, 0), Position(40, 1)),
+                                       AnyId(), SymbolKind::File,
+                                       Role::Write | Role::Implicit));
+    var.def.spell = IndexLexicalRef(Range(Position(1, 2), Position(1, 3)),
+                                    AnyId(0), SymbolKind::Func,
+                                    Role::Definition);
+    file.vars.push_back(var);
+
+    std::unique_ptr<IndexFile> result =
+        Deserialize(SerializeFormat::MessagePack, file.path,
+                    Serialize(SerializeFormat::MessagePack, file), nullopt);
+    REQUIRE(result);
+    REQUIRE(result->vars.size() == 1);
+    REQUIRE(result->vars[0].uses == var.uses);
+    REQUIRE(result->vars[0].def.spell == var.def.spell);
+  }
+
   TEST_CASE("GetBaseName") {
     REQUIRE(GetBaseName("foo.cc") == "foo.cc");
     REQUIRE(GetBaseName("foo/foo.cc") == "foo.cc");
@@ -72,6 +72,7 @@ class Writer {
 };
 
 struct IndexFile;
+struct IndexSymbolDocs;
 
 struct optionals_mandatory_tag {};
 
@@ -312,7 +313,14 @@ std::unique_ptr<IndexFile> Deserialize(
     SerializeFormat format,
     const AbsolutePath& path,
     const std::string& serialized_index_content,
-    const std::string& file_content,
     optional<int> expected_version);
 
+// Hover and comments are stored separately from the IndexFile, see
+// IndexFile::CollectDocs.
+std::string SerializeDocs(SerializeFormat format,
+                          std::vector<IndexSymbolDocs>& docs);
+optional<std::vector<IndexSymbolDocs>> DeserializeDocs(
+    SerializeFormat format,
+    const std::string& serialized_docs);
+
 void SetTestOutputMode();
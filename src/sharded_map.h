@@ -0,0 +1,56 @@
+#pragma once
+
+#include <optional.h>
+
+#include <array>
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <utility>
+
+// Hash map split into a fixed number of shards, each guarded by its own
+// reader-writer lock. Threads working on different keys rarely contend, and
+// readers of the same shard do not block each other.
+template <typename TKey, typename TValue, size_t kNumShards = 64>
+struct ShardedMap {
+  using Map = std::unordered_map<TKey, TValue>;
+
+  // Returns a copy of the value for |key|, if any.
+  optional<TValue> TryGet(const TKey& key) {
+    Shard& shard = GetShard(key);
+    std::shared_lock<std::shared_timed_mutex> lock(shard.mutex);
+    auto it = shard.map.find(key);
+    if (it == shard.map.end())
+      return nullopt;
+    return it->second;
+  }
+
+  void Set(const TKey& key, const TValue& value) {
+    Shard& shard = GetShard(key);
+    std::unique_lock<std::shared_timed_mutex> lock(shard.mutex);
+    shard.map[key] = value;
+  }
+
+  // Calls |fn| with the map of the shard that owns |key| while holding that
+  // shard exclusively, so a read-modify-write on |key| is atomic. |fn| must
+  // only touch |key|.
+  template <typename TFn>
+  auto WithLock(const TKey& key, TFn fn) -> decltype(fn(std::declval<Map&>())) {
+    Shard& shard = GetShard(key);
+    std::unique_lock<std::shared_timed_mutex> lock(shard.mutex);
+    return fn(shard.map);
+  }
+
+ private:
+  struct Shard {
+    std::shared_timed_mutex mutex;
+    Map map;
+  };
+
+  Shard& GetShard(const TKey& key) {
+    return shards_[std::hash<TKey>()(key) % kNumShards];
+  }
+
+  std::array<Shard, kNumShards> shards_;
+};
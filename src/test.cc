@@ -269,7 +269,7 @@ void VerifySerializeToFrom(IndexFile* file) {
   std::string serialized = Serialize(SerializeFormat::Json, *file);
   std::unique_ptr<IndexFile> result =
       Deserialize(SerializeFormat::Json, AbsolutePath::BuildDoNotUse("--.cc"),
-                  serialized, "<empty>", nullopt /*expected_version*/);
+                  serialized, nullopt /*expected_version*/);
   std::string actual = result->ToString();
   if (expected != actual) {
     std::cerr << "Serialization failure" << std::endl;
@@ -368,6 +368,7 @@ bool RunIndexTests(const std::string& filter_path, bool enable_update) {
     // Run test.
     FileConsumerSharedState file_consumer_shared;
     auto dbs = Parse(&file_consumer_shared, path, flags, {}, &index,
+                     IndexFidelity::Full, nullptr /*budget*/,
                      false /*dump_ast*/);
     assert(dbs);
 
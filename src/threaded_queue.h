@@ -87,6 +87,10 @@ struct ThreadedQueue : public BaseThreadQueue {
   // Returns the number of elements in the queue. This is lock-free.
   size_t Size() const { return total_count_; }
 
+  // Number of elements ever added to / removed from the queue. Lock-free.
+  long long TotalEnqueued() const { return total_enqueued_; }
+  long long TotalDequeued() const { return total_dequeued_; }
+
   // Add an element to the queue.
   void Enqueue(T&& t, bool priority) {
     {
@@ -96,6 +100,7 @@ struct ThreadedQueue : public BaseThreadQueue {
       else
         queue_.push_back(std::move(t));
       ++total_count_;
+      ++total_enqueued_;
     }
     waiter->cv.notify_one();
   }
@@ -108,6 +113,7 @@ struct ThreadedQueue : public BaseThreadQueue {
     {
       std::lock_guard<std::mutex> lock(mutex);
       total_count_ += elements.size();
+      total_enqueued_ += elements.size();
       for (T& element : elements) {
         if (priority)
           priority_.push_back(std::move(element));
@@ -133,6 +139,7 @@ struct ThreadedQueue : public BaseThreadQueue {
       auto val = std::move(q->front());
       q->pop_front();
       --total_count_;
+      ++total_dequeued_;
       return std::move(val);
     };
     if (!priority_.empty())
@@ -149,6 +156,7 @@ struct ThreadedQueue : public BaseThreadQueue {
       auto val = std::move(q->front());
       q->pop_front();
       --total_count_;
+      ++total_dequeued_;
       return std::move(val);
     };
 
@@ -179,6 +187,8 @@ struct ThreadedQueue : public BaseThreadQueue {
 
  private:
   std::atomic<int> total_count_;
+  std::atomic<long long> total_enqueued_{0};
+  std::atomic<long long> total_dequeued_{0};
   std::deque<T> priority_;
   std::deque<T> queue_;
 };
@@ -6,12 +6,8 @@
 optional<int64_t> TimestampManager::GetLastCachedModificationTime(
     ICacheManager* cache_manager,
     const std::string& path) {
-  {
-    std::lock_guard<std::mutex> guard(mutex_);
-    auto it = timestamps_.find(path);
-    if (it != timestamps_.end())
-      return it->second;
-  }
+  if (optional<int64_t> timestamp = timestamps_.TryGet(path))
+    return timestamp;
   IndexFile* file = cache_manager->TryLoad(path);
   if (!file)
     return nullopt;
@@ -22,6 +18,5 @@ optional<int64_t> TimestampManager::GetLastCachedModificationTime(
 
 void TimestampManager::UpdateCachedModificationTime(const std::string& path,
                                                     int64_t timestamp) {
-  std::lock_guard<std::mutex> guard(mutex_);
-  timestamps_[path] = timestamp;
+  timestamps_.Set(path, timestamp);
 }
@@ -1,9 +1,11 @@
 #pragma once
 
+#include "sharded_map.h"
+
 #include <optional.h>
 
-#include <mutex>
-#include <unordered_map>
+#include <cstdint>
+#include <string>
 
 struct ICacheManager;
 
@@ -16,7 +18,5 @@ struct TimestampManager {
 
   void UpdateCachedModificationTime(const std::string& path, int64_t timestamp);
 
-  // TODO: use std::shared_mutex so we can have multiple readers.
-  std::mutex mutex_;
-  std::unordered_map<std::string, int64_t> timestamps_;
+  ShardedMap<std::string, int64_t> timestamps_;
 };
\ No newline at end of file
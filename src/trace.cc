@@ -0,0 +1,181 @@
+#include "trace.h"
+
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+#include <loguru.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+// Bounds memory use if tracing is left on; later events are dropped.
+const size_t kMaxEvents = 1 << 20;
+
+struct TraceEvent {
+  // Stage or queue name. Always a string literal.
+  const char* name;
+  bool is_wait;
+  int thread;
+  long long start_us;
+  long long duration_us;
+  std::string path;
+};
+
+std::atomic<bool> g_tracing(false);
+std::mutex g_events_mutex;
+std::vector<TraceEvent> g_events;
+size_t g_dropped_events = 0;
+std::string g_write_on_exit_path;
+
+long long NowMicroseconds() {
+  static const auto kStart = std::chrono::steady_clock::now();
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - kStart)
+      .count();
+}
+
+// Small stable id for the calling thread; Chrome shows one track per id.
+int CurrentThread() {
+  static std::atomic<int> next_thread(1);
+  thread_local int thread = next_thread++;
+  return thread;
+}
+
+void AddEvent(TraceEvent event) {
+  std::lock_guard<std::mutex> lock(g_events_mutex);
+  if (g_events.size() >= kMaxEvents) {
+    ++g_dropped_events;
+    return;
+  }
+  g_events.push_back(std::move(event));
+}
+
+void WriteTraceOnExit() {
+  if (!g_write_on_exit_path.empty())
+    WriteTrace(g_write_on_exit_path);
+}
+
+}  // namespace
+
+void StartTracing(const std::string& path) {
+  NowMicroseconds();
+  if (!path.empty()) {
+    if (g_write_on_exit_path.empty())
+      std::atexit(WriteTraceOnExit);
+    g_write_on_exit_path = path;
+  }
+  g_tracing = true;
+}
+
+void StopTracing() {
+  g_tracing = false;
+}
+
+bool IsTracing() {
+  return g_tracing;
+}
+
+optional<size_t> WriteTrace(const std::string& path) {
+  std::ofstream file(path, std::ios::out | std::ios::trunc | std::ios::binary);
+  if (!file.good()) {
+    LOG_S(ERROR) << "Cannot write trace to " << path;
+    return nullopt;
+  }
+
+  std::vector<TraceEvent> events;
+  size_t dropped_events;
+  {
+    std::lock_guard<std::mutex> lock(g_events_mutex);
+    events.swap(g_events);
+    dropped_events = g_dropped_events;
+    g_dropped_events = 0;
+  }
+  LOG_IF_S(WARNING, dropped_events)
+      << "Trace is missing " << dropped_events << " events";
+
+  rapidjson::StringBuffer output;
+  rapidjson::Writer<rapidjson::StringBuffer> writer(output);
+  writer.StartObject();
+  writer.Key("displayTimeUnit");
+  writer.String("ms");
+  writer.Key("traceEvents");
+  writer.StartArray();
+  auto write_event = [&](const TraceEvent& event, const char* phase,
+                         long long timestamp, size_t id) {
+    writer.StartObject();
+    writer.Key("name");
+    writer.String(event.name);
+    writer.Key("cat");
+    writer.String(event.is_wait ? "queue" : "stage");
+    writer.Key("ph");
+    writer.String(phase);
+    writer.Key("ts");
+    writer.Int64(timestamp);
+    writer.Key("pid");
+    writer.Int(1);
+    writer.Key("tid");
+    writer.Int(event.thread);
+    if (event.is_wait) {
+      writer.Key("id");
+      writer.Uint64(id);
+    } else {
+      writer.Key("dur");
+      writer.Int64(event.duration_us);
+    }
+    writer.Key("args");
+    writer.StartObject();
+    writer.Key("file");
+    writer.String(event.path.c_str(), (rapidjson::SizeType)event.path.size());
+    writer.EndObject();
+    writer.EndObject();
+  };
+  for (size_t i = 0; i < events.size(); ++i) {
+    const TraceEvent& event = events[i];
+    // Waits of different files overlap, so they are async slices instead of
+    // slices on a thread.
+    if (event.is_wait) {
+      write_event(event, "b", event.start_us, i);
+      write_event(event, "e", event.start_us + event.duration_us, i);
+    } else {
+      write_event(event, "X", event.start_us, i);
+    }
+  }
+  writer.EndArray();
+  writer.EndObject();
+
+  file << output.GetString();
+  LOG_S(INFO) << "Wrote " << events.size() << " trace events to " << path;
+  return events.size();
+}
+
+void PipelineTrace::Enqueue(const std::string& path) {
+  if (!g_tracing) {
+    mark_us = 0;
+    return;
+  }
+  this->path = path;
+  mark_us = NowMicroseconds();
+}
+
+void PipelineTrace::Dequeue(const char* queue) {
+  if (!g_tracing || !mark_us)
+    return;
+  long long now = NowMicroseconds();
+  AddEvent(TraceEvent{queue, true /*is_wait*/, CurrentThread(), mark_us,
+                      now - mark_us, path});
+  mark_us = now;
+}
+
+void PipelineTrace::EndStage(const char* stage) {
+  if (!g_tracing || !mark_us)
+    return;
+  long long now = NowMicroseconds();
+  AddEvent(TraceEvent{stage, false /*is_wait*/, CurrentThread(), mark_us,
+                      now - mark_us, path});
+  mark_us = now;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <optional.h>
+
+#include <string>
+
+// Per-file timing of the import pipeline, written as Chrome trace-event JSON
+// (open it in chrome://tracing or ui.perfetto.dev). Nothing is recorded until
+// tracing is started with --trace or $cquery/trace.
+
+// Starts recording. If |path| is not empty the trace is written there when
+// cquery exits.
+void StartTracing(const std::string& path = std::string());
+void StopTracing();
+bool IsTracing();
+// Writes the events recorded so far to |path| and forgets them. Returns the
+// number of events written.
+optional<size_t> WriteTrace(const std::string& path);
+
+// Travels with a file through the import pipeline queues, ie, inside of
+// Index_Request, Index_DoIdMap, Index_OnIdMapped and Index_OnIndexed.
+struct PipelineTrace {
+  // Call when the message for |path| is created, just before it is queued.
+  void Enqueue(const std::string& path);
+  // Records the time since Enqueue as a wait in |queue| and starts timing the
+  // stage that dequeued the file.
+  void Dequeue(const char* queue);
+  // Records the time since Dequeue or the previous EndStage as |stage|.
+  void EndStage(const char* stage);
+
+  // Both are only set while tracing.
+  std::string path;
+  long long mark_us = 0;
+};
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Open-addressing hash map from a Usr to a small value, stored in a single
+// flat array with linear probing. Usr values are hashes (or small type kinds
+// for builtin types), so they pick the slot directly. Compared to
+// std::unordered_map there is no allocation per entry and a lookup usually
+// touches one cache line. Entries cannot be removed.
+template <typename TValue>
+struct UsrMap {
+  using Usr = uint64_t;
+
+  // Returns the value stored for |usr|, or null.
+  const TValue* Find(Usr usr) const {
+    if (usr == kEmpty)
+      return has_empty_key_ ? &empty_key_value_ : nullptr;
+    if (slots_.empty())
+      return nullptr;
+    for (size_t i = usr & mask_;; i = (i + 1) & mask_) {
+      const Slot& slot = slots_[i];
+      if (slot.usr == usr)
+        return &slot.value;
+      if (slot.usr == kEmpty)
+        return nullptr;
+    }
+  }
+
+  // Stores |value| for |usr| unless |usr| is already present. Returns the
+  // stored value; |inserted| tells which happened. The pointer is invalidated
+  // by the next insertion.
+  TValue* TryEmplace(Usr usr, const TValue& value, bool* inserted) {
+    *inserted = false;
+    if (usr == kEmpty) {
+      if (!has_empty_key_) {
+        has_empty_key_ = true;
+        empty_key_value_ = value;
+        ++size_;
+        *inserted = true;
+      }
+      return &empty_key_value_;
+    }
+
+    // Keep the load factor at most 3/4 so probe sequences stay short.
+    if ((size_ + 1) * 4 > slots_.size() * 3)
+      Rehash(slots_.empty() ? 16 : slots_.size() * 2);
+    for (size_t i = usr & mask_;; i = (i + 1) & mask_) {
+      Slot& slot = slots_[i];
+      if (slot.usr == usr)
+        return &slot.value;
+      if (slot.usr == kEmpty) {
+        slot.usr = usr;
+        slot.value = value;
+        ++size_;
+        *inserted = true;
+        return &slot.value;
+      }
+    }
+  }
+
+  void Set(Usr usr, const TValue& value) {
+    bool inserted;
+    *TryEmplace(usr, value, &inserted) = value;
+  }
+
+  // Makes room for |count| entries without rehashing.
+  void Reserve(size_t count) {
+    size_t capacity = 16;
+    while (capacity * 3 < count * 4)
+      capacity *= 2;
+    if (capacity > slots_.size())
+      Rehash(capacity);
+  }
+
+  size_t size() const { return size_; }
+
+ private:
+  // Marks a free slot. A real Usr of 0 is kept outside of |slots_|.
+  static constexpr Usr kEmpty = 0;
+
+  struct Slot {
+    Usr usr = kEmpty;
+    TValue value;
+  };
+
+  // |capacity| must be a power of two.
+  void Rehash(size_t capacity) {
+    std::vector<Slot> old_slots(capacity);
+    std::swap(old_slots, slots_);
+    mask_ = capacity - 1;
+    for (Slot& old_slot : old_slots) {
+      if (old_slot.usr == kEmpty)
+        continue;
+      size_t i = old_slot.usr & mask_;
+      while (slots_[i].usr != kEmpty)
+        i = (i + 1) & mask_;
+      slots_[i] = std::move(old_slot);
+    }
+  }
+
+  std::vector<Slot> slots_;
+  size_t mask_ = 0;
+  size_t size_ = 0;
+  bool has_empty_key_ = false;
+  TValue empty_key_value_{};
+};
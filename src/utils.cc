@@ -341,6 +341,27 @@ std::vector<std::string> ToLines(const std::string& content,
   return result;
 }
 
+std::vector<uint64_t> ToLineHashes(std::string_view content) {
+  // Same lines as ToLines(content, true /*trim_whitespace*/), but without
+  // copying |content| or any line.
+  auto is_space = [](char c) { return std::isspace((unsigned char)c) != 0; };
+  std::vector<uint64_t> result;
+  size_t start = 0;
+  while (start < content.size()) {
+    size_t end = content.find('\n', start);
+    if (end == std::string_view::npos)
+      end = content.size();
+    std::string_view line = content.substr(start, end - start);
+    while (!line.empty() && is_space(line.front()))
+      line.remove_prefix(1);
+    while (!line.empty() && is_space(line.back()))
+      line.remove_suffix(1);
+    result.push_back(HashUsr(line));
+    start = end + 1;
+  }
+  return result;
+}
+
 std::string TextReplacer::Apply(const std::string& content) {
   std::string result = content;
 
@@ -528,3 +549,15 @@ TEST_SUITE("StripFileType") {
     REQUIRE(StripFileType("foo/bar.cc") == "foo/bar");
   }
 }
+
+TEST_SUITE("ToLineHashes") {
+  TEST_CASE("matches ToLines") {
+    for (std::string content :
+         {"", "\n", "\n\n", "a", "a\n", "  a \r\nb\n\n\tc  ", " \n x"}) {
+      std::vector<uint64_t> expected;
+      for (const std::string& line : ToLines(content, true /*trim_whitespace*/))
+        expected.push_back(HashUsr(line));
+      REQUIRE(ToLineHashes(content) == expected);
+    }
+  }
+}
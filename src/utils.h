@@ -97,6 +97,9 @@ optional<std::string> ReadContent(const AbsolutePath& filename);
 std::vector<std::string> ReadLinesWithEnding(const AbsolutePath& filename);
 std::vector<std::string> ToLines(const std::string& content,
                                  bool trim_whitespace);
+// Hashes each line of |content| with surrounding whitespace trimmed. This is
+// all WorkingFile needs to map indexed lines onto an edited buffer.
+std::vector<uint64_t> ToLineHashes(std::string_view content);
 
 struct TextReplacer {
   struct Replacement {
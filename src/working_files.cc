@@ -146,16 +146,21 @@ int AlignColumn(const std::string& a, int column, std::string b, bool is_end) {
 // Find matching buffer line of index_lines[line].
 // By symmetry, this can also be used to find matching index line of a buffer
 // line.
+// |index_lines| or |buffer_lines| is empty if the indexed text is unavailable,
+// in which case only line numbers are mapped and |column| is left unchanged.
 optional<int> FindMatchingLine(const std::vector<std::string>& index_lines,
                                const std::vector<int>& index_to_buffer,
                                int line,
                                int* column,
                                const std::vector<std::string>& buffer_lines,
+                               int num_buffer_lines,
                                bool is_end) {
+  bool has_text = !index_lines.empty() && !buffer_lines.empty();
+
   // If this is a confident mapping, returns.
   if (index_to_buffer[line] >= 0) {
     int ret = index_to_buffer[line];
-    if (column)
+    if (column && has_text)
       *column =
           AlignColumn(index_lines[line], *column, buffer_lines[ret], is_end);
     return ret;
@@ -167,12 +172,19 @@ optional<int> FindMatchingLine(const std::vector<std::string>& index_lines,
   }
   while (++down < int(index_to_buffer.size()) && index_to_buffer[down] < 0) {
   }
+  int offset = line - up;
+  int up_line = up < 0 ? -1 : index_to_buffer[up];
   up = up < 0 ? 0 : index_to_buffer[up];
-  down = down >= int(index_to_buffer.size()) ? int(buffer_lines.size()) - 1
+  down = down >= int(index_to_buffer.size()) ? num_buffer_lines - 1
                                              : index_to_buffer[down];
   if (up > down)
     return nullopt;
 
+  // Without text, assume the line kept its distance from the confident line
+  // above.
+  if (!has_text)
+    return std::min(up_line + offset, down);
+
   // Search for lines [up,down] and use Myers's diff algorithm to find the best
   // match (least edit distance).
   int best = up, best_dist = kMaxDiff + 1;
@@ -211,16 +223,29 @@ WorkingFile::WorkingFile(const AbsolutePath& filename,
     : filename(filename), buffer_content(buffer_content) {
   OnBufferContentUpdated();
 
-  // SetIndexContent gets called when the file is opened.
+  // SetIndexLineHashes gets called when the file is opened.
 }
 
-void WorkingFile::SetIndexContent(const std::string& index_content) {
-  index_lines = ToLines(index_content, false /*trim_whitespace*/);
+void WorkingFile::SetIndexLineHashes(std::vector<uint64_t> line_hashes) {
+  index_hashes = std::move(line_hashes);
+  index_lines_.clear();
+  index_lines_loaded_ = false;
 
   index_to_buffer.clear();
   buffer_to_index.clear();
 }
 
+void WorkingFile::LoadIndexLines() {
+  if (index_lines_loaded_)
+    return;
+  index_lines_loaded_ = true;
+
+  // Most of the time the file on disk is what was indexed.
+  optional<std::string> content = ReadContent(filename);
+  if (content && ToLineHashes(*content) == index_hashes)
+    index_lines_ = ToLines(*content, false /*trim_whitespace*/);
+}
+
 void WorkingFile::OnBufferContentUpdated() {
   buffer_lines = ToLines(buffer_content, false /*trim_whitespace*/);
 
@@ -236,18 +261,15 @@ void WorkingFile::OnBufferContentUpdated() {
 // to align other identical lines (but not unique).
 void WorkingFile::ComputeLineMapping() {
   std::unordered_map<uint64_t, int> hash_to_unique;
-  std::vector<uint64_t> index_hashes(index_lines.size());
   std::vector<uint64_t> buffer_hashes(buffer_lines.size());
-  index_to_buffer.resize(index_lines.size());
+  index_to_buffer.resize(index_hashes.size());
   buffer_to_index.resize(buffer_lines.size());
   hash_to_unique.reserve(
       std::max(index_to_buffer.size(), buffer_to_index.size()));
 
   // For index line i, set index_to_buffer[i] to -1 if line i is duplicated.
   int i = 0;
-  for (auto& line : index_lines) {
-    std::string trimmed = Trim(line);
-    uint64_t h = HashUsr(trimmed);
+  for (uint64_t h : index_hashes) {
     auto it = hash_to_unique.find(h);
     if (it == hash_to_unique.end()) {
       hash_to_unique[h] = i;
@@ -257,7 +279,7 @@ void WorkingFile::ComputeLineMapping() {
         index_to_buffer[it->second] = -1;
       index_to_buffer[i] = it->second = -1;
     }
-    index_hashes[i++] = h;
+    i++;
   }
 
   // For buffer line i, set buffer_to_index[i] to -1 if line i is duplicated.
@@ -328,18 +350,19 @@ optional<int> WorkingFile::GetBufferPosFromIndexPos(int line,
 
   // TODO: reenable this assert once we are using the real indexed file.
   // assert(index_line >= 1 && index_line <= index_lines.size());
-  if (line < 0 || line >= (int)index_lines.size()) {
+  if (line < 0 || line >= (int)index_hashes.size()) {
     loguru::Text stack = loguru::stacktrace();
     LOG_S(WARNING) << "Bad index_line (got " << line << ", expected [0, "
-                   << index_lines.size() << ")) in " << filename
+                   << index_hashes.size() << ")) in " << filename
                    << stack.c_str();
     return nullopt;
   }
 
   if (index_to_buffer.empty())
     ComputeLineMapping();
-  return FindMatchingLine(index_lines, index_to_buffer, line, column,
-                          buffer_lines, is_end);
+  LoadIndexLines();
+  return FindMatchingLine(index_lines_, index_to_buffer, line, column,
+                          buffer_lines, (int)buffer_lines.size(), is_end);
 }
 
 optional<int> WorkingFile::GetIndexPosFromBufferPos(int line,
@@ -351,8 +374,16 @@ optional<int> WorkingFile::GetIndexPosFromBufferPos(int line,
 
   if (buffer_to_index.empty())
     ComputeLineMapping();
+  LoadIndexLines();
   return FindMatchingLine(buffer_lines, buffer_to_index, line, column,
-                          index_lines, is_end);
+                          index_lines_, (int)index_hashes.size(), is_end);
+}
+
+optional<std::string_view> WorkingFile::GetIndexLine(int line) {
+  LoadIndexLines();
+  if (line < 0 || line >= (int)index_lines_.size())
+    return nullopt;
+  return std::string_view(index_lines_[line]);
 }
 
 std::string WorkingFile::FindClosestCallNameInBuffer(
@@ -566,6 +597,18 @@ lsPosition CharPos(const WorkingFile& file,
 }
 
 TEST_SUITE("WorkingFile") {
+  TEST_CASE("line mapping from hashes") {
+    // foo.cc does not exist on disk, so only the line hashes are known.
+    WorkingFile f(AbsolutePath::BuildDoNotUse("foo.cc"),
+                  "int x;\nint a;\nint y;\nint c;\n");
+    f.SetIndexLineHashes(ToLineHashes("int a;\n  int b;\nint c;\n"));
+    REQUIRE(!f.GetIndexLine(0));
+    REQUIRE(f.GetBufferPosFromIndexPos(0, nullptr, false) == 1);
+    REQUIRE(f.GetBufferPosFromIndexPos(1, nullptr, false) == 2);
+    REQUIRE(f.GetBufferPosFromIndexPos(2, nullptr, false) == 3);
+    REQUIRE(f.GetIndexPosFromBufferPos(3, nullptr, false) == 2);
+  }
+
   TEST_CASE("simple call") {
     WorkingFile f(AbsolutePath::BuildDoNotUse("foo.cc"), "abcd(1, 2");
     int active_param = 0;
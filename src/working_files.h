@@ -5,6 +5,7 @@
 
 #include <clang-c/Index.h>
 #include <optional.h>
+#include <string_view.h>
 
 #include <mutex>
 #include <string>
@@ -14,8 +15,9 @@ struct WorkingFile {
   AbsolutePath filename;
 
   std::string buffer_content;
+  // Hashes of the trimmed lines of the indexed contents (see ToLineHashes).
   // Note: This assumes 0-based lines (1-based lines are normally assumed).
-  std::vector<std::string> index_lines;
+  std::vector<uint64_t> index_hashes;
   // Note: This assumes 0-based lines (1-based lines are normally assumed).
   std::vector<std::string> buffer_lines;
   // Mappings between index line number and buffer line number.
@@ -34,7 +36,7 @@ struct WorkingFile {
   WorkingFile(const AbsolutePath& filename, const std::string& buffer_content);
 
   // This should be called when the indexed content has changed.
-  void SetIndexContent(const std::string& index_content);
+  void SetIndexLineHashes(std::vector<uint64_t> line_hashes);
   // This should be called whenever |buffer_content| has changed.
   void OnBufferContentUpdated();
 
@@ -46,6 +48,9 @@ struct WorkingFile {
   // Finds the index line number which maps to buffer line number |line|.
   // Also resolves |column| if not NULL.
   optional<int> GetIndexPosFromBufferPos(int line, int* column, bool is_end);
+  // Returns the text of index line |line| if it is available; see
+  // |index_lines_|.
+  optional<std::string_view> GetIndexLine(int line);
 
   // TODO: Move FindClosestCallNameInBuffer and FindStableCompletionSource into
   // lex_utils.h/cc
@@ -77,6 +82,14 @@ struct WorkingFile {
  private:
   // Compute index_to_buffer and buffer_to_index.
   void ComputeLineMapping();
+  // Loads |index_lines_| on first use.
+  void LoadIndexLines();
+
+  // Text of the indexed contents. The index only stores line hashes, so this
+  // is read back from disk when column alignment or fuzzy line matching needs
+  // it, and stays empty if the file on disk no longer matches |index_hashes|.
+  std::vector<std::string> index_lines_;
+  bool index_lines_loaded_ = false;
 };
 
 struct WorkingFiles {